@@ -7,19 +7,22 @@ CPP_SRCS += \
 ../src/tools/Config.cpp \
 ../src/tools/DataReaders.cpp \
 ../src/tools/FileSystemTools.cpp \
-../src/tools/SystemTools.cpp 
+../src/tools/SystemTools.cpp \
+../src/tools/ThreadPool.cpp 
 
 OBJS += \
 ./src/tools/Config.o \
 ./src/tools/DataReaders.o \
 ./src/tools/FileSystemTools.o \
-./src/tools/SystemTools.o 
+./src/tools/SystemTools.o \
+./src/tools/ThreadPool.o 
 
 CPP_DEPS += \
 ./src/tools/Config.d \
 ./src/tools/DataReaders.d \
 ./src/tools/FileSystemTools.d \
-./src/tools/SystemTools.d 
+./src/tools/SystemTools.d \
+./src/tools/ThreadPool.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -23,8 +23,58 @@ def SavingOriginalWeights(model, path):
     for i in range(len(layers)):
         config = layers[i].get_config() 
         print( config.get("name") )
+        #printing batch normalization parameters. gamma and beta are missing if scale or center is off
+        if type(layers[i]).__name__ == "BatchNormalization":
+            weights = layers[i].get_weights()
+            moving_mean, moving_variance = weights[-2], weights[-1]
+            idx = 0
+            gamma = np.ones(moving_mean.shape)
+            if config.get("scale"):
+                gamma = weights[idx]
+                idx += 1
+            beta = np.zeros(moving_mean.shape)
+            if config.get("center"):
+                beta = weights[idx]
+            for suffix, values in (("_gamma", gamma), ("_beta", beta), ("_moving_mean", moving_mean), ("_moving_variance", moving_variance)):
+                strName = os.path.join( path, config.get("name")+suffix+".txt" )
+                if not to_sysout:
+                    np.savetxt(strName, values, newline = ' ', fmt='%f')
+
+        #printing depthwise kernels. The names of these layers contain conv2d as well
+        #separable convolutions are split in a depthwise and a pointwise (1x1) convolution
+        elif type(layers[i]).__name__ in ("DepthwiseConv2D", "SeparableConv2D"):
+            weights = layers[i].get_weights()
+            separable = type(layers[i]).__name__ == "SeparableConv2D"
+            depthwise = weights[0]
+            nomChannels = depthwise.shape[2]
+            depthMultiplier = depthwise.shape[3]
+            outChannels = nomChannels * depthMultiplier
+            if separable:
+                pointwise = weights[1]
+                nomFilters = pointwise.shape[3]
+                bias = weights[2] if config.get("use_bias") else np.zeros(nomFilters)
+                name = config.get("name") + "_depthwise"
+                depthwiseBias = np.zeros(outChannels)
+            else:
+                name = config.get("name")
+                depthwiseBias = weights[1] if config.get("use_bias") else np.zeros(outChannels)
+            for c in range(nomChannels):
+                for d in range(depthMultiplier):
+                    LayerWeights = np.append(depthwise[:,:,c,d], depthwiseBias[c * depthMultiplier + d])
+                    strName = os.path.join( path, name+"-"+str(c)+"_"+str(d)+".txt" )
+                    if not to_sysout:
+                        np.savetxt(strName, LayerWeights, newline = ' ', fmt='%f')
+            if separable:
+                name = config.get("name") + "_pointwise"
+                for c in range(outChannels):
+                    for j in range(nomFilters):
+                        LayerWeights = np.append(pointwise[:,:,c,j], bias[j])
+                        strName = os.path.join( path, name+"-"+str(c)+"_"+str(j)+".txt" )
+                        if not to_sysout:
+                            np.savetxt(strName, LayerWeights, newline = ' ', fmt='%f')
+
         #printing convolutional layers weights
-        if str(config.get("name")).find("conv2d") > -1:            
+        elif str(config.get("name")).find("conv2d") > -1:            
             weights = np.array(layers[i].get_weights())                        
             kernel_size = config.get("kernel_size")
             nomFilters = config.get("filters")
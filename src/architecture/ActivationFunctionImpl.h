@@ -26,6 +26,21 @@ public:
 
 	virtual void activate( T& in ) = 0;
 
+	/**
+	 * @brief Multiplicative depth of the activation: the longest chain of multiplications (with ciphertexts or
+	 * constants) an input goes through. 0 by default.
+	 */
+	virtual uint depth() {
+		return 0;
+	}
+
+	/**
+	 * @brief Degree k with activate( s * x ) == s^k * activate( x ) for every s > 0, so a scale can pass through the
+	 * activation. 0 if there is no such k, which is the default.
+	 */
+	virtual uint degree() {
+		return 0;
+	}
 
 	static std::shared_ptr<Activation<T>> getSharedPointer() {
 		return nullptr;
@@ -51,6 +66,10 @@ public:
 		return std::make_shared<LinearActivation<T>>();
 	}
 
+	uint degree() override {
+		return 1;
+	}
+
 };
 
 template<class T>
@@ -66,6 +85,14 @@ public:
 		return std::make_shared<SquareActivation<T>>();
 	}
 
+	uint depth() override {
+		return 1;
+	}
+
+	uint degree() override {
+		return 2;
+	}
+
 };
 
 /**
@@ -121,6 +148,11 @@ public:
 		return std::make_shared<PolynomialActivation<T>>(a,b,c,tensor);
 	}
 
+	// the highest power times its coefficient
+	uint depth() override {
+		return 2;
+	}
+
 
 
 };
@@ -192,6 +224,11 @@ public:
 		return std::make_shared<PolynomialActivationDegree3<T>>(a,b,c,d,tensor);
 	}
 
+	// the highest power times its coefficient
+	uint depth() override {
+		return 3;
+	}
+
 
 };
 
@@ -264,6 +301,11 @@ public:
 		return std::make_shared<SquareActivation<T>>();
 	}
 
+	// the highest power times its coefficient
+	uint depth() override {
+		return 4;
+	}
+
 };
 
 
@@ -280,6 +322,10 @@ public:
 		in = std::max( in, zero );
 	}
 
+	uint degree() override {
+		return 1;
+	}
+
 };
 
 template<class T>
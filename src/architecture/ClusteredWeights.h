@@ -0,0 +1,194 @@
+/*
+ * ClusteredWeights.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef ARCHITECTURE_CLUSTEREDWEIGHTS_H_
+#define ARCHITECTURE_CLUSTEREDWEIGHTS_H_
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include "Tensor.h"
+
+/**
+ * @brief Groups the weights of every row (neuron, filter) by their value. The tensor is viewed as a
+ * matrix with one row per output unit, like SparseWeights. Every row holds a list of groups; a group is a
+ * codeword and the columns of the row that carry it. A kernel adds up the inputs of a group first and
+ * multiplies the sum with the codeword once, which costs one multiplication per distinct value in the row
+ * instead of one per weight. Codewords that are zero get no group at all.
+ *
+ * The codebook holds the distinct values of the tensor. Use quantize() first to limit it to a small number
+ * of values if the weights were not quantized already.
+ */
+template<class WeightType>
+class ClusteredWeights {
+public:
+	ClusteredWeights( TensorP<WeightType> weights, size_t rows ) : mRows( rows ), mRowStart( rows + 1, 0 ), mGroupStart( 1, 0 ) {
+		if ( rows == 0 || weights->shape.capacity() % rows != 0 )
+			throw std::logic_error( "weights can not be split into the requested number of rows" );
+		mRowLength = weights->shape.capacity() / rows;
+
+		std::map<WeightType, size_t> codewordIdx;
+		for ( size_t i = 0; i < weights->shape.capacity(); ++i )
+			codewordIdx.emplace( ( *weights )[ (long) i ], 0 );
+		for ( auto& entry : codewordIdx ) {
+			entry.second = mCodebook.size();
+			mCodebook.push_back( entry.first );
+		}
+
+		std::vector<std::vector<size_t>> columns( mCodebook.size() );
+		for ( size_t row = 0; row < rows; ++row ) {
+			for ( size_t col = 0; col < mRowLength; ++col ) {
+				WeightType w = ( *weights )[ (long) ( row * mRowLength + col ) ];
+				if ( w == 0 )
+					continue;
+				columns[ codewordIdx[ w ] ].push_back( col );
+			}
+			for ( size_t c = 0; c < columns.size(); ++c ) {
+				if ( columns[ c ].empty() )
+					continue;
+				mGroupCodeword.push_back( c );
+				mColumns.insert( mColumns.end(), columns[ c ].begin(), columns[ c ].end() );
+				mGroupStart.push_back( mColumns.size() );
+				columns[ c ].clear();
+			}
+			mRowStart[ row + 1 ] = mGroupCodeword.size();
+		}
+	}
+
+	/**
+	 * @brief Replaces the weights in place by the closest of at most codebookSize values, found with
+	 * k-means (Lloyd's algorithm, started from evenly spaced quantiles). Integral weights, or all weights if
+	 * roundCodewords is set, get rounded codewords. Tensors with no more than codebookSize distinct values are
+	 * left untouched.
+	 */
+	static void quantize( TensorP<WeightType> weights, size_t codebookSize, bool roundCodewords = false, uint iterations = 32 ) {
+		if ( codebookSize == 0 )
+			throw std::logic_error( "codebook needs at least one entry" );
+		std::vector<double> values;
+		for ( size_t i = 0; i < weights->shape.capacity(); ++i )
+			values.push_back( ( *weights )[ (long) i ] );
+		std::sort( values.begin(), values.end() );
+		std::vector<double> distinct( values );
+		distinct.erase( std::unique( distinct.begin(), distinct.end() ), distinct.end() );
+		if ( distinct.size() <= codebookSize )
+			return;
+
+		std::vector<double> centroids( codebookSize );
+		for ( size_t c = 0; c < codebookSize; ++c )
+			centroids[ c ] = values[ ( 2 * c + 1 ) * values.size() / ( 2 * codebookSize ) ];
+
+		for ( uint it = 0; it < iterations; ++it ) {
+			std::vector<double> sums( codebookSize, 0 );
+			std::vector<size_t> counts( codebookSize, 0 );
+			for ( double v : values ) {
+				size_t c = closest( centroids, v );
+				sums[ c ] += v;
+				counts[ c ]++;
+			}
+			bool moved = false;
+			for ( size_t c = 0; c < codebookSize; ++c ) {
+				if ( counts[ c ] == 0 )
+					continue;
+				double centroid = sums[ c ] / counts[ c ];
+				moved |= centroid != centroids[ c ];
+				centroids[ c ] = centroid;
+			}
+			if ( !moved )
+				break;
+		}
+
+		for ( size_t i = 0; i < weights->shape.capacity(); ++i ) {
+			double centroid = centroids[ closest( centroids, ( *weights )[ (long) i ] ) ];
+			if ( roundCodewords || std::is_integral<WeightType>::value )
+				centroid = std::round( centroid );
+			( *weights )[ (long) i ] = static_cast<WeightType>( centroid );
+		}
+	}
+
+	/**
+	 * @brief Index of the first group of row
+	 */
+	size_t rowBegin( size_t row ) const {
+		return mRowStart[ row ];
+	}
+
+	/**
+	 * @brief One past the index of the last group of row
+	 */
+	size_t rowEnd( size_t row ) const {
+		return mRowStart[ row + 1 ];
+	}
+
+	const WeightType& codeword( size_t group ) const {
+		return mCodebook[ mGroupCodeword[ group ] ];
+	}
+
+	/**
+	 * @brief Index of the first column of group in column()
+	 */
+	size_t groupBegin( size_t group ) const {
+		return mGroupStart[ group ];
+	}
+
+	size_t groupEnd( size_t group ) const {
+		return mGroupStart[ group + 1 ];
+	}
+
+	size_t column( size_t idx ) const {
+		return mColumns[ idx ];
+	}
+
+	const std::vector<WeightType>& codebook() const {
+		return mCodebook;
+	}
+
+	size_t rows() const {
+		return mRows;
+	}
+
+	size_t rowLength() const {
+		return mRowLength;
+	}
+
+	/**
+	 * @brief Total number of groups, which is the number of multiplications needed for all rows
+	 */
+	size_t groups() const {
+		return mGroupCodeword.size();
+	}
+
+private:
+	size_t mRows, mRowLength;
+	std::vector<WeightType> mCodebook;
+	std::vector<size_t> mRowStart; // first group of every row
+	std::vector<size_t> mGroupCodeword; // codebook index of every group
+	std::vector<size_t> mGroupStart; // first column of every group
+	std::vector<size_t> mColumns;
+
+	static size_t closest( const std::vector<double>& centroids, double v ) {
+		size_t best = 0;
+		double bestDistance = std::numeric_limits<double>::max();
+		for ( size_t c = 0; c < centroids.size(); ++c ) {
+			if ( std::abs( centroids[ c ] - v ) < bestDistance ) {
+				bestDistance = std::abs( centroids[ c ] - v );
+				best = c;
+			}
+		}
+		return best;
+	}
+};
+
+template<class WeightType>
+using ClusteredWeightsP = std::shared_ptr<ClusteredWeights<WeightType>>;
+
+
+#endif /* ARCHITECTURE_CLUSTEREDWEIGHTS_H_ */
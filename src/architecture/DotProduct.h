@@ -0,0 +1,94 @@
+/*
+ * DotProduct.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef ARCHITECTURE_DOTPRODUCT_H_
+#define ARCHITECTURE_DOTPRODUCT_H_
+
+#include <cstddef>
+
+/**
+ * @brief acc += sum( *in[ k ] * weights[ k ] ) for k in [ 0, n ). Terms with a zero weight are skipped.
+ *
+ * This is the generic version for plain values. Ciphertext types overload dot() for their wrapper and hand
+ * the whole sum to their backend, which can accumulate the products without a temporary per term.
+ */
+template<class ValueType, class WeightType>
+void dot( ValueType& acc, const ValueType* const * in, const WeightType* weights, size_t n ) {
+	for ( size_t k = 0; k < n; ++k ) {
+		if ( weights[ k ] == 0 )
+			continue;
+		ValueType term = *in[ k ];
+		term *= weights[ k ];
+		acc += term;
+	}
+}
+
+/**
+ * @brief Strided dot product over a window of rows x rowLength values, for example the part of a filter
+ * window that lies inside the image. Row r of the inputs starts at in + r * inStride, row r of the weights at
+ * weights + r * weightStride. A contiguous vector is a single row.
+ */
+template<class ValueType, class WeightType>
+void dot( ValueType& acc, const ValueType* in, size_t rowLength, size_t rows, size_t inStride, const WeightType* weights, size_t weightStride ) {
+	for ( size_t r = 0; r < rows; ++r ) {
+		for ( size_t k = 0; k < rowLength; ++k ) {
+			const WeightType& w = weights[ r * weightStride + k ];
+			if ( w == 0 )
+				continue;
+			ValueType term = in[ r * inStride + k ];
+			term *= w;
+			acc += term;
+		}
+	}
+}
+
+/**
+ * @brief *acc[ k ] += in * weights[ k ] for k in [ 0, n ), one input added into several sums, like an input pixel
+ * into every filter and filter position of a convolution that reads it. Terms with a zero weight are skipped.
+ *
+ * Ciphertext types overload it like dot() and multiply all terms in one temporary.
+ */
+template<class ValueType, class WeightType>
+void scatter( ValueType* const * acc, const ValueType& in, const WeightType* weights, size_t n ) {
+	for ( size_t k = 0; k < n; ++k ) {
+		if ( weights[ k ] == 0 )
+			continue;
+		ValueType term = in;
+		term *= weights[ k ];
+		*acc[ k ] += term;
+	}
+}
+
+/**
+ * @brief Called by the kernels once the weighted sum for an output neuron or pixel is complete, before the bias
+ * and the activation. Ciphertext types overload it to do the work they deferred while accumulating the terms.
+ * Nothing to do for plain values.
+ */
+template<class ValueType>
+void finishSum( ValueType& acc ) {
+}
+
+/**
+ * @brief The form in which a backend multiplies values of ValueType with weights fastest. Layers encode their weights
+ * with it once (see Layer::encodeWeights()) and hand the encodings to dot() and the operators of ValueType instead
+ * of the weights. Plain values use the weights as they are; ciphertext wrappers specialize this to precompute what
+ * their operators would otherwise compute for every single multiplication.
+ *
+ * like is any value of ValueType, it tells the specialization which backend (keys, parameters) the encodings are
+ * for. integral is set if w holds an integer that has to be multiplied as one, like integerized weights.
+ */
+template<class ValueType, class WeightType>
+struct WeightEncoding {
+	typedef WeightType Encoded;
+
+	static Encoded encode( const ValueType& like, const WeightType& w, bool integral ) {
+		return w;
+	}
+};
+
+
+#endif /* ARCHITECTURE_DOTPRODUCT_H_ */
@@ -9,12 +9,24 @@
 #define ARCHITECTURE_HEBACKEND_CIPHERTEXTWRAPPER_H_
 
 
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
 #include "../Tensor.h"
+#include "../../tools/ThreadPool.h"
 
 
 template<class T>
 class HETensorFactory;
 
+template<class T>
+class KeyHolder;
+
 template<class CiphterTextWrapper>
 class CipherTextWrapperFactory {
 public:
@@ -38,6 +50,61 @@ public:
 
 	virtual uint batchsize()=0;
 
+	/**
+	 * @brief Binary serialization of a single ciphertext, used by HETensorFile
+	 */
+	virtual void writeCipherText( const CiphterTextWrapper& ctxt, std::ostream& out ) = 0;
+
+	/**
+	 * @brief Serializes the ciphertext switched down to level if it is above it, which drops the primes of the
+	 * levels it no longer needs. ctxt itself keeps its level.
+	 */
+	virtual void writeCipherText( const CiphterTextWrapper& ctxt, std::ostream& out, long level ) = 0;
+
+	virtual CiphterTextWrapper readCipherText( std::istream& in ) = 0;
+
+	/**
+	 * @brief Identifies the context and keys of the factory. Serialized ciphertexts can only be read by a factory
+	 * with the same fingerprint.
+	 */
+	virtual uint64_t contextFingerprint() = 0;
+
+	/**
+	 * @brief Levels of the modulus chain a ciphertext needs to go through depth multiplications, in the unit of
+	 * the level of the ciphertexts (see Tensor::modDownToLevel()). The default counts one level per multiplication.
+	 */
+	virtual long levelsForDepth( long depth ) {
+		return depth;
+	}
+
+	/**
+	 * @brief Decrypts the ciphertext and encrypts its values anew, which resets the noise. Needs the secret key, the
+	 * key holder calls it (see KeyHolder).
+	 */
+	virtual CiphterTextWrapper refreshCipherText( const CiphterTextWrapper& ctxt ) = 0;
+
+	/**
+	 * @brief Serializes the context and the secret key for the key holder process, which builds its own factory
+	 * from them (see KeyHolder). The secret key leaves the process with it.
+	 */
+	virtual void writeKeys( std::ostream& out ) {
+		throw std::logic_error( "this factory can not hand its keys to a key holder" );
+	}
+
+	/**
+	 * @brief Whether bootstrap() works, the context needs bootstrapping keys for it
+	 */
+	virtual bool canBootstrap() {
+		return false;
+	}
+
+	/**
+	 * @brief Fresh ciphertext with the value of ctxt, bootstrapped on the server without the secret key
+	 */
+	virtual CiphterTextWrapper bootstrap( const CiphterTextWrapper& ctxt ) {
+		throw std::logic_error( "bootstrapping is not supported by this factory" );
+	}
+
 	/**
 	 * @brief Take a 1D vector transform into the given shape and encrypt it. The 1st dimension of the same needs to line up with the batchSize
 	 * supported by the encryption scheme.
@@ -54,25 +121,226 @@ public:
 
 	virtual void feedCipherTensor( const TensorP<double> in, Tensor<CiphterTextWrapper>& tensor ) = 0;
 
+	/**
+	 * @brief acc += sum( *in[ k ] * weights[ k ] ) for k in [ 0, n ), see dot() in DotProduct.h. Backends override
+	 * these to accumulate the products without creating a ciphertext per term, the defaults use the operators of the
+	 * wrapper like the layers used to.
+	 */
+	virtual void dot( CiphterTextWrapper& acc, const CiphterTextWrapper* const * in, const long* weights, size_t n ) {
+		gatherDot( acc, in, weights, n );
+	}
+
+	virtual void dot( CiphterTextWrapper& acc, const CiphterTextWrapper* const * in, const float* weights, size_t n ) {
+		gatherDot( acc, in, weights, n );
+	}
+
+	virtual void dot( CiphterTextWrapper& acc, const CiphterTextWrapper* const * in, const double* weights, size_t n ) {
+		gatherDot( acc, in, weights, n );
+	}
+
+	/**
+	 * @brief Strided variant for windows of rows x rowLength ciphertexts, row r of the inputs starts at in + r * inStride
+	 * and row r of the weights at weights + r * weightStride.
+	 */
+	virtual void dot( CiphterTextWrapper& acc, const CiphterTextWrapper* in, size_t rowLength, size_t rows, size_t inStride, const long* weights, size_t weightStride ) {
+		stridedDot( acc, in, rowLength, rows, inStride, weights, weightStride );
+	}
+
+	virtual void dot( CiphterTextWrapper& acc, const CiphterTextWrapper* in, size_t rowLength, size_t rows, size_t inStride, const float* weights, size_t weightStride ) {
+		stridedDot( acc, in, rowLength, rows, inStride, weights, weightStride );
+	}
+
+	virtual void dot( CiphterTextWrapper& acc, const CiphterTextWrapper* in, size_t rowLength, size_t rows, size_t inStride, const double* weights, size_t weightStride ) {
+		stridedDot( acc, in, rowLength, rows, inStride, weights, weightStride );
+	}
+
+	/**
+	 * @brief *acc[ k ] += in * weights[ k ] for k in [ 0, n ), see scatter() in DotProduct.h. Backends override these
+	 * like dot(), the defaults use the operators of the wrapper.
+	 */
+	virtual void scatter( CiphterTextWrapper* const * acc, const CiphterTextWrapper& in, const long* weights, size_t n ) {
+		scatterTerms( acc, in, weights, n );
+	}
+
+	virtual void scatter( CiphterTextWrapper* const * acc, const CiphterTextWrapper& in, const float* weights, size_t n ) {
+		scatterTerms( acc, in, weights, n );
+	}
+
+	virtual void scatter( CiphterTextWrapper* const * acc, const CiphterTextWrapper& in, const double* weights, size_t n ) {
+		scatterTerms( acc, in, weights, n );
+	}
+
 	virtual ~CipherTextWrapperFactory() {
 	}
 
-	void enableRefreshOnHighNoise(){
+	/**
+	 * @brief Lets HETensor::performChecks() refresh the ciphertexts with a noise budget of less than minNoiseBudget
+	 * bits left
+	 */
+	void enableRefreshOnHighNoise( double minNoiseBudget = 20 ){
 		this->mRefreshOnHighNoise = true;
+		this->mMinNoiseBudget = minNoiseBudget;
 	}
 
 	void disableRefreshOnHighNoise(){
-		this->mRefreshOnHighNoise = true;
+		this->mRefreshOnHighNoise = false;
 	}
 
 	bool refreshOnHighNoiseEnabled(){
 		return mRefreshOnHighNoise;
 	}
 
+	double minNoiseBudget() const {
+		return mMinNoiseBudget;
+	}
+
+	/**
+	 * @brief Sends the refreshs to keyHolder. Without a key holder the factory refreshes with its own secret key.
+	 */
+	void useKeyHolder( std::shared_ptr<KeyHolder<CiphterTextWrapper>> keyHolder ) {
+		mKeyHolder = keyHolder;
+	}
+
+	std::shared_ptr<KeyHolder<CiphterTextWrapper>> keyHolder() const {
+		return mKeyHolder;
+	}
+
+	/**
+	 * @brief Time spent on a way of refreshing ciphertexts. The first batch is a warm-up that pays for one-time setup
+	 * (tables of the recryption, the threads of the backend), it counts as refreshed but is not measured.
+	 */
+	struct RefreshCost {
+		long batches = 0;
+		long cipherTexts = 0;
+		double seconds = 0;	// of the measured batches
+		double recent = 0;	// moving average of the seconds per ciphertext of the measured batches
+
+		bool measured() const {
+			return batches > 1;
+		}
+
+		double perCipherText() const {
+			return recent;
+		}
+	};
+
+	/**
+	 * @brief Weight of the latest batch in RefreshCost::recent
+	 */
+	static constexpr double recentRefreshWeight = 0.25;
+
+	/**
+	 * @brief Every refreshExploration-th batch takes the way that is more expensive so far, so a change of the costs
+	 * gets noticed
+	 */
+	static const long refreshExploration = 16;
+
+	/**
+	 * @brief Refreshes a batch of ciphertexts either by bootstrapping them on the server or with the secret key, in
+	 * one round trip to the key holder if there is one. If the factory can bootstrap both ways get measured first,
+	 * bootstrapping before the secret key. Then the way that was cheaper per ciphertext in the recent batches gets
+	 * picked, apart from every refreshExploration-th batch that probes the other one.
+	 */
+	std::vector<CiphterTextWrapper> refreshCipherTexts( const std::vector<CiphterTextWrapper>& stale ) {
+		auto start = std::chrono::steady_clock::now();
+		const bool bootstrapping = chooseBootstrapping();
+		std::vector<CiphterTextWrapper> fresh;
+		if ( bootstrapping ) {
+			fresh.resize( stale.size(), empty() );
+			ThreadPool::getPool().parallelFor( 0, stale.size(), [&]( long i ) {
+				fresh[ i ] = this->bootstrap( stale[ i ] );
+			}, 0 );
+		} else if ( mKeyHolder ) {
+			fresh = mKeyHolder->refresh( stale );
+		} else {
+			fresh.resize( stale.size(), empty() );
+			ThreadPool::getPool().parallelFor( 0, stale.size(), [&]( long i ) {
+				fresh[ i ] = this->refreshCipherText( stale[ i ] );
+			}, 0 );
+		}
+		double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+		std::lock_guard<std::mutex> lock( mRefreshMutex );
+		RefreshCost& cost = bootstrapping ? mBootstrapCost : mClientRefreshCost;
+		cost.cipherTexts += stale.size();
+		if ( ++cost.batches > 1 && !stale.empty() ) { // the first batch is the warm-up
+			double perCipherText = seconds / stale.size();
+			cost.recent = cost.batches == 2 ? perCipherText : ( 1 - recentRefreshWeight ) * cost.recent + recentRefreshWeight * perCipherText;
+			cost.seconds += seconds;
+		}
+		return fresh;
+	}
+
+	RefreshCost bootstrapCost() {
+		std::lock_guard<std::mutex> lock( mRefreshMutex );
+		return mBootstrapCost;
+	}
+
+	RefreshCost clientRefreshCost() {
+		std::lock_guard<std::mutex> lock( mRefreshMutex );
+		return mClientRefreshCost;
+	}
 
 
 private:
 	bool mRefreshOnHighNoise = false;
+	double mMinNoiseBudget = 20;
+	std::shared_ptr<KeyHolder<CiphterTextWrapper>> mKeyHolder;
+	std::mutex mRefreshMutex; // guards the refresh costs, batches get refreshed from several threads
+	RefreshCost mBootstrapCost;
+	RefreshCost mClientRefreshCost;
+	long mRefreshBatches = 0;
+
+	bool chooseBootstrapping() {
+		if ( !canBootstrap() )
+			return false;
+		std::lock_guard<std::mutex> lock( mRefreshMutex );
+		if ( !mBootstrapCost.measured() )
+			return true;
+		if ( !mClientRefreshCost.measured() )
+			return false;
+		bool bootstrapCheaper = mBootstrapCost.recent <= mClientRefreshCost.recent;
+		return ++mRefreshBatches % refreshExploration == 0 ? !bootstrapCheaper : bootstrapCheaper;
+	}
+
+	template<class WeightType>
+	void gatherDot( CiphterTextWrapper& acc, const CiphterTextWrapper* const * in, const WeightType* weights, size_t n ) {
+		for ( size_t k = 0; k < n; ++k ) {
+			if ( weights[ k ] == 0 )
+				continue;
+			CiphterTextWrapper term = empty();
+			term += *in[ k ];
+			term *= weights[ k ];
+			acc += term;
+		}
+	}
+
+	template<class WeightType>
+	void stridedDot( CiphterTextWrapper& acc, const CiphterTextWrapper* in, size_t rowLength, size_t rows, size_t inStride, const WeightType* weights, size_t weightStride ) {
+		for ( size_t r = 0; r < rows; ++r ) {
+			for ( size_t k = 0; k < rowLength; ++k ) {
+				const WeightType& w = weights[ r * weightStride + k ];
+				if ( w == 0 )
+					continue;
+				CiphterTextWrapper term = empty();
+				term += in[ r * inStride + k ];
+				term *= w;
+				acc += term;
+			}
+		}
+	}
+
+	template<class WeightType>
+	void scatterTerms( CiphterTextWrapper* const * acc, const CiphterTextWrapper& in, const WeightType* weights, size_t n ) {
+		for ( size_t k = 0; k < n; ++k ) {
+			if ( weights[ k ] == 0 )
+				continue;
+			CiphterTextWrapper term = empty();
+			term += in;
+			term *= weights[ k ];
+			*acc[ k ] += term;
+		}
+	}
 
 };
 
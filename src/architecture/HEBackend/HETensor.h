@@ -12,12 +12,17 @@
 #include <iostream>
 #include <fstream>
 #include "CipherTextWrapper.h"
+#include "KeyHolder.h"
 #include "../Tensor.h"
 #include "../PlainTensor.h"
+#include "../../tools/ThreadPool.h"
 
 template<class T>
 class HETensorFactory;
 
+template<class T>
+class HETensorFile;
+
 template<class T>
 class HETensor: public Tensor<T> {
 public:
@@ -44,81 +49,59 @@ public:
 
 	/**
 	 * @brief Runs some checks on the content of the tensor.
-	 * If the factory has `refreshOnHighNoiseEnabled` this triggers
-	 * the data to be sent to the client for rencryption.
+	 * If the factory has `refreshOnHighNoiseEnabled` the ciphertexts whose noise budget dropped below
+	 * the minimum of the factory get refreshed, in one batch (see CipherTextWrapperFactory::refreshCipherTexts()).
+	 * The others are left alone.
 	 */
 	virtual void performChecks() override {
-		if( mFactory->refreshOnHighNoiseEnabled() ){
-			for( size_t i = 0; i < this->shape.capacity(); ++ i ){
-				if( this->mdata.get()[ i ].noiseNearOverflow() || true ){
-					std::cout << "WARNING checks for noiseoverflow not performed correctly" << std::endl;
-					this->writeToFile( "old_" + std::to_string( mFactory->batchsize() ) + ".bin" )  ;
-					refreshCipherTexts();
-					this->writeToFile( "new_" + std::to_string( mFactory->batchsize() ) + ".bin" )  ;
-					break;
-				}
-			}
-		}
-		
+		if ( !mFactory->refreshOnHighNoiseEnabled() || !this->mStorageCreated )
+			return;
+		const size_t n = this->shape.capacity();
+		std::vector<char> stale( n, 0 );
+		T* elements = data();
+		ThreadPool::getPool().parallelFor( 0, n, [&stale, elements]( long i ) {
+			stale[ i ] = elements[ i ].noiseNearOverflow();
+		}, 0 );
+		std::vector<size_t> indices;
+		for ( size_t i = 0; i < n; ++i )
+			if ( stale[ i ] )
+				indices.push_back( i );
+		refresh( indices );
 	};
 
 
-	TensorP<double> decryptDouble() {
-		Shape oldShape = this->shape; // @suppress("Invalid arguments")
-		// flatten the vector
-		this->reshape( { this->shape.capacity() } );
-
-		// decrypt the pixel batch
-		// the shape of this is [ px, batch ]
-		// we want [ batch, px  ] though
-		std::vector<std::vector<double>> plainVector( this->mPlainTextShape[ 0 ],
-				std::vector<double>( this->shape.capacity(), 0 ) );
-		for ( uint px = 0; px < this->shape.capacity(); ++px ) {
-			std::vector<double> inner = this->mFactory->decryptDouble( this->operator []( { px } ) ); // @suppress("Invalid arguments")
-			for ( uint batch = 0; batch < this->mPlainTextShape[ 0 ]; ++batch ) {
-				plainVector[ batch ][ px ] = inner[ batch ];
-			}
-		}
-
-		// restore the old shape
-		this->reshape( oldShape );
+	/**
+	 * @brief Copy of the tensor in its own storage with every ciphertext switched down to level, see
+	 * T::modDownToLevel(). The tensor and tensors sharing its storage keep their ciphertexts.
+	 */
+	virtual TensorP<T> modDownToLevel( long level ) override {
+		if ( !this->mStorageCreated )
+			return nullptr;
+		auto switched = std::make_shared<HETensor<T>>( this->shape, mPlainTextShape, mFactory );
+		T* elements = this->mdata.get();
+		T* target = switched->data();
+		ThreadPool::getPool().parallelFor( 0, this->shape.capacity(), [elements, target, level]( long i ) {
+			target[ i ] = elements[ i ];
+			target[ i ].modDownToLevel( level );
+		}, 0 );
+		return switched;
+	}
 
-		//create plain tensor with same shape as the plain vector
-		TensorP<double> ret = PlainTensorFactory<double>().create( Shape {	plainVector.size(), plainVector [ 0 ].size() } ); // @suppress("Symbol is not resolved")
-		ret->init( plainVector );
 
-		// bring the plaintensor into the correct shape
-		ret->reshape( mPlainTextShape );
-		return ret;
+	/**
+	 * @brief Converts with the factory, see CipherTextWrapperFactory::levelsForDepth()
+	 */
+	virtual long levelsForDepth( long depth ) override {
+		return mFactory->levelsForDepth( depth );
 	}
 
-	TensorP<long> decryptLong() {
-		Shape oldShape = this->shape; // @suppress("Invalid arguments")
-		// flatten the vector
-		this->reshape( { this->shape.capacity() } );
-
-		// decrypt the pixel batch
-		// the shape of this is [ px, batch ]
-		// we want [ batch, px  ] though
-		uint lastDimSize = oldShape.size == 4 ? oldShape[ 2 ] * oldShape[ 3 ] : oldShape[ oldShape.size - 1 ];
-		std::vector<std::vector<long>> plainVector( mPlainTextShape [ 0 ], std::vector<long>( lastDimSize, 0 ) );
-		for ( size_t px = 0; px < this->shape.capacity(); ++px ) {
-			auto inner = this->mFactory->decryptLong( this->operator []( { px } ) );
-			for ( uint batch = 0; batch < this->mPlainTextShape [ 0 ]; ++batch ) {
-				plainVector [ batch ] [ px ] = inner [ batch ];
-			}
-		}
-
-		// restore the old shape
-		this->reshape( oldShape );
 
-		//create plain tensor with same shape as the plain vector
-		TensorP<long> ret = PlainTensorFactory<long>().create( Shape{ (uint) plainVector.size(), (uint) plainVector [ 0 ].size() } ); // @suppress("Symbol is not resolved")
-		ret->init( plainVector );
+	TensorP<double> decryptDouble() {
+		return decrypt<double>( [this]( const T& ctxt ) {return this->mFactory->decryptDouble( ctxt );} );
+	}
 
-		// bring the plaintensor into the correct shape
-		ret->reshape( mPlainTextShape );
-		return ret;
+	TensorP<long> decryptLong() {
+		return decrypt<long>( [this]( const T& ctxt ) {return this->mFactory->decryptLong( ctxt );} );
 	}
 
 
@@ -132,7 +115,10 @@ public:
 
 
 	virtual void init() override {
-		createStorage();
+		if ( !this->mStorageCreated ) { // fresh storage holds empty ciphertexts already
+			createStorage();
+			return;
+		}
 //		std::cout << "creating storage" << std::endl;
 		for ( uint i = 0; i < this->shape.capacity(); ++i )
 			this->mdata.get()[ i ] = this->mFactory->empty();
@@ -143,30 +129,51 @@ public:
 	}
 
 	/**
-	 * @brief Refreshes the ciphertexts in the tensor.
-	 * Currently they are decrypted and rencrypted. A more realistic
-	 * implementation would send them to the holder of the private key.
-	 *
+	 * @brief Refreshes all ciphertexts in the tensor, through the key holder of the factory if it has one.
 	 */
 	void refreshCipherTexts(){
-		std::cout << "refreshing ciphertexts..";
-		auto decrypted = decryptDouble();
-		// std::cout << *decrypted << std::endl;
-		mFactory->feedCipherTensor( decrypted, *this );
-		std::cout << "done" << std::endl;
+		std::vector<size_t> indices( this->shape.capacity() );
+		for ( size_t i = 0; i < indices.size(); ++i )
+			indices[ i ] = i;
+		refresh( indices );
 	}
 
 
-	virtual void writeToFile( std::string file ){
-		std::fstream myfile;
-		myfile = std::fstream( file, std::ios::out | std::ios::binary );
-		if ( !myfile ){
-			std::cerr << "something messed up when opening " << file << std::endl;
-			exit( 1 );
-		}
-		for( size_t i = 0; i < this->shape.capacity(); ++i )
-			this->mdata.get()[ i ].writeToFile( myfile );
-		myfile.close();
+	/**
+	 * @brief Writes the tensor in the ciphertext tensor file format, see HETensorFile
+	 */
+	virtual void writeToFile( std::string file ) override {
+		HETensorFile<T>::write( *this, file );
+	}
+
+	/**
+	 * @brief Writes a compact file with the ciphertexts switched down to level, see HETensorFile::write()
+	 */
+	void writeToFile( std::string file, long level ) {
+		HETensorFile<T>::write( *this, file, level );
+	}
+
+	/**
+	 * @brief Reads a tensor written by writeToFile(). The factory needs the context and keys of the writer.
+	 */
+	static std::shared_ptr<HETensor<T>> readFromFile( std::string file, CipherTextWrapperFactory<T>* factory ) {
+		return HETensorFile<T>::read( file, factory );
+	}
+
+	CipherTextWrapperFactory<T>* factory() const {
+		return mFactory;
+	}
+
+	const Shape& plainTextShape() const {
+		return mPlainTextShape;
+	}
+
+	/**
+	 * @brief The storage of the tensor, shape.capacity() ciphertexts
+	 */
+	T* data() {
+		createStorage();
+		return this->mdata.get();
 	}
 
 
@@ -176,6 +183,39 @@ protected:
 	CipherTextWrapperFactory<T>* mFactory;
 
 
+	/**
+	 * @brief Decrypts the ciphertexts in parallel straight into a plain tensor in the plain text shape. Ciphertext px
+	 * holds element px of every instance, instance b of the result gets slot b.
+	 */
+	template<class PlainType, class Decrypt>
+	TensorP<PlainType> decrypt( Decrypt decryptOne ) {
+		const size_t elements = this->shape.capacity();
+		const size_t instances = mPlainTextShape[ 0 ];
+		TensorP<PlainType> ret = PlainTensorFactory<PlainType>().create( Shape { instances, elements } );
+		ret->init();
+		ThreadPool::getPool().parallelFor( 0, elements, [&]( long px ) {
+			std::vector<PlainType> slots = decryptOne( this->mdata.get()[ px ] );
+			for ( size_t batch = 0; batch < instances; ++batch )
+				( *ret )[ (long) ( batch * elements + px ) ] = slots[ batch ];
+		}, 0 );
+		ret->reshape( mPlainTextShape );
+		return ret;
+	}
+
+	/**
+	 * @brief Replaces the ciphertexts at indices with fresh encryptions of their values
+	 */
+	void refresh( const std::vector<size_t>& indices ) {
+		if ( indices.empty() )
+			return;
+		std::vector<T> stale;
+		for ( size_t i : indices )
+			stale.push_back( this->mdata.get()[ i ] );
+		std::vector<T> fresh = mFactory->refreshCipherTexts( stale );
+		for ( size_t k = 0; k < indices.size(); ++k )
+			this->mdata.get()[ indices[ k ] ] = fresh[ k ];
+	}
+
 	/**
 	 * Strides and shapes work somewhat differently with HE Tensors. Since we
 	 * are working with SIMD our shape is [ channel, y, x, batch ]. This also changes
@@ -194,9 +234,11 @@ protected:
 			return;
 		if(! T::defaultFactory)
 			mFactory->setAsDefaultFactory() ;
+		// the default constructor creates empty ciphertexts of the default factory
 		this->mdata = std::shared_ptr<T>( new T [ this->shape.capacity() ], std::default_delete<T [ ]>() );
-		for ( uint i = 0; i < this->shape.capacity(); ++i )
-			this->mdata.get() [ i ] = this->mFactory->empty();
+		if ( T::defaultFactory != mFactory )
+			for ( uint i = 0; i < this->shape.capacity(); ++i )
+				this->mdata.get() [ i ] = this->mFactory->empty();
 		this->mStorageCreated = true;
 
 	}
@@ -216,6 +258,7 @@ public:
 	virtual TensorP<T> create( Shape s ) override {
 		Shape tensorShape = s;
 		tensorShape [ 0 ] = 1; // rethink this
+		tensorShape.computeCapacity();
 		/// Store the plain text shape for convience
 		Shape plainTextShape = s;
 		plainTextShape [ 0 ] = mFactory->batchsize();
@@ -226,6 +269,7 @@ public:
 	virtual TensorP<T> createView( Shape s, TensorP<T> other ) override {
 		Shape tensorShape = s;
 		tensorShape [ 0 ] = 1; // rethink this
+		tensorShape.computeCapacity();
 		/// Store the plain text shape for convience
 		Shape plainTextShape = s;
 		plainTextShape [ 0 ] = mFactory->batchsize();
@@ -289,4 +333,6 @@ private:
 };
 
 
+#include "HETensorIO.h"
+
 #endif /* ARCHITECTURE_HEBACKEND_HETENSOR_H_ */
@@ -0,0 +1,389 @@
+/*
+ * HETensorIO.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef ARCHITECTURE_HEBACKEND_HETENSORIO_H_
+#define ARCHITECTURE_HEBACKEND_HETENSORIO_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <streambuf>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "HETensor.h"
+#include "../../tools/ThreadPool.h"
+
+
+/**
+ * @brief Header of a ciphertext tensor file. The file is the header followed by the ciphertexts, serialized by
+ * CipherTextWrapperFactory::writeCipherText() one after the other in the order of the tensor storage.
+ *
+ *     char[ 8 ]   magic "HETENSOR"
+ *     uint32      version
+ *     uint32      flags, droppedLevels if the ciphertexts were switched down to level for the file
+ *     uint64      fingerprint of the context and keys the ciphertexts belong to
+ *     int64       lowest level of the ciphertexts
+ *     uint32      rank, followed by rank uint64 dimensions of the tensor shape
+ *     uint32      rank, followed by rank uint64 dimensions of the plain text shape
+ *     uint64      number of ciphertexts n, followed by n + 1 uint64 offsets of the ciphertexts from the
+ *                 start of the payload; the last one is the size of the payload
+ *
+ * Numbers are stored in the byte order of the machine. The offsets let readers deserialize the ciphertexts in
+ * parallel and load single ones from a memory mapped file.
+ *
+ * A compact file (see HETensorFile::write()) holds the ciphertexts at the lowest level the receiver still needs,
+ * the size of a ciphertext is proportional to its level. Readers need nothing special for it, the ciphertexts just
+ * come back at that level. Levels are in the unit of the backend, primes of the modulus chain for HElib (see
+ * CipherTextWrapperFactory::levelsForDepth()).
+ *
+ * Both parts of a ciphertext are stored. Storing the seed of the uniform part of a fresh encryption instead would
+ * need a secret key encryption that samples that part from a seed of its own. HElib does not offer one: the parts
+ * of a Ctxt are private and FHESecKey::Encrypt() draws the uniform part and the noise from the same NTL stream, so
+ * the part can not be expanded from a stored seed alone.
+ */
+struct HETensorFileHeader {
+	static const uint32_t currentVersion = 1;
+
+	static const uint32_t droppedLevels = 1;
+
+	uint32_t version = currentVersion;
+	uint32_t flags = 0;
+	uint64_t fingerprint = 0;
+	int64_t level = 0;
+	std::vector<size_t> shape;
+	std::vector<size_t> plainTextShape;
+	std::vector<uint64_t> offsets { 0 };
+
+	static const char* magic() {
+		return "HETENSOR";
+	}
+
+	size_t count() const {
+		return offsets.size() - 1;
+	}
+
+	void write( std::ostream& out ) const {
+		out.write( magic(), 8 );
+		put( out, version );
+		put( out, flags );
+		put( out, fingerprint );
+		put( out, level );
+		putDims( out, shape );
+		putDims( out, plainTextShape );
+		put( out, (uint64_t) count() );
+		for ( uint64_t offset : offsets )
+			put( out, offset );
+	}
+
+	/**
+	 * @brief Size of the header in the file
+	 */
+	uint64_t size() const {
+		return 8 + 2 * sizeof( uint32_t ) + sizeof( uint64_t ) + sizeof( int64_t ) + 2 * sizeof( uint32_t )
+				+ ( shape.size() + plainTextShape.size() + 1 + offsets.size() ) * sizeof( uint64_t );
+	}
+
+	/**
+	 * @brief Reads and checks the header. Throws if the stream does not hold a tensor file of a version this
+	 * build can read, or if the header does not fit the file: the number of ciphertexts has to be the capacity of
+	 * the shape, the offsets have to start at 0 and grow, and the payload has to fit into the available bytes of
+	 * the file after the header. The offsets are read one by one, a corrupt count does not allocate anything.
+	 */
+	void read( std::istream& in, uint64_t available = std::numeric_limits<uint64_t>::max() ) {
+		char m[ 8 ];
+		in.read( m, 8 );
+		if ( !in || std::memcmp( m, magic(), 8 ) != 0 )
+			throw std::runtime_error( "not a ciphertext tensor file" );
+		get( in, version );
+		if ( version != currentVersion )
+			throw std::runtime_error( "unsupported ciphertext tensor file version " + std::to_string( version ) );
+		get( in, flags );
+		get( in, fingerprint );
+		get( in, level );
+		getDims( in, shape );
+		getDims( in, plainTextShape );
+		uint64_t n;
+		get( in, n );
+		if ( !in )
+			throw std::runtime_error( "truncated ciphertext tensor file header" );
+		uint64_t capacity = 1;
+		for ( size_t d : shape ) {
+			if ( d != 0 && capacity > std::numeric_limits<uint64_t>::max() / d )
+				throw std::runtime_error( "corrupt ciphertext tensor file header" );
+			capacity *= d;
+		}
+		if ( n != capacity )
+			throw std::runtime_error( "shape of the ciphertext tensor file does not match its number of ciphertexts" );
+		offsets.clear();
+		for ( uint64_t i = 0; i <= n; ++i ) {
+			uint64_t offset;
+			get( in, offset );
+			if ( !in )
+				throw std::runtime_error( "truncated ciphertext tensor file header" );
+			if ( offset < ( offsets.empty() ? 0 : offsets.back() ) || ( offsets.empty() && offset != 0 ) )
+				throw std::runtime_error( "corrupt ciphertext tensor file header" );
+			offsets.push_back( offset );
+		}
+		if ( available < size() || offsets.back() > available - size() )
+			throw std::runtime_error( "truncated ciphertext tensor file" );
+	}
+
+private:
+	template<class Number>
+	static void put( std::ostream& out, Number x ) {
+		out.write( (const char*) &x, sizeof( x ) );
+	}
+
+	template<class Number>
+	static void get( std::istream& in, Number& x ) {
+		in.read( (char*) &x, sizeof( x ) );
+	}
+
+	static void putDims( std::ostream& out, const std::vector<size_t>& dims ) {
+		put( out, (uint32_t) dims.size() );
+		for ( size_t d : dims )
+			put( out, (uint64_t) d );
+	}
+
+	static void getDims( std::istream& in, std::vector<size_t>& dims ) {
+		uint32_t rank = 0;
+		get( in, rank );
+		if ( !in || rank > 64 )
+			throw std::runtime_error( "corrupt ciphertext tensor file header" );
+		dims.resize( rank );
+		for ( size_t& d : dims ) {
+			uint64_t x;
+			get( in, x );
+			d = x;
+		}
+	}
+};
+
+
+/**
+ * @brief Read only stream over a block of memory, the ciphertexts get deserialized straight from a buffer or
+ * a mapped file without copying them first.
+ */
+class MemoryStreamBuffer: public std::streambuf {
+public:
+	MemoryStreamBuffer( const char* begin, const char* end ) {
+		setg( const_cast<char*>( begin ), const_cast<char*>( begin ), const_cast<char*>( end ) );
+	}
+};
+
+
+/**
+ * @brief Reads and writes HETensors in the format described at HETensorFileHeader. Ciphertexts are serialized and
+ * deserialized in parallel on the ThreadPool. A file can only be read with a factory that has the same context
+ * and keys as the one that wrote it, checked with CipherTextWrapperFactory::contextFingerprint().
+ */
+template<class T>
+class HETensorFile {
+public:
+
+	static void write( HETensor<T>& tensor, const std::string& file, long level = -1 ) {
+		std::ofstream out( file, std::ios::out | std::ios::binary );
+		if ( !out )
+			throw std::runtime_error( "can not open " + file + " for writing" );
+		write( tensor, out, level );
+		if ( !out )
+			throw std::runtime_error( "writing " + file + " failed" );
+	}
+
+	/**
+	 * @brief Writes the tensor to out. With a level >= 0 the file is compact: ciphertexts above level get switched
+	 * down to it on the way out, the tensor itself keeps its levels. For an encrypted model input the level the
+	 * first layer needs is Model::planLevels().front(), already converted to the levels of the backend.
+	 */
+	static void write( HETensor<T>& tensor, std::ostream& out, long level = -1 ) {
+		const size_t n = tensor.shape.capacity();
+		CipherTextWrapperFactory<T>* factory = tensor.factory();
+		std::vector<std::string> payloads( n );
+		std::vector<long> levels( n );
+		T* elements = tensor.data();
+		ThreadPool::getPool().parallelFor( 0, n, [&]( long i ) {
+			std::ostringstream ctxt( std::ios::out | std::ios::binary );
+			levels[ i ] = elements[ i ].level();
+			if ( level >= 0 ) {
+				factory->writeCipherText( elements[ i ], ctxt, level );
+				levels[ i ] = std::min( levels[ i ], level );
+			} else {
+				factory->writeCipherText( elements[ i ], ctxt );
+			}
+			payloads[ i ] = ctxt.str();
+		}, 0 );
+
+		HETensorFileHeader header;
+		header.flags = level >= 0 ? HETensorFileHeader::droppedLevels : 0;
+		header.fingerprint = factory->contextFingerprint();
+		header.level = n ? *std::min_element( levels.begin(), levels.end() ) : 0;
+		header.shape = dims( tensor.shape );
+		header.plainTextShape = dims( tensor.plainTextShape() );
+		for ( const std::string& payload : payloads )
+			header.offsets.push_back( header.offsets.back() + payload.size() );
+		header.write( out );
+		for ( const std::string& payload : payloads )
+			out.write( payload.data(), payload.size() );
+	}
+
+	/**
+	 * @brief Reads a tensor from a stream, for example a pipe or a socket, and deserializes it in parallel.
+	 * maxBytes bounds the size of the file. The payload is read in chunks, so the buffer only grows with the data
+	 * that actually arrives and a corrupt header can not make it allocate more.
+	 */
+	static std::shared_ptr<HETensor<T>> read( std::istream& in, CipherTextWrapperFactory<T>* factory,
+			uint64_t maxBytes = std::numeric_limits<uint64_t>::max() ) {
+		HETensorFileHeader header;
+		header.read( in, maxBytes );
+		checkFingerprint( header, factory );
+		const uint64_t size = header.offsets.back();
+		std::vector<char> payload;
+		while ( payload.size() < size ) {
+			size_t chunk = (size_t) std::min<uint64_t>( size - payload.size(), readChunk );
+			size_t start = payload.size();
+			payload.resize( start + chunk );
+			in.read( payload.data() + start, chunk );
+			if ( (size_t) in.gcount() != chunk )
+				throw std::runtime_error( "truncated ciphertext tensor file" );
+		}
+		return build( header, factory, payload.data() );
+	}
+
+	/**
+	 * @brief Reads a tensor from a file through a memory mapping, see MappedHETensorFile
+	 */
+	static std::shared_ptr<HETensor<T>> read( const std::string& file, CipherTextWrapperFactory<T>* factory );
+
+	/**
+	 * @brief Creates the tensor of the header and deserializes its ciphertexts in parallel from payload
+	 */
+	static std::shared_ptr<HETensor<T>> build( const HETensorFileHeader& header, CipherTextWrapperFactory<T>* factory, const char* payload ) {
+		std::vector<T> elements( header.count(), factory->empty() );
+		ThreadPool::getPool().parallelFor( 0, header.count(), [&]( long i ) {
+			elements[ i ] = readOne( header, factory, payload, i );
+		}, 0 );
+		auto tensor = std::make_shared<HETensor<T>>( Shape( header.shape ), Shape( header.plainTextShape ), factory );
+		if ( tensor->shape.capacity() != header.count() )
+			throw std::runtime_error( "shape of the ciphertext tensor file does not match its number of ciphertexts" );
+		tensor->flatten();
+		tensor->Tensor<T>::init( elements );
+		tensor->reshape( Shape( header.shape ) );
+		return tensor;
+	}
+
+	static T readOne( const HETensorFileHeader& header, CipherTextWrapperFactory<T>* factory, const char* payload, size_t i ) {
+		MemoryStreamBuffer buffer( payload + header.offsets[ i ], payload + header.offsets[ i + 1 ] );
+		std::istream ctxt( &buffer );
+		return factory->readCipherText( ctxt );
+	}
+
+	static void checkFingerprint( const HETensorFileHeader& header, CipherTextWrapperFactory<T>* factory ) {
+		if ( header.fingerprint != factory->contextFingerprint() )
+			throw std::runtime_error( "the ciphertexts were written with another context or other keys" );
+	}
+
+private:
+	static const size_t readChunk = 1 << 24; // bytes the stream reader grows its buffer by at most
+
+	static std::vector<size_t> dims( const Shape& shape ) {
+		std::vector<size_t> d;
+		for ( size_t i = 0; i < shape.size; ++i )
+			d.push_back( shape[ i ] );
+		return d;
+	}
+};
+
+
+/**
+ * @brief Maps a ciphertext tensor file into memory. Only the header is read when opening it; element() deserializes
+ * single ciphertexts on demand and the operating system pages in just the parts that get touched. load() reads the
+ * whole tensor in parallel.
+ */
+template<class T>
+class MappedHETensorFile {
+public:
+	MappedHETensorFile( const std::string& file, CipherTextWrapperFactory<T>* factory ) : mFactory( factory ) {
+		int fd = ::open( file.c_str(), O_RDONLY );
+		if ( fd < 0 )
+			throw std::runtime_error( "can not open " + file );
+		struct stat st;
+		if ( ::fstat( fd, &st ) != 0 || st.st_size == 0 ) {
+			::close( fd );
+			throw std::runtime_error( "can not map " + file );
+		}
+		mSize = st.st_size;
+		void* data = ::mmap( nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+		::close( fd ); // the mapping stays valid
+		if ( data == MAP_FAILED )
+			throw std::runtime_error( "can not map " + file );
+		mData = (const char*) data;
+
+		MemoryStreamBuffer buffer( mData, mData + mSize );
+		std::istream in( &buffer );
+		try {
+			mHeader.read( in, mSize ); // checks that the payload fits into the file
+			HETensorFile<T>::checkFingerprint( mHeader, mFactory );
+			mPayload = mData + mHeader.size();
+		} catch ( ... ) {
+			::munmap( (void*) mData, mSize );
+			throw;
+		}
+	}
+
+	~MappedHETensorFile() {
+		::munmap( (void*) mData, mSize );
+	}
+
+	MappedHETensorFile( const MappedHETensorFile& ) = delete;
+	void operator=( const MappedHETensorFile& ) = delete;
+
+	const HETensorFileHeader& header() const {
+		return mHeader;
+	}
+
+	size_t size() const {
+		return mHeader.count();
+	}
+
+	/**
+	 * @brief Deserializes ciphertext i of the tensor storage
+	 */
+	T element( size_t i ) const {
+		if ( i >= size() )
+			throw std::out_of_range( "ciphertext " + std::to_string( i ) + " is not in the file" );
+		return HETensorFile<T>::readOne( mHeader, mFactory, mPayload, i );
+	}
+
+	std::shared_ptr<HETensor<T>> load() const {
+		return HETensorFile<T>::build( mHeader, mFactory, mPayload );
+	}
+
+private:
+	CipherTextWrapperFactory<T>* mFactory;
+	HETensorFileHeader mHeader;
+	const char* mData = nullptr;
+	const char* mPayload = nullptr;
+	size_t mSize = 0;
+};
+
+
+template<class T>
+std::shared_ptr<HETensor<T>> HETensorFile<T>::read( const std::string& file, CipherTextWrapperFactory<T>* factory ) {
+	return MappedHETensorFile<T>( file, factory ).load();
+}
+
+
+#endif /* ARCHITECTURE_HEBACKEND_HETENSORIO_H_ */
@@ -0,0 +1,278 @@
+/*
+ * KeyHolder.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef ARCHITECTURE_HEBACKEND_KEYHOLDER_H_
+#define ARCHITECTURE_HEBACKEND_KEYHOLDER_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "CipherTextWrapper.h"
+#include "../../tools/ThreadPool.h"
+
+extern char** environ;
+
+
+/**
+ * @brief The party that holds the secret key and refreshes ciphertexts for the server, run as a separate process.
+ *
+ * The process answers over a local socket, standing in for a client on the other side of a network. A refresh
+ * sends a whole batch of ciphertexts in one message and gets the fresh ones back in one message; statistics() sums
+ * up the round trips, bytes and time so the cost of refreshing can be measured. Messages are a uint64 length
+ * followed by the payload, a payload is the uint64 number of ciphertexts followed by the ciphertexts, each as
+ * uint64 length and the bytes of CipherTextWrapperFactory::writeCipherText().
+ *
+ * The process is not forked from the server, which has threads by then, but spawned: executable (the running one
+ * by default) is started anew with the socket in the environment variable of serveVariable. The executable has to
+ * call serveIfSpawned() as the first statement of main(), there the spawned process serves and exits before the
+ * rest of the program runs. The first message hands it the keys (CipherTextWrapperFactory::writeKeys()), it builds
+ * its own factory from them with T::Factory::readKeys() and refreshes on a single thread.
+ *
+ *     int main( int argc, char** argv ) {
+ *         KeyHolder<HELibCipherText>::serveIfSpawned();
+ *         ...
+ *     }
+ *
+ *     auto keyHolder = std::make_shared<KeyHolder<HELibCipherText>>( &factory );
+ *     factory.useKeyHolder( keyHolder );
+ *     factory.enableRefreshOnHighNoise( 30 );
+ */
+template<class T>
+class KeyHolder {
+public:
+	struct Statistics {
+		long roundTrips = 0;
+		long cipherTexts = 0;
+		uint64_t bytesSent = 0;
+		uint64_t bytesReceived = 0;
+		double seconds = 0;
+	};
+
+	static const char* serveVariable() {
+		return "HE_CNN_KEY_HOLDER_SOCKET";
+	}
+
+	explicit KeyHolder( CipherTextWrapperFactory<T>* factory, const std::string& executable = "/proc/self/exe" ) : mFactory( factory ) {
+		int sockets[ 2 ];
+		if ( ::socketpair( AF_UNIX, SOCK_STREAM, 0, sockets ) != 0 )
+			throw std::runtime_error( "can not create the socket to the key holder" );
+		::fcntl( sockets[ 0 ], F_SETFD, FD_CLOEXEC ); // only the end of the key holder gets passed on
+
+		std::vector<std::string> variables;
+		for ( char** v = environ; *v; ++v )
+			variables.push_back( *v );
+		variables.push_back( std::string( serveVariable() ) + "=" + std::to_string( sockets[ 1 ] ) );
+		std::vector<char*> envp;
+		for ( std::string& v : variables )
+			envp.push_back( &v[ 0 ] );
+		envp.push_back( nullptr );
+		std::string program = executable;
+		char* argv[] = { &program[ 0 ], nullptr };
+
+		int spawned = ::posix_spawn( &mPid, executable.c_str(), nullptr, nullptr, argv, envp.data() );
+		::close( sockets[ 1 ] );
+		mSocket = sockets[ 0 ];
+		if ( spawned != 0 ) {
+			::close( mSocket );
+			throw std::runtime_error( "can not start the key holder process " + executable );
+		}
+		std::ostringstream keys( std::ios::out | std::ios::binary );
+		mFactory->writeKeys( keys );
+		if ( !send( mSocket, keys.str() ) ) {
+			::close( mSocket );
+			::waitpid( mPid, nullptr, 0 );
+			throw std::runtime_error( "can not hand the keys to the key holder" );
+		}
+	}
+
+	~KeyHolder() {
+		::close( mSocket ); // the key holder exits once it reads the end of the stream
+		::waitpid( mPid, nullptr, 0 );
+	}
+
+	KeyHolder( const KeyHolder& ) = delete;
+	void operator=( const KeyHolder& ) = delete;
+
+	/**
+	 * @brief Serves and exits if the process was spawned as a key holder, otherwise returns. Has to be the first
+	 * statement of main() of every executable that creates a KeyHolder (or of the executable passed to it), so
+	 * the key holder starts after the static initialization of the program and before anything else.
+	 */
+	static void serveIfSpawned() {
+		const char* socket = std::getenv( serveVariable() );
+		if ( socket )
+			serve( std::atoi( socket ) );
+	}
+
+	/**
+	 * @brief Refreshes the ciphertexts in one round trip, the fresh ones are returned in the same order
+	 */
+	std::vector<T> refresh( const std::vector<T>& stale ) {
+		if ( stale.empty() )
+			return {};
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::string> payloads( stale.size() );
+		ThreadPool::getPool().parallelFor( 0, stale.size(), [&]( long i ) {
+			std::ostringstream ctxt( std::ios::out | std::ios::binary );
+			mFactory->writeCipherText( stale[ i ], ctxt );
+			payloads[ i ] = ctxt.str();
+		}, 0 );
+		std::string request = pack( payloads );
+
+		std::string response;
+		{
+			std::lock_guard<std::mutex> lock( mMutex ); // one request on the socket at a time
+			if ( !send( mSocket, request ) || !receive( mSocket, response ) )
+				throw std::runtime_error( "lost the connection to the key holder" );
+		}
+
+		payloads = unpack( response );
+		if ( payloads.size() != stale.size() )
+			throw std::runtime_error( "the key holder answered with the wrong number of ciphertexts" );
+		std::vector<T> fresh( payloads.size(), mFactory->empty() );
+		ThreadPool::getPool().parallelFor( 0, payloads.size(), [&]( long i ) {
+			std::istringstream ctxt( payloads[ i ], std::ios::in | std::ios::binary );
+			fresh[ i ] = mFactory->readCipherText( ctxt );
+		}, 0 );
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		mStatistics.roundTrips++;
+		mStatistics.cipherTexts += stale.size();
+		mStatistics.bytesSent += request.size() + sizeof( uint64_t );
+		mStatistics.bytesReceived += response.size() + sizeof( uint64_t );
+		mStatistics.seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+		return fresh;
+	}
+
+	Statistics statistics() {
+		std::lock_guard<std::mutex> lock( mMutex );
+		return mStatistics;
+	}
+
+private:
+	CipherTextWrapperFactory<T>* mFactory;
+	int mSocket = -1;
+	pid_t mPid = -1;
+	std::mutex mMutex;
+	Statistics mStatistics;
+
+	/**
+	 * @brief Loop of the key holder process, never returns
+	 */
+	static void serve( int socket ) {
+		::signal( SIGPIPE, SIG_IGN );
+		int status = 0;
+		try {
+			std::string request;
+			if ( !receive( socket, request ) )
+				throw std::runtime_error( "got no keys" );
+			std::istringstream keys( request, std::ios::in | std::ios::binary );
+			auto factory = T::Factory::readKeys( keys );
+			while ( receive( socket, request ) ) {
+				std::vector<std::string> payloads = unpack( request );
+				for ( std::string& payload : payloads ) {
+					std::istringstream in( payload, std::ios::in | std::ios::binary );
+					T fresh = factory->refreshCipherText( factory->readCipherText( in ) );
+					std::ostringstream out( std::ios::out | std::ios::binary );
+					factory->writeCipherText( fresh, out );
+					payload = out.str();
+				}
+				if ( !send( socket, pack( payloads ) ) )
+					break;
+			}
+		} catch ( const std::exception& e ) {
+			std::cerr << "key holder: " << e.what() << std::endl;
+			status = 1;
+		}
+		::close( socket );
+		::_exit( status ); // the key holder never returns to main()
+	}
+
+	static std::string pack( const std::vector<std::string>& payloads ) {
+		std::string message;
+		append( message, payloads.size() );
+		for ( const std::string& payload : payloads ) {
+			append( message, payload.size() );
+			message += payload;
+		}
+		return message;
+	}
+
+	static std::vector<std::string> unpack( const std::string& message ) {
+		size_t pos = 0;
+		uint64_t n = take( message, pos );
+		std::vector<std::string> payloads;
+		for ( uint64_t i = 0; i < n; ++i ) {
+			uint64_t size = take( message, pos );
+			if ( size > message.size() - pos )
+				throw std::runtime_error( "corrupt key holder message" );
+			payloads.push_back( message.substr( pos, size ) );
+			pos += size;
+		}
+		return payloads;
+	}
+
+	static void append( std::string& message, uint64_t x ) {
+		message.append( (const char*) &x, sizeof( x ) );
+	}
+
+	static uint64_t take( const std::string& message, size_t& pos ) {
+		uint64_t x;
+		if ( message.size() - pos < sizeof( x ) )
+			throw std::runtime_error( "corrupt key holder message" );
+		message.copy( (char*) &x, sizeof( x ), pos );
+		pos += sizeof( x );
+		return x;
+	}
+
+	static bool send( int socket, const std::string& message ) {
+		std::string framed;
+		append( framed, message.size() );
+		framed += message;
+		for ( size_t sent = 0; sent < framed.size(); ) {
+			ssize_t n = ::send( socket, framed.data() + sent, framed.size() - sent, MSG_NOSIGNAL );
+			if ( n <= 0 )
+				return false;
+			sent += n;
+		}
+		return true;
+	}
+
+	static bool receive( int socket, std::string& message ) {
+		uint64_t size;
+		if ( !readFully( socket, (char*) &size, sizeof( size ) ) )
+			return false;
+		message.resize( size );
+		return readFully( socket, &message[ 0 ], size );
+	}
+
+	static bool readFully( int socket, char* data, size_t size ) {
+		for ( size_t received = 0; received < size; ) {
+			ssize_t n = ::recv( socket, data + received, size - received, 0 );
+			if ( n <= 0 )
+				return false;
+			received += n;
+		}
+		return true;
+	}
+};
+
+
+#endif /* ARCHITECTURE_HEBACKEND_KEYHOLDER_H_ */
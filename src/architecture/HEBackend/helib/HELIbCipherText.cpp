@@ -10,12 +10,158 @@
 #include "HELIbCipherText.h"
 #include "../HETensor.h"
 #include "../../PlainTensor.h"
+#include "../../../tools/ThreadPool.h"
+#include <NTL/BasicThreadPool.h>
+#include <unordered_map>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <string>
 
 
 
 //need to declare static memeber outside of the classs
 HELibCipherTextFactory* HELibCipherText::defaultFactory = nullptr;
-long HELibCipherText::noiseThreshold = NTL_OVFBND / 2.5;
+
+
+namespace {
+	// per thread and factory. Pooled ciphertexts keep the storage of their parts, so this bounds the memory they hold
+	const size_t MAX_POOLED_CTXTS = 64;
+	const size_t MAX_POOLED_BLOCKS = 1024; // per thread
+
+	/**
+	 * Released ciphertexts of a thread, per factory, and the free memory blocks for their control blocks.
+	 */
+	struct CtxtPool {
+		struct Entry {
+			std::weak_ptr<bool> alive;
+			std::vector<Ctxt*> free;
+		};
+		std::unordered_map<long, Entry> entries;
+		std::vector<void*> blocks;
+		size_t blockSize = 0;
+
+		~CtxtPool();
+	};
+
+	/**
+	 * The random stream of a factory on a thread, see HELibCipherTextFactory::randomStream()
+	 */
+	struct RandomStreamEntry {
+		std::weak_ptr<bool> alive;
+		long generation = -1;
+		std::unique_ptr<NTL::RandomStream> stream;
+	};
+
+	thread_local std::unordered_map<long, RandomStreamEntry> tRandomStreams; // by pool id of the factory
+
+	thread_local CtxtPool tCtxtPool;
+	thread_local bool tCtxtPoolDestroyed = false; // ciphertexts can outlive the pool of their thread
+
+	CtxtPool::~CtxtPool() {
+		for ( auto& entry : entries )
+			for ( Ctxt* ctxt : entry.second.free )
+				delete ctxt;
+		for ( void* block : blocks )
+			::operator delete( block );
+		tCtxtPoolDestroyed = true;
+	}
+
+	/**
+	 * Keeps the ciphertext as it is, parts included. The next user either clears it (see createRawEmpty()) or
+	 * assigns to it (see createRawCopy()), an assignment reuses the storage of the parts.
+	 */
+	void recycle( long poolId, Ctxt* ctxt ) {
+		if ( tCtxtPoolDestroyed ) {
+			delete ctxt;
+			return;
+		}
+		auto entry = tCtxtPool.entries.find( poolId );
+		if ( entry == tCtxtPool.entries.end() || entry->second.alive.expired() || entry->second.free.size() >= MAX_POOLED_CTXTS ) {
+			delete ctxt;
+			return;
+		}
+		entry->second.free.push_back( ctxt );
+	}
+
+	/**
+	 * Allocator for allocate_shared that takes the memory from the free blocks of the calling thread, so handing
+	 * out a pooled ciphertext does not allocate a new control block every time. All control blocks have the same
+	 * size, other sizes go to the heap.
+	 */
+	template<class T>
+	struct BlockAllocator {
+		typedef T value_type;
+
+		BlockAllocator() = default;
+
+		template<class U>
+		BlockAllocator( const BlockAllocator<U>& ) {
+		}
+
+		T* allocate( size_t n ) {
+			const size_t size = n * sizeof( T );
+			if ( !tCtxtPoolDestroyed && size == tCtxtPool.blockSize && !tCtxtPool.blocks.empty() ) {
+				void* block = tCtxtPool.blocks.back();
+				tCtxtPool.blocks.pop_back();
+				return static_cast<T*>( block );
+			}
+			return static_cast<T*>( ::operator new( size ) );
+		}
+
+		void deallocate( T* p, size_t n ) {
+			const size_t size = n * sizeof( T );
+			if ( tCtxtPoolDestroyed || ( tCtxtPool.blockSize != 0 && tCtxtPool.blockSize != size )
+					|| tCtxtPool.blocks.size() >= MAX_POOLED_BLOCKS ) {
+				::operator delete( p );
+				return;
+			}
+			tCtxtPool.blockSize = size;
+			tCtxtPool.blocks.push_back( p );
+		}
+	};
+
+	template<class T, class U>
+	bool operator==( const BlockAllocator<T>&, const BlockAllocator<U>& ) {
+		return true;
+	}
+
+	template<class T, class U>
+	bool operator!=( const BlockAllocator<T>&, const BlockAllocator<U>& ) {
+		return false;
+	}
+
+	/**
+	 * Owns a pooled ciphertext and gives it back to the pool of the releasing thread once the last copy is gone
+	 */
+	struct CtxtLease {
+		long poolId;
+		Ctxt* ctxt;
+
+		CtxtLease( long poolId, Ctxt* ctxt ) : poolId( poolId ), ctxt( ctxt ) {
+		}
+
+		~CtxtLease() {
+			recycle( poolId, ctxt );
+		}
+
+		CtxtLease( const CtxtLease& ) = delete;
+		void operator=( const CtxtLease& ) = delete;
+	};
+
+	/**
+	 * Wraps ctxt into a shared_ptr whose control block (together with the lease) comes from the block pool
+	 */
+	std::shared_ptr<Ctxt> lease( long poolId, Ctxt* ctxt ) {
+		auto owner = std::allocate_shared<CtxtLease>( BlockAllocator<CtxtLease>(), poolId, ctxt );
+		return std::shared_ptr<Ctxt>( owner, ctxt ); // shares the control block of owner
+	}
+}
 
 HELibCipherText::HELibCipherText() :
 		mFactory( defaultFactory ), mCtxt( mFactory->createRawEmpty() ) {
@@ -25,6 +171,10 @@ HELibCipherText HELibCipherText::empty() {
 	return this->mFactory->empty();
 }
 
+bool HELibCipherText::noiseNearOverflow() const {
+	return !mCtxt->isEmpty() && noiseBudget() < mFactory->minNoiseBudget();
+}
+
 HELibCipherText& HELibCipherText::operator+=( long x ) {
 	if ( mFactory->useBFV )
 		mCtxt->addConstant( NTL::to_ZZ( x ) );
@@ -87,8 +237,265 @@ HELibCipherText& HELibCipherText::operator*=( double x ) {
 	return *this;
 }
 
+void HELibCipherText::relinearize() {
+	if ( mCtxt->inCanonicalForm() )
+		return;
+	std::shared_ptr<Ctxt> relinearized = mFactory->createRawCopy( *mCtxt );
+	relinearized->reLinearize();
+	mCtxt = relinearized;
+}
+
+void HELibCipherText::modDownToLevel( long level ) {
+	if ( mCtxt->isEmpty() || mCtxt->findBaseLevel() <= level )
+		return;
+	std::shared_ptr<Ctxt> switched = mFactory->createRawCopy( *mCtxt );
+	if ( !switched->inCanonicalForm() )
+		switched->reLinearize();
+	switched->modDownToLevel( level );
+	mCtxt = switched;
+}
+
+HELibCipherText& HELibCipherText::operator*=( const HELibCipherText& other ) {
+	relinearize();
+	std::shared_ptr<Ctxt> factor = other.mCtxt; // after relinearize() for a square
+	if ( !factor->inCanonicalForm() ) { // other is const and may be read by other threads, relinearize a copy
+		factor = mFactory->createRawCopy( *factor );
+		factor->reLinearize();
+	}
+	if ( mFactory->lazyRelinearization() )
+		mCtxt->multLowLvl( *factor );
+	else
+		*mCtxt *= *factor;
+	return *this;
+}
+
+HELibCipherText& HELibCipherText::operator+=( const HELibConstant& x ) {
+	if ( mFactory->useBFV )
+		mCtxt->addConstant( x.integer );
+	else if ( x.integral )
+		mCtxt->addConstantCKKS( x.value );
+	else
+		mCtxt->addConstantCKKS( x.rational );
+	return *this;
+}
+
+HELibCipherText& HELibCipherText::operator*=( const HELibConstant& x ) {
+	if ( x.zero ) {
+		mCtxt = mFactory->createRawEmpty();
+		return *this;
+	}
+	if ( mFactory->useBFV ) {
+		if ( !x.integral )
+			throw std::logic_error( "cant do float with bfv" );
+		mCtxt->multByConstant( x.integer );
+	}
+	else if ( x.integral )
+		mCtxt->multByConstantCKKS( x.value );
+	else
+		mCtxt->multByConstantCKKS( x.rational );
+	return *this;
+}
+
+
+
+
+long HELibCipherTextFactory::newPoolId() {
+	static std::atomic<long> nextId( 0 );
+	return nextId++;
+}
+
+Ctxt* HELibCipherTextFactory::takePooledCtxt() {
+	auto& entry = tCtxtPool.entries[ mPoolId ];
+	if ( !entry.free.empty() ) {
+		Ctxt* ctxt = entry.free.back();
+		entry.free.pop_back();
+		return ctxt;
+	}
+	if ( entry.alive.expired() ) { // first ciphertext of this factory on the thread, drop the pools of dead factories
+		entry.alive = mAlive;
+		for ( auto it = tCtxtPool.entries.begin(); it != tCtxtPool.entries.end(); ) {
+			if ( !it->second.alive.expired() ) {
+				++it;
+				continue;
+			}
+			for ( Ctxt* dead : it->second.free )
+				delete dead;
+			it = tCtxtPool.entries.erase( it );
+		}
+	}
+	return nullptr;
+}
+
+std::shared_ptr<Ctxt> HELibCipherTextFactory::createRawEmpty() {
+	if ( tCtxtPoolDestroyed )
+		return std::make_shared<Ctxt>( *publicKey );
+	Ctxt* ctxt = takePooledCtxt();
+	if ( ctxt )
+		ctxt->clear();
+	else
+		ctxt = new Ctxt( *publicKey );
+	return lease( mPoolId, ctxt );
+}
+
+std::shared_ptr<Ctxt> HELibCipherTextFactory::createRawCopy( const Ctxt& from ) {
+	if ( tCtxtPoolDestroyed )
+		return std::make_shared<Ctxt>( from );
+	Ctxt* ctxt = takePooledCtxt();
+	if ( ctxt )
+		*ctxt = from; // the parts of the pooled ciphertext get overwritten in place
+	else
+		ctxt = new Ctxt( from );
+	return lease( mPoolId, ctxt );
+}
+
+void HELibCipherTextFactory::multiplyTerm( Ctxt& term, long w ) {
+	if ( useBFV )
+		term.multByConstant( NTL::to_ZZ( w ) );
+	else
+		term.multByConstantCKKS( w );
+}
+
+void HELibCipherTextFactory::multiplyTerm( Ctxt& term, double w ) {
+	if ( useBFV )
+		throw std::logic_error( "cant do float with bfv" );
+	term.multByConstantCKKS( rationalApprox( w, 1L << term.getContext().alMod.getR() ) );
+}
+
+void HELibCipherTextFactory::multiplyTerm( Ctxt& term, const HELibConstant& w ) {
+	if ( useBFV ) {
+		if ( !w.integral )
+			throw std::logic_error( "cant do float with bfv" );
+		term.multByConstant( w.integer );
+	}
+	else if ( w.integral )
+		term.multByConstantCKKS( w.value );
+	else
+		term.multByConstantCKKS( w.rational );
+}
+
+HELibConstant HELibCipherTextFactory::encode( long x ) {
+	HELibConstant c;
+	c.zero = x == 0;
+	c.value = x;
+	c.integer = NTL::to_ZZ( x );
+	return c;
+}
+
+HELibConstant HELibCipherTextFactory::encode( double x ) {
+	HELibConstant c;
+	c.zero = x == 0;
+	c.integral = false;
+	c.integer = NTL::to_ZZ( x ); // what operator+=( double ) adds for BFV
+	if ( !useBFV )
+		c.rational = rationalApprox( x, 1L << context->alMod.getR() );
+	return c;
+}
+
+namespace {
+	bool isZero( long w ) {
+		return w == 0;
+	}
+
+	bool isZero( double w ) {
+		return w == 0;
+	}
+
+	bool isZero( const HELibConstant& w ) {
+		return w.zero;
+	}
+}
+
+template<class InputAt, class WeightAt>
+void HELibCipherTextFactory::accumulate( HELibCipherText& acc, size_t n, InputAt inputAt, WeightAt weightAt ) {
+	Ctxt term( *publicKey ); // reused for every term, assigning keeps its storage
+	for ( size_t k = 0; k < n; ++k ) {
+		auto&& w = weightAt( k );
+		if ( isZero( w ) )
+			continue;
+		term = inputAt( k ).ctxt();
+		multiplyTerm( term, w );
+		*acc.mCtxt += term;
+	}
+	if ( acc.mCtxt->getRatFactor().x == 0 ) // same safeguard as in operator+=, the sum carries no value anymore
+		acc.mCtxt = createRawEmpty();
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* const * in, const long* weights, size_t n ) {
+	accumulate( acc, n, [in]( size_t k ) -> const HELibCipherText& {return *in[ k ];}, [weights]( size_t k ) {return weights[ k ];} );
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* const * in, const float* weights, size_t n ) {
+	accumulate( acc, n, [in]( size_t k ) -> const HELibCipherText& {return *in[ k ];}, [weights]( size_t k ) {return (double) weights[ k ];} );
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* const * in, const double* weights, size_t n ) {
+	accumulate( acc, n, [in]( size_t k ) -> const HELibCipherText& {return *in[ k ];}, [weights]( size_t k ) {return weights[ k ];} );
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const long* weights, size_t weightStride ) {
+	accumulate( acc, rows * rowLength,
+			[=]( size_t k ) -> const HELibCipherText& {return in[ k / rowLength * inStride + k % rowLength ];},
+			[=]( size_t k ) {return weights[ k / rowLength * weightStride + k % rowLength ];} );
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const float* weights, size_t weightStride ) {
+	accumulate( acc, rows * rowLength,
+			[=]( size_t k ) -> const HELibCipherText& {return in[ k / rowLength * inStride + k % rowLength ];},
+			[=]( size_t k ) {return (double) weights[ k / rowLength * weightStride + k % rowLength ];} );
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const double* weights, size_t weightStride ) {
+	accumulate( acc, rows * rowLength,
+			[=]( size_t k ) -> const HELibCipherText& {return in[ k / rowLength * inStride + k % rowLength ];},
+			[=]( size_t k ) {return weights[ k / rowLength * weightStride + k % rowLength ];} );
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* const * in, const HELibConstant* weights, size_t n ) {
+	accumulate( acc, n, [in]( size_t k ) -> const HELibCipherText& {return *in[ k ];}, [weights]( size_t k ) -> const HELibConstant& {return weights[ k ];} );
+}
+
+void HELibCipherTextFactory::dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const HELibConstant* weights, size_t weightStride ) {
+	accumulate( acc, rows * rowLength,
+			[=]( size_t k ) -> const HELibCipherText& {return in[ k / rowLength * inStride + k % rowLength ];},
+			[=]( size_t k ) -> const HELibConstant& {return weights[ k / rowLength * weightStride + k % rowLength ];} );
+}
+
+template<class WeightType>
+void HELibCipherTextFactory::scatterTerms( HELibCipherText* const * acc, const HELibCipherText& in, const WeightType* weights, size_t n ) {
+	Ctxt term( *publicKey ); // reused for every term like in accumulate()
+	for ( size_t k = 0; k < n; ++k ) {
+		if ( isZero( weights[ k ] ) )
+			continue;
+		term = in.ctxt();
+		multiplyTerm( term, weights[ k ] );
+		*acc[ k ]->mCtxt += term;
+		if ( acc[ k ]->mCtxt->getRatFactor().x == 0 )
+			acc[ k ]->mCtxt = createRawEmpty();
+	}
+}
+
+void HELibCipherTextFactory::scatter( HELibCipherText* const * acc, const HELibCipherText& in, const long* weights, size_t n ) {
+	scatterTerms( acc, in, weights, n );
+}
+
+void HELibCipherTextFactory::scatter( HELibCipherText* const * acc, const HELibCipherText& in, const float* weights, size_t n ) {
+	scatterTerms( acc, in, weights, n ); // float weights get multiplied as doubles, like in dot()
+}
 
+void HELibCipherTextFactory::scatter( HELibCipherText* const * acc, const HELibCipherText& in, const double* weights, size_t n ) {
+	scatterTerms( acc, in, weights, n );
+}
 
+void HELibCipherTextFactory::scatter( HELibCipherText* const * acc, const HELibCipherText& in, const HELibConstant* weights, size_t n ) {
+	scatterTerms( acc, in, weights, n );
+}
+
+void HELibCipherTextFactory::shareThreadBudget() {
+#ifdef NTL_THREADS
+	// NTL keeps one thread pool per thread, so this only affects the calling worker
+	ThreadPool::getPool().innerParallelism( []( size_t threads ) {NTL::SetNumThreads( threads );} );
+#endif
+}
 
 void HELibCipherTextFactory::setAsDefaultFactory(){
 	HELibCipherText::defaultFactory = this;
@@ -96,37 +503,229 @@ void HELibCipherTextFactory::setAsDefaultFactory(){
 
 
 
+NTL::RandomStream& HELibCipherTextFactory::randomStream() {
+	RandomStreamEntry& entry = tRandomStreams[ mPoolId ];
+	if ( entry.stream && entry.generation == mStreamGeneration )
+		return *entry.stream;
+	if ( entry.alive.expired() ) { // first stream of this factory on the thread, drop the streams of dead factories
+		entry.alive = mAlive;
+		for ( auto it = tRandomStreams.begin(); it != tRandomStreams.end(); )
+			it = it->second.alive.expired() ? tRandomStreams.erase( it ) : std::next( it );
+	}
+	// the key of the stream is a hash of the stream key of the factory and the stream number
+	unsigned char data[ NTL_PRG_KEYLEN + sizeof( uint64_t ) ];
+	{
+		std::lock_guard<std::mutex> lock( mStreamMutex );
+		uint64_t number = mNextStream++;
+		memcpy( data, mStreamKey.data(), NTL_PRG_KEYLEN );
+		memcpy( data + NTL_PRG_KEYLEN, &number, sizeof( number ) );
+		entry.generation = mStreamGeneration;
+	}
+	unsigned char key[ NTL_PRG_KEYLEN ];
+	NTL::DeriveKey( key, NTL_PRG_KEYLEN, data, sizeof( data ) );
+	entry.stream.reset( new NTL::RandomStream( key ) );
+	return *entry.stream;
+}
+
+template<class Encrypt>
+void HELibCipherTextFactory::withRandomStream( Encrypt encrypt ) {
+	NTL::RandomStream& stream = randomStream();
+	NTL::RandomStreamPush push; // restores the stream of the thread when it goes out of scope
+	NTL::SetSeed( stream );
+	encrypt();
+	stream = NTL::GetCurrentRandomStream();
+}
+
+std::array<unsigned char, NTL_PRG_KEYLEN> HELibCipherTextFactory::systemStreamKey() {
+	std::random_device device;
+	std::array<unsigned char, NTL_PRG_KEYLEN> key;
+	for ( unsigned char& byte : key )
+		byte = (unsigned char) device();
+	return key;
+}
+
+void HELibCipherTextFactory::seedRandomStreams( long seed ) {
+	// a label keeps the streams apart from the key generation, which seeds NTL with the plain seed
+	std::string label = "encryption streams " + std::to_string( seed );
+	std::lock_guard<std::mutex> lock( mStreamMutex );
+	NTL::DeriveKey( mStreamKey.data(), NTL_PRG_KEYLEN, (const unsigned char*) label.data(), label.size() );
+	mNextStream = 0;
+	++mStreamGeneration;
+}
+
+void HELibCipherTextFactory::writeKeys( std::ostream& out ) {
+	out.put( useBFV ? 1 : 0 );
+	writeContextBase( out, *context );
+	out << *context << *secretKey;
+}
+
+HELibCipherTextFactory::HELibCipherTextFactory( std::istream& keys ) :
+		useBFV( keys.get() == 1 ) {
+
+	NTL::SetNumThreads( 1 );
+	unsigned long m, p, r;
+	std::vector<long> gens, ords;
+	readContextBase( keys, m, p, r, gens, ords );
+	context = std::make_shared<FHEcontext>( m, p, r, gens, ords );
+	keys >> *context;
+	secretKey = std::make_shared<FHESecKey>( *context );
+	keys >> *secretKey;
+	if ( !keys )
+		throw std::runtime_error( "could not read the keys" );
+	publicKey = secretKey;
+	ea = std::make_shared<EncryptedArray>( *context );
+}
+
+std::unique_ptr<HELibCipherTextFactory> HELibCipherTextFactory::readKeys( std::istream& in ) {
+	return std::unique_ptr<HELibCipherTextFactory>( new HELibCipherTextFactory( in ) );
+}
+
+/**
+ * Encryptions of zero, see HELibCipherTextFactory::precomputeZeros()
+ */
+struct HELibCipherTextFactory::ZeroPool {
+	std::mutex mutex;
+	std::condition_variable refill; // wakes the background threads once zeros got taken or the pool stops
+	std::deque<std::shared_ptr<Ctxt>> zeros;
+	size_t capacity = 0;
+	size_t encrypting = 0; // zeros the background threads are working on
+	std::atomic<bool> stop { false };
+	std::vector<std::thread> threads;
+};
+
+HELibCipherTextFactory::~HELibCipherTextFactory() {
+	precomputeZeros( 0 );
+}
+
+void HELibCipherTextFactory::precomputeZeros( size_t capacity, size_t threads ) {
+	if ( mZeroPool ) {
+		{
+			std::lock_guard<std::mutex> lock( mZeroPool->mutex );
+			mZeroPool->stop = true;
+		}
+		mZeroPool->refill.notify_all();
+		ThreadPool::getPool().interruptIdleWaits();
+		for ( auto& thread : mZeroPool->threads )
+			thread.join();
+		mZeroPool.reset();
+	}
+	if ( capacity == 0 )
+		return;
+	mZeroPool = std::make_shared<ZeroPool>();
+	mZeroPool->capacity = capacity;
+	for ( size_t i = 0; i < threads; ++i )
+		mZeroPool->threads.emplace_back( [this] {this->refillZeros();} );
+}
+
+size_t HELibCipherTextFactory::precomputedZeros() const {
+	if ( !mZeroPool )
+		return 0;
+	std::lock_guard<std::mutex> lock( mZeroPool->mutex );
+	return mZeroPool->zeros.size();
+}
+
+std::shared_ptr<Ctxt> HELibCipherTextFactory::encryptZero() {
+	auto zero = std::make_shared<Ctxt>( *publicKey );
+	withRandomStream( [&] {
+		if ( useBFV )
+			publicKey->Encrypt( *zero, NTL::to_ZZX( 0 ) );
+		else {
+			const EncryptedArrayCx& ea = context->ea->getCx();
+			ea.encrypt( *zero, *publicKey, std::vector<double>( ea.size(), 0. ) );
+		}
+	} );
+	return zero;
+}
+
+void HELibCipherTextFactory::refillZeros() {
+	ZeroPool& pool = *mZeroPool;
+	ThreadPool& threadPool = ThreadPool::getPool();
+	while ( true ) {
+		{
+			std::unique_lock<std::mutex> lock( pool.mutex );
+			pool.refill.wait( lock, [&pool] {return pool.stop || pool.zeros.size() + pool.encrypting < pool.capacity;} );
+			if ( pool.stop )
+				return;
+			++pool.encrypting;
+		}
+		// the layers have work queued, leave the cores to them
+		threadPool.waitForIdle( [&pool] {return (bool) pool.stop;} );
+		if ( pool.stop )
+			return;
+		std::shared_ptr<Ctxt> zero = encryptZero();
+		std::lock_guard<std::mutex> lock( pool.mutex );
+		--pool.encrypting;
+		pool.zeros.push_back( std::move( zero ) );
+	}
+}
+
+std::shared_ptr<Ctxt> HELibCipherTextFactory::takeZero() {
+	if ( !mZeroPool )
+		return nullptr;
+	std::shared_ptr<Ctxt> zero;
+	{
+		std::lock_guard<std::mutex> lock( mZeroPool->mutex );
+		if ( mZeroPool->zeros.empty() )
+			return nullptr;
+		zero = std::move( mZeroPool->zeros.front() );
+		mZeroPool->zeros.pop_front();
+	}
+	mZeroPool->refill.notify_one();
+	return zero;
+}
+
+HELibCipherText HELibCipherTextFactory::createCipherText( long x ) {
+	if ( !useBFV )
+		return createCipherText( std::vector<double>( batchsize(), (double) x ) );
+	std::shared_ptr<Ctxt> ctxt = takeZero();
+	if ( ctxt )
+		ctxt->addConstant( NTL::to_ZZ( x ) );
+	else {
+		ctxt = createRawEmpty();
+		withRandomStream( [&] {publicKey->Encrypt( *ctxt, NTL::to_ZZX( x ) );} );
+	}
+	return HELibCipherText( ctxt, this );
+}
+
 HELibCipherText HELibCipherTextFactory::createCipherText( const std::vector<long> & in ) {
-	std::shared_ptr<Ctxt> ctxt = std::make_shared<Ctxt>( *publicKey );
-	if ( useBFV ) {
-		ea->encrypt<std::vector<long>>( *ctxt, *publicKey, in );
+	if ( !useBFV )
+		return createCipherText( std::vector<double>( in.begin(), in.end() ) );
+	std::shared_ptr<Ctxt> ctxt = takeZero();
+	if ( ctxt ) {
+		NTL::ZZX encoded;
+		ea->encode( encoded, in );
+		ctxt->addConstant( encoded );
 	} else {
-		EncryptedArrayCx ea = context.get()->ea->getCx();
-		ea.encrypt( *ctxt, *publicKey, in );
+		ctxt = createRawEmpty();
+		withRandomStream( [&] {ea->encrypt<std::vector<long>>( *ctxt, *publicKey, in );} );
 	}
 	return HELibCipherText( ctxt, this );
 }
 
 
 HELibCipherText HELibCipherTextFactory::createCipherText( const std::vector<double> & in ) {
-	std::shared_ptr<Ctxt> ctxt = std::make_shared<Ctxt>( *publicKey );
-	if ( useBFV ) {
+	if ( useBFV )
 		throw std::logic_error( "cant use doubles with BFV" );
+	const EncryptedArrayCx& ea = context->ea->getCx();
+	std::shared_ptr<Ctxt> ctxt = takeZero();
+	if ( ctxt ) {
+		// the same encoding the encryption would use, added with its own scaling factor
+		zzX encoded;
+		double factor = ea.encode( encoded, in );
+		ctxt->addConstantCKKS( encoded, NTL::xdouble( -1.0 ), NTL::to_xdouble( factor ) );
 	} else {
-		EncryptedArrayCx ea = context.get()->ea->getCx();
-		ea.encrypt( *ctxt, *publicKey, in );
+		ctxt = createRawEmpty();
+		withRandomStream( [&] {ea.encrypt( *ctxt, *publicKey, in );} );
 	}
 	return HELibCipherText( ctxt, this );
 }
 
 
 HELibCipherText HELibCipherTextFactory::createCipherText( const std::vector<float> & in ) {
-	std::shared_ptr<Ctxt> ctxt = std::make_shared<Ctxt>( *publicKey );
 	if ( useBFV )
 		throw std::logic_error( "cant use doubles with BFV" );
 	std::vector<double> doubleVector( in.begin(), in.end() );
-	createCipherText( doubleVector );
-	return HELibCipherText( ctxt, this );
+	return createCipherText( doubleVector );
 }
 
 
@@ -141,12 +740,15 @@ std::vector<double> HELibCipherTextFactory::decryptDouble( const HELibCipherText
 	if ( useBFV )
 		throw std::logic_error( "cant decrypt doubles with BFV" );
 	std::vector<double> plain( batchsize(), 0.0 );
-	EncryptedArrayCx ea = context.get()->ea->getCx();
-	ea.decrypt( ctx.ctxt(), *secretKey, plain );
+	context->ea->getCx().decrypt( ctx.ctxt(), *secretKey, plain );
 	return plain;
 }
 
-HELibCipherText& HELibCipherText::operator+=( HELibCipherText& other ) {
+HELibCipherText& HELibCipherText::operator+=( const HELibCipherText& other ) {
+	if ( mCtxt->isEmpty() ) { // x = empty(); x += other; makes a private copy, into the storage of a pooled ciphertext
+		mCtxt = mFactory->createRawCopy( other.ctxt() );
+		return *this;
+	}
 	*mCtxt += ( (HELibCipherText&) other ).ctxt();
 	if ( mCtxt->getRatFactor().x == 0 ) {
 		std::cout << "rat factor is zero" << std::endl;
@@ -159,27 +761,32 @@ HELibCipherText& HELibCipherText::operator+=( HELibCipherText& other ) {
 }
 
 
+template<class ValueAt>
+void HELibCipherTextFactory::encryptElements( size_t num, ValueAt valueAt, Tensor<HELibCipherText>& tensor ) {
+	const uint bs = batchsize();
+	std::vector<HELibCipherText> cipherTexts( num, empty() );
+	ThreadPool::getPool().parallelFor( 0, num, [&]( long i ) {
+		std::vector<double> slots( bs );
+		for ( size_t batch = 0; batch < bs; ++batch )
+			slots[ batch ] = valueAt( i, batch );
+		cipherTexts[ i ] = createCipherText( slots );
+	}, 0 );
+	Shape oldShape = tensor.shape;
+	tensor.flatten();
+	tensor.init( cipherTexts );
+	tensor.reshape( oldShape );
+}
+
+
 TensorP<HELibCipherText> HELibCipherTextFactory::createCipherTensor( const std::vector<double>& in, const Shape& shape, HETensorFactory<HELibCipherText>* hetf ){
 	if( shape[ 0 ] != batchsize() )
 		throw std::logic_error( "Shape does not match supported batchsize" );
 
-	const uint bs = batchsize();
-	// create a vector of ciphertexts
-	const size_t num = in.size() / bs; // number of elements in a batch
-	std::vector<double> temp( num, 0 );
-
-	std::vector<HELibCipherText> cipherTexts;
-	for( size_t i=0; i<num; ++i )
-		for( size_t batch = 0; batch < shape[ 0 ]; ++batch ){
-			temp[ i ]= in[ batch + num * i ] ;
-		cipherTexts.push_back( createCipherText( temp ) );
-	}
-
+	const size_t num = in.size() / batchsize(); // number of elements in a batch
 	Shape newShape = shape;
 	newShape[ 0 ] = 1;
 	auto ret = hetf->create( { num } );
-
-	ret->init( cipherTexts );
+	encryptElements( num, [&in, num]( size_t i, size_t batch ) {return in[ i + batch * num ];}, *ret );
 	ret->reshape( newShape );
 	return ret;
 }
@@ -194,34 +801,16 @@ TensorP<HELibCipherText> HELibCipherTextFactory::createCipherTensor( const std::
 
 
 void HELibCipherTextFactory::feedCipherTensor( const std::vector<double>& in, TensorP<HELibCipherText> tensor ){
-	const uint bs = batchsize();
-	// create a vector of ciphertexts
-	std::cout << "batchsize " <<  bs << std::endl;
-	std::cout << "in size " <<  in.size() << std::endl;
-
-	const size_t num = in.size() / bs; // number of elements in a batch
+	const size_t num = in.size() / batchsize(); // number of elements in a batch
 
 	// do some sanity checking
 	size_t numCheck = 1;
 	for( size_t i = 1; i < tensor->shape.size; ++i )
 		numCheck *= tensor->shape[ i ];
-	std::cout << num << std::endl;
-	std::cout << numCheck << std::endl;
 	if( num != numCheck )
 		throw std::logic_error( "Shape does not match supported batchsize" );
 
-
-	std::vector<double> temp( bs, 0 );
-	std::vector<HELibCipherText> cipherTexts;
-	for( size_t i=0; i<num; ++i ){
-		for( size_t batch = 0; batch < bs; ++batch )
-			temp[ batch ]= in[ i + batch * num ];
-		cipherTexts.push_back( createCipherText( temp ) );
-	}
-	Shape oldShape = tensor->shape;
-	tensor->flatten();
-	tensor->init( cipherTexts );
-	tensor->reshape( oldShape );
+	encryptElements( num, [&in, num]( size_t i, size_t batch ) {return in[ i + batch * num ];}, *tensor );
 }
 
 
@@ -232,44 +821,118 @@ void HELibCipherTextFactory::feedCipherTensor( const std::vector<float>& in, Ten
 
 
 void HELibCipherTextFactory::feedCipherTensor( const TensorP<double> in, Tensor<HELibCipherText>& tensor ){
-	const uint bs = batchsize();
-	// create a vector of ciphertexts
-//	std::cout << "batchsize " <<  bs << std::endl;
-//	std::cout << "in size " <<  in->shape.capacity() << std::endl;
-
-	const size_t num = in->shape.capacity() / bs; // number of elements in a batch
+	const size_t num = in->shape.capacity() / batchsize(); // number of elements in a batch
 
 	// do some sanity checking
 	size_t numCheck = 1;
 	for( size_t i = 1; i < tensor.shape.size; ++i )
 		numCheck *= tensor.shape[ i ];
-//	std::cout << num << std::endl;
-//	std::cout << numCheck << std::endl;
 	if( num != numCheck )
 		throw std::logic_error( "Shape does not match supported batchsize" );
 
+	encryptElements( num, [&in, num]( size_t i, size_t batch ) {return ( *in )[ (long) ( i + batch * num ) ];}, tensor );
+}
+
 
-	std::vector<double> temp( bs, 0 );
-	std::vector<HELibCipherText> cipherTexts;
-	for( size_t i=0; i<num; ++i ){
-		for( size_t batch = 0; batch < bs; ++batch ){
-			temp[ batch ]= in->operator []( i + batch * num);
+
+void HELibCipherTextFactory::feedCipherTensor( const TensorP<double> in, TensorP<HELibCipherText> tensor ){
+	feedCipherTensor( in, *tensor );
+}
+
+namespace {
+	/**
+	 * Hashes everything written to it with 64 bit FNV-1a, so large objects can be fingerprinted without keeping
+	 * their text around.
+	 */
+	class FingerprintBuffer: public std::streambuf {
+	public:
+		uint64_t hash = 14695981039346656037ull;
+	protected:
+		int_type overflow( int_type c ) override {
+			if ( c != traits_type::eof() )
+				add( (unsigned char) c );
+			return traits_type::not_eof( c );
+		}
+
+		std::streamsize xsputn( const char* s, std::streamsize n ) override {
+			for ( std::streamsize i = 0; i < n; ++i )
+				add( (unsigned char) s[ i ] );
+			return n;
 		}
-		cipherTexts.push_back( createCipherText( temp ) );
+	private:
+		void add( unsigned char c ) {
+			hash = ( hash ^ c ) * 1099511628211ull;
+		}
+	};
+}
+
+void HELibCipherTextFactory::writeCipherText( const HELibCipherText& ctxt, std::ostream& out ) {
+	ctxt.ctxt().write( out );
+}
+
+void HELibCipherTextFactory::writeCipherText( const HELibCipherText& ctxt, std::ostream& out, long level ) {
+	if ( ctxt.ctxt().isEmpty() || ctxt.level() <= level ) {
+		writeCipherText( ctxt, out );
+		return;
 	}
-//	std::cout << std::endl;
+	// switch a copy, shared copies of ctxt still see the full chain
+	Ctxt dropped( ctxt.ctxt() );
+	if ( !dropped.inCanonicalForm() )
+		dropped.reLinearize();
+	dropped.modDownToLevel( level );
+	dropped.write( out );
+}
 
+HELibCipherText HELibCipherTextFactory::refreshCipherText( const HELibCipherText& ctxt ) {
+	std::shared_ptr<Ctxt> fresh = createRawEmpty();
+	if ( useBFV ) {
+		std::vector<long> values = decryptLong( ctxt );
+		withRandomStream( [&] {ea->encrypt<std::vector<long>>( *fresh, *publicKey, values );} );
+	} else {
+		std::vector<double> values = decryptDouble( ctxt );
+		withRandomStream( [&] {context->ea->getCx().encrypt( *fresh, *publicKey, values );} );
+	}
+	return HELibCipherText( fresh, this );
+}
 
-	Shape oldShape = tensor.shape;
-	tensor.flatten();
-	tensor.init( cipherTexts );
-	tensor.reshape( oldShape );
+HELibCipherText HELibCipherTextFactory::bootstrap( const HELibCipherText& ctxt ) {
+	if ( !mBootstrappable )
+		throw std::logic_error( "the context has no bootstrapping keys" );
+	if ( ctxt.ctxt().isEmpty() )
+		return ctxt;
+	std::shared_ptr<Ctxt> fresh = createRawCopy( ctxt.ctxt() );
+	if ( !fresh->inCanonicalForm() )
+		fresh->reLinearize();
+	publicKey->thinReCrypt( *fresh );
+	return HELibCipherText( fresh, this );
 }
 
+HELibCipherText HELibCipherTextFactory::readCipherText( std::istream& in ) {
+	std::shared_ptr<Ctxt> ctxt = createRawEmpty();
+	ctxt->read( in );
+	if ( !in )
+		throw std::runtime_error( "could not read ciphertext" );
+	return HELibCipherText( ctxt, this );
+}
 
+uint64_t HELibCipherTextFactory::contextFingerprint() {
+	std::call_once( mFingerprinted, [this] {
+		FingerprintBuffer buffer;
+		std::ostream out( &buffer );
+		out << *context << *publicKey;
+		mFingerprint = buffer.hash;
+	} );
+	return mFingerprint;
+}
 
-void HELibCipherTextFactory::feedCipherTensor( const TensorP<double> in, TensorP<HELibCipherText> tensor ){
-	feedCipherTensor( in, *tensor );
+long HELibCipherTextFactory::levelsForDepth( long depth ) {
+	const long primes = context->ctxtPrimes.card();
+	if ( depth <= 0 || primes == 0 )
+		return 0;
+	const double plainBits = useBFV ? std::log2( (double) context->alMod.getPPowR() ) : context->alMod.getR();
+	const double primeBits = context->logOfProduct( context->ctxtPrimes ) / std::log( 2. ) / primes;
+	const long levels = (long) std::ceil( depth * ( plainBits + levelNoiseBits ) / primeBits );
+	return std::min( levels, primes );
 }
 
 std::ostream& operator<<( std::ostream& output, const HELibCipherText& heCtxt ) {
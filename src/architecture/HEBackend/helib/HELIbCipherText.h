@@ -12,73 +12,121 @@
 #include <NTL/ZZ.h>
 #include <helib/FHE.h>
 #include <ostream>
+#include <utility>
+#include <type_traits>
+#include <mutex>
+#include <array>
+#include <atomic>
 #include <helib/EncryptedArray.h>
 #include "../CipherTextWrapper.h"
 #include "../../ActivationFunction.h"
+#include "../../DotProduct.h"
 #include "../HETensor.h"
 
 
 class HELibCipherTextFactory;
 
 
+/**
+ * @brief A constant encoded the way the operators of HELibCipherText use it: the ZZ for BFV, the long or the
+ * rational approximation (rationalApprox with the precision of the context) for CKKS. Weights are scalars
+ * that go into every slot, so HElib needs no polynomial encoding for them; the conversions are all there is to
+ * precompute. Created by HELibCipherTextFactory::encode().
+ */
+struct HELibConstant {
+	bool zero = true;
+	bool integral = true;			// multiplied as an integer, rational is unused then
+	long value = 0;					// CKKS integers
+	NTL::ZZ integer;				// BFV
+	std::pair<long, long> rational { 0, 1 };	// CKKS non integers
+};
+
+
 class HELibCipherText {
 public:
 
 	friend HELibCipherTextFactory;
 
-	static HELibCipherTextFactory* defaultFactory; // declaration in cpp
+	typedef HELibCipherTextFactory Factory;
 
-	/**
-	 * Threshold for the noise. If the noise grows larger
-	 * reincryption is triggered if enabled.
-	 */
-	static long noiseThreshold;
+	static HELibCipherTextFactory* defaultFactory; // declaration in cpp
 
 	HELibCipherText();
 
 	HELibCipherText( std::shared_ptr<Ctxt> ctxt, HELibCipherTextFactory* factory ) :
-			mFactory( factory ), mCtxt( ctxt ) {
+			mFactory( factory ), mCtxt( std::move( ctxt ) ) {
 
 	}
 
+	// copies share the Ctxt, moves hand it over without touching the reference count
+	HELibCipherText( const HELibCipherText& ) = default;
+	HELibCipherText( HELibCipherText&& ) noexcept = default;
+	HELibCipherText& operator=( const HELibCipherText& ) = default;
+	HELibCipherText& operator=( HELibCipherText&& ) noexcept = default;
+
 	const Ctxt& ctxt() const {
 		return *mCtxt;
 	}
 
-	virtual HELibCipherText& operator+=( long x );
-	virtual HELibCipherText& operator*=( long x );
-	virtual HELibCipherText& operator+=( float x );
-	virtual HELibCipherText& operator*=( float x );
-	virtual HELibCipherText& operator+=( double x );
-	virtual HELibCipherText& operator*=( double x );
+	HELibCipherText& operator+=( long x );
+	HELibCipherText& operator*=( long x );
+	HELibCipherText& operator+=( float x );
+	HELibCipherText& operator*=( float x );
+	HELibCipherText& operator+=( double x );
+	HELibCipherText& operator*=( double x );
+	HELibCipherText& operator+=( const HELibConstant& x );
+	HELibCipherText& operator*=( const HELibConstant& x );
 
-	virtual HELibCipherText& operator+=( HELibCipherText* other ) {
+	HELibCipherText& operator+=( HELibCipherText* other ) {
 		*mCtxt += ( (HELibCipherText*) other )->ctxt();
 		return *this;
 	}
 
-	virtual HELibCipherText& operator*=( HELibCipherText* other ) {
-		*mCtxt *= ( (HELibCipherText*) other )->ctxt();
-		return *this;
+	HELibCipherText& operator*=( HELibCipherText* other ) {
+		return *this *= *other;
 	}
 
-	virtual HELibCipherText& operator+=( HELibCipherText& other );
+	HELibCipherText& operator+=( const HELibCipherText& other );
 
-	virtual HELibCipherText& operator*=( HELibCipherText& other ) {
-		*mCtxt *= ( (HELibCipherText&) other ).ctxt();
-		return *this;
-	}
+	/**
+	 * @brief Ciphertext product. With lazy relinearization (see HELibCipherTextFactory::lazyRelinearization()) the
+	 * product stays a degree 2 ciphertext until relinearize() is called.
+	 */
+	HELibCipherText& operator*=( const HELibCipherText& other );
 
-	virtual HELibCipherText empty();
+	HELibCipherText empty();
 
-	void square(){
-		mCtxt->square();
+	void square() {
+		*this *= *this;
 	}
 
-	void power( uint p ){
+	void power( uint p ) {
+		relinearize();
 		mCtxt->power( p );
 	}
 
+	/**
+	 * @brief Brings a degree 2 ciphertext left by a lazy product back to the canonical two parts. Does nothing if
+	 * the ciphertext is in canonical form already. Relinearizes a private copy, shared copies may be read by other
+	 * threads at the same time and keep the degree 2 ciphertext.
+	 */
+	void relinearize();
+
+	/**
+	 * @brief Level of the ciphertext in the modulus chain, the number of primes it has left. See
+	 * HELibCipherTextFactory::levelsForDepth() for the number of primes a multiplication takes.
+	 */
+	long level() const {
+		return mCtxt->findBaseLevel();
+	}
+
+	/**
+	 * @brief Drops primes from the ciphertext until it is at level, if it is above it. Later operations work on
+	 * fewer primes then. Does not change the value. Switches a private copy like relinearize(), shared copies keep
+	 * their level.
+	 */
+	void modDownToLevel( long level );
+
 
 	// TODO make me pretty
 	friend std::ostream& operator<<( std::ostream& output, const HELibCipherText& heCtxt );
@@ -91,16 +139,17 @@ public:
 	}
 
 	/**
-	 * @brief Checks if the noise is about to overflow
+	 * @brief Bits of the modulus left above the noise, HElib's estimate. Multiplications and mod switches use them up.
 	 */
-	bool noiseNearOverflow(){
-		//if ( ctxt().getNoiseBound() != 0 )
-		//	std::cout << ctxt().getNoiseBound().e << ' ' << noiseThreshold << std::endl;
-		return ctxt().getNoiseBound().e >= noiseThreshold;
+	double noiseBudget() const {
+		return mCtxt->capacity();
 	}
 
-	virtual ~HELibCipherText() {
-	}
+	/**
+	 * @brief Checks if the noise budget dropped below the minimum of the factory, see
+	 * CipherTextWrapperFactory::enableRefreshOnHighNoise()
+	 */
+	bool noiseNearOverflow() const;
 
 	// FIXME move back to private
 	HELibCipherTextFactory* mFactory;
@@ -111,6 +160,38 @@ private:
 
 };
 
+/**
+ * @brief BGV parameters of a context with bootstrapping, for HELibCipherTextFactory( const HELibBootstrappingParameters& ).
+ *
+ * Recryption needs m to be a product of the coprime factors mvec, and gens and ords to describe the slot structure.
+ * The defaults are the m = 4095 set of HElib's bootstrapping tests, 144 slots of Z_2^r. The plaintext space p^r has to
+ * hold the values of the model, forValueBits() raises r for that; recryption gets more expensive with r. Other sets
+ * can be taken from the same tables.
+ */
+struct HELibBootstrappingParameters {
+	long p = 2;			// plaintext prime
+	long r = 1;			// lifting, the plaintext space is p^r
+	long m = 4095;		// cyclotomic index
+	long L = 600;		// bits of the modulus chain, recryption uses up most of them
+	long c = 3;			// columns of the key switching matrices
+	long w = 64;		// hamming weight of the secret key
+	std::vector<long> mvec { 7, 5, 117 };
+	std::vector<long> gens { 2341, 3277, 3641 };
+	std::vector<long> ords { 6, 4, 6 };
+
+	/**
+	 * @brief The default set with the plaintext space 2^bits, for integer models whose values need bits bits. The
+	 * slots hold values modulo 2^bits, negative ones come back as 2^bits - |x|. The chain gets 30 bits more for every
+	 * bit of the plaintext space, recryption goes through more of it for a larger one.
+	 */
+	static HELibBootstrappingParameters forValueBits( long bits ) {
+		HELibBootstrappingParameters params;
+		params.r = bits;
+		params.L += 30 * ( bits - 1 );
+		return params;
+	}
+};
+
 /**
  * Factory to create `HELibCipherText`
  *
@@ -129,7 +210,7 @@ public:
 			useBFV( useBFV ) {
 
 		SetSeed( NTL::ZZ( seed ) );
-
+		shareThreadBudget();
 
 		if ( useBFV ) {
 			long p = 4999; // Plaintext prime modulus
@@ -188,6 +269,7 @@ public:
 			useBFV( false ) {
 
 		SetSeed( NTL::ZZ( 0 ) );
+		shareThreadBudget();
 		/// m specific the ring
 		/// p = -1 means CKKS
 		/// r is the number of bits after the decimal aka precision
@@ -201,25 +283,39 @@ public:
 
 	}
 
-	virtual HELibCipherText empty() override {
-		return HELibCipherText( std::make_shared<Ctxt>( *publicKey ), this );
+	/**
+	 * @brief BGV/BFV factory that can bootstrap its ciphertexts on the server, see bootstrap(). Generates the
+	 * recryption keys along with the others, which takes a while.
+	 */
+	HELibCipherTextFactory( const HELibBootstrappingParameters& params, long seed = 0 ) :
+			useBFV( true ) {
+
+		SetSeed( NTL::ZZ( seed ) );
+		shareThreadBudget();
+
+		NTL::Vec<long> mvec;
+		mvec.SetLength( params.mvec.size() );
+		for ( size_t i = 0; i < params.mvec.size(); ++i )
+			mvec[ i ] = params.mvec[ i ];
+
+		context = std::make_shared<FHEcontext>( params.m, params.p, params.r, params.gens, params.ords );
+		buildModChain( *context, params.L, params.c, /*willBeBootstrappable=*/true );
+		context->makeBootstrappable( mvec );
+		secretKey = std::make_shared<FHESecKey>( *context );
+		secretKey->GenSecKey( params.w );
+		addSome1DMatrices( *secretKey );
+		addFrbMatrices( *secretKey );	// recryption needs the Frobenius automorphisms as well
+		secretKey->genRecryptData();
+		publicKey = secretKey;
+		ea = std::make_shared<EncryptedArray>( *context );
+		mBootstrappable = true;
 	}
 
-	virtual HELibCipherText createCipherText( long x ) override {
-		std::shared_ptr<Ctxt> ctxt = std::make_shared<Ctxt>( *publicKey );
-		if ( useBFV ) {
-			publicKey->Encrypt( *ctxt, NTL::to_ZZX( x ) );
-		} else {
-			EncryptedArrayCx ea = context.get()->ea->getCx();
-			std::vector<long> vdLong;
-			for ( long i = 0; i < ea.size(); i++ ) {
-				vdLong.push_back( x );
-			}
-			ea.encrypt( *ctxt, *publicKey, vdLong );
-		}
-		return HELibCipherText( ctxt, this );
+	virtual HELibCipherText empty() override {
+		return HELibCipherText( createRawEmpty(), this );
 	}
 
+	virtual HELibCipherText createCipherText( long x ) override;
 
 	virtual HELibCipherText createCipherText( const std::vector<long> & in ) override;
 
@@ -237,6 +333,11 @@ public:
 
 	virtual TensorP<HELibCipherText> createCipherTensor( const std::vector<float>& in, const Shape& shape, HETensorFactory<HELibCipherText>* hetf ) override;
 
+	/**
+	 * @brief The feed and create functions encrypt the elements of the tensor in parallel on the ThreadPool. in holds
+	 * the instances one after the other, element i of instance b is in[ i + b * elements ]. Every thread encrypts
+	 * with its own random stream, see randomStream().
+	 */
 	virtual void feedCipherTensor( const std::vector<double>& in, TensorP<HELibCipherText> tensor ) override;
 
 
@@ -250,25 +351,293 @@ public:
 		return ea->size();
 	}
 
-	std::shared_ptr<Ctxt> createRawEmpty() {
-		return std::make_shared<Ctxt>( *publicKey );
+	virtual void writeCipherText( const HELibCipherText& ctxt, std::ostream& out ) override;
+
+	virtual void writeCipherText( const HELibCipherText& ctxt, std::ostream& out, long level ) override;
+
+	virtual HELibCipherText readCipherText( std::istream& in ) override;
+
+	/**
+	 * @brief Decrypts with the secret key and encrypts the values again with the public key, without the
+	 * precomputed zeros
+	 */
+	virtual HELibCipherText refreshCipherText( const HELibCipherText& ctxt ) override;
+
+	/**
+	 * @brief Writes the scheme, the context and the secret key, see readKeys()
+	 */
+	virtual void writeKeys( std::ostream& out ) override;
+
+	/**
+	 * @brief Factory with the context and keys written by writeKeys(), for the key holder process. It leaves the
+	 * ThreadPool alone and sets NTL to a single thread, the key holder refreshes serially.
+	 */
+	static std::unique_ptr<HELibCipherTextFactory> readKeys( std::istream& in );
+
+	/**
+	 * @brief Derives the random streams of the encryptions from seed instead of the entropy of the system, for
+	 * reproducible encryptions. The streams are keyed apart from the key generation, so the same seed for both
+	 * does not repeat the randomness of the keys. Call it before encrypting, not while other threads encrypt.
+	 */
+	void seedRandomStreams( long seed );
+
+	/**
+	 * @brief Only factories built with HELibBootstrappingParameters can bootstrap. HElib has no bootstrapping for
+	 * CKKS.
+	 */
+	virtual bool canBootstrap() override {
+		return mBootstrappable;
 	}
 
+	/**
+	 * @brief Thin recryption with the public recryption keys, the slots hold values of the base ring. Recrypts a
+	 * private copy and returns it, ctxt and its shared copies keep the old ciphertext.
+	 */
+	virtual HELibCipherText bootstrap( const HELibCipherText& ctxt ) override;
 
-	virtual ~HELibCipherTextFactory() {
+	/**
+	 * @brief Hash of the context and the public key, computed once
+	 */
+	virtual uint64_t contextFingerprint() override;
+
+	/**
+	 * @brief Bits a multiplication drops from the modulus on top of the plaintext bits, the headroom HElib keeps
+	 * for the noise
+	 */
+	static const long levelNoiseBits = 20;
+
+	/**
+	 * @brief HElib levels are primes of the modulus chain. The rescaling (CKKS) or modulus switching (BGV) after a
+	 * multiplication drops about the bits of the plaintext, the precision r for CKKS and log2 p^r for BGV, plus
+	 * levelNoiseBits. The primes of the chain are about the same size, so depth multiplications need that many bits
+	 * worth of primes, rounded up and at most all primes of the chain.
+	 */
+	virtual long levelsForDepth( long depth ) override;
+
+	/**
+	 * @brief HElib's estimate of the security level of the context
+	 */
+	double securityLevel() const {
+		return context->securityLevel();
+	}
+
+	/**
+	 * @brief With lazy relinearization ciphertext products (square activations) skip the key switching. The layer
+	 * kernels add up degree 2 ciphertexts, which HElib handles part by part, and relinearize once per output
+	 * neuron or pixel in finishSum(). Pays off when the following layer has fewer outputs than inputs, like a
+	 * Dense layer after a convolution. Ciphertexts get relinearized before they are multiplied with each other
+	 * again, so lazy and eager products can be mixed. Off by default.
+	 */
+	void lazyRelinearization( bool lazy ) {
+		mLazyRelinearization = lazy;
 	}
 
+	bool lazyRelinearization() const {
+		return mLazyRelinearization;
+	}
+
+	/**
+	 * @brief Dot products with a single temporary Ctxt for all terms. Every term is copied into it, multiplied
+	 * by its weight with the same encoding as the operators of HELibCipherText and added to the accumulator;
+	 * zero weights are skipped.
+	 */
+	virtual void dot( HELibCipherText& acc, const HELibCipherText* const * in, const long* weights, size_t n ) override;
+
+	virtual void dot( HELibCipherText& acc, const HELibCipherText* const * in, const float* weights, size_t n ) override;
+
+	virtual void dot( HELibCipherText& acc, const HELibCipherText* const * in, const double* weights, size_t n ) override;
+
+	virtual void dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const long* weights, size_t weightStride ) override;
+
+	virtual void dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const float* weights, size_t weightStride ) override;
+
+	virtual void dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const double* weights, size_t weightStride ) override;
+
+	void dot( HELibCipherText& acc, const HELibCipherText* const * in, const HELibConstant* weights, size_t n );
+
+	void dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const HELibConstant* weights, size_t weightStride );
+
+	/**
+	 * @brief Scatters one input into several sums with a single temporary Ctxt, like dot()
+	 */
+	virtual void scatter( HELibCipherText* const * acc, const HELibCipherText& in, const long* weights, size_t n ) override;
+
+	virtual void scatter( HELibCipherText* const * acc, const HELibCipherText& in, const float* weights, size_t n ) override;
+
+	virtual void scatter( HELibCipherText* const * acc, const HELibCipherText& in, const double* weights, size_t n ) override;
+
+	void scatter( HELibCipherText* const * acc, const HELibCipherText& in, const HELibConstant* weights, size_t n );
+
+	/**
+	 * @brief Encodes a constant for the ciphertexts of this factory, see HELibConstant
+	 */
+	HELibConstant encode( long x );
+
+	HELibConstant encode( double x );
+
+	/**
+	 * @brief Empty Ctxt from the ciphertext pool of the calling thread. Released ciphertexts go back to the
+	 * pool of the thread that releases them, so the kernels, which create a temporary for every multiplication,
+	 * do not allocate a new Ctxt every time. The control block of the shared_ptr comes from a pool as well.
+	 */
+	std::shared_ptr<Ctxt> createRawEmpty();
+
+	/**
+	 * @brief Copy of from in a Ctxt of the pool of the calling thread, see createRawEmpty(). Pooled ciphertexts
+	 * keep their parts, the copy reuses their storage instead of allocating the parts again.
+	 */
+	std::shared_ptr<Ctxt> createRawCopy( const Ctxt& from );
+
+
+	/**
+	 * @brief Keeps up to capacity fresh encryptions of zero ready, encrypted by threads background threads. Encrypting
+	 * a message then only takes one of them and adds the encoded message to it, the sampling and encryption of the
+	 * public key part is done beforehand. Every zero gets used once. The background threads hold back while the
+	 * ThreadPool has tasks queued, so they fill the pool when the server is idle. Falls back to a regular encryption
+	 * if the pool is empty. A capacity of 0 stops the pool, which is the default.
+	 *
+	 * Call it before encrypting, not while other threads encrypt with the factory.
+	 */
+	void precomputeZeros( size_t capacity, size_t threads = 1 );
+
+	/**
+	 * @brief Number of encryptions of zero that are ready
+	 */
+	size_t precomputedZeros() const;
+
+	virtual ~HELibCipherTextFactory();
+
 	std::shared_ptr<FHESecKey> secretKey; // FIXME for debugging. should be private
 private:
 	std::shared_ptr<EncryptedArray> ea;
 	std::shared_ptr<FHEcontext> context;
 	std::shared_ptr<FHEPubKey> publicKey;
+	bool mLazyRelinearization = false;
+	bool mBootstrappable = false;
+	std::mutex mStreamMutex; // guards the stream key and numbers
+	std::array<unsigned char, NTL_PRG_KEYLEN> mStreamKey = systemStreamKey(); // the random streams of the threads are derived from it
+	uint64_t mNextStream = 0;
+	std::atomic<long> mStreamGeneration { 0 }; // changes with the stream key, the threads derive their streams again then
+	std::once_flag mFingerprinted;
+	uint64_t mFingerprint = 0;
+
+	const long mPoolId = newPoolId(); // key of the ciphertext pools of this factory
+	std::shared_ptr<bool> mAlive = std::make_shared<bool>( true ); // expires with the factory, pools drop its ciphertexts then
+
+	static long newPoolId();
+
+	explicit HELibCipherTextFactory( std::istream& keys );
+
+	/**
+	 * @brief A released Ctxt of this factory from the pool of the calling thread, as it was released. nullptr if
+	 * the pool is empty
+	 */
+	Ctxt* takePooledCtxt();
+
+	/**
+	 * @brief Encrypts num ciphertexts in parallel into tensor, which gets flattened for that. Slot b of ciphertext i
+	 * is valueAt( i, b ).
+	 */
+	template<class ValueAt>
+	void encryptElements( size_t num, ValueAt valueAt, Tensor<HELibCipherText>& tensor );
+
+	struct ZeroPool;
+	std::shared_ptr<ZeroPool> mZeroPool; // shared_ptr since ZeroPool is only complete in the cpp
+
+	/**
+	 * @brief A precomputed encryption of zero, nullptr if there is none ready
+	 */
+	std::shared_ptr<Ctxt> takeZero();
+
+	std::shared_ptr<Ctxt> encryptZero();
+
+	// loop of the background threads of the ZeroPool
+	void refillZeros();
+
+	/**
+	 * @brief The random stream of this factory for the calling thread. Every thread gets its own, keyed by a hash of
+	 * the stream key of the factory and a stream number no other thread of the factory got. Threads encrypting in
+	 * parallel neither share a stream nor repeat each other, and factories do not share streams either.
+	 */
+	NTL::RandomStream& randomStream();
+
+	/**
+	 * @brief Runs encrypt with randomStream() as the current NTL stream, the stream of the thread is restored
+	 * afterwards. All encryptions of the factory go through it.
+	 */
+	template<class Encrypt>
+	void withRandomStream( Encrypt encrypt );
+
+	static std::array<unsigned char, NTL_PRG_KEYLEN> systemStreamKey();
+
+	template<class InputAt, class WeightAt>
+	void accumulate( HELibCipherText& acc, size_t n, InputAt inputAt, WeightAt weightAt );
+
+	template<class WeightType>
+	void scatterTerms( HELibCipherText* const * acc, const HELibCipherText& in, const WeightType* weights, size_t n );
+
+	void multiplyTerm( Ctxt& term, long w );
+
+	void multiplyTerm( Ctxt& term, double w );
+
+	void multiplyTerm( Ctxt& term, const HELibConstant& w );
+
+	/**
+	 * @brief Lets the layers hand part of the ThreadPool budget to the NTL thread pool, which HElib uses to
+	 * parallelize inside a single ciphertext operation.
+	 */
+	static void shareThreadBudget();
 };
 
 
 
 
 
+/**
+ * @brief Dot products of HElib ciphertexts are computed by the factory of the accumulator, see DotProduct.h
+ */
+template<class WeightType>
+void dot( HELibCipherText& acc, const HELibCipherText* const * in, const WeightType* weights, size_t n ) {
+	acc.mFactory->dot( acc, in, weights, n );
+}
+
+template<class WeightType>
+void dot( HELibCipherText& acc, const HELibCipherText* in, size_t rowLength, size_t rows, size_t inStride, const WeightType* weights, size_t weightStride ) {
+	acc.mFactory->dot( acc, in, rowLength, rows, inStride, weights, weightStride );
+}
+
+template<class WeightType>
+void scatter( HELibCipherText* const * acc, const HELibCipherText& in, const WeightType* weights, size_t n ) {
+	in.mFactory->scatter( acc, in, weights, n );
+}
+
+/**
+ * @brief Relinearizes the sum if its terms were lazy products, see HELibCipherTextFactory::lazyRelinearization().
+ *
+ * There is no CKKS rescale to defer here: multiplications with constants only change the rational factor of the
+ * ciphertext, and HElib drops primes (rescales) right before the next ciphertext product. A sum of such terms is
+ * rescaled once by the product that consumes it.
+ */
+inline void finishSum( HELibCipherText& acc ) {
+	acc.relinearize();
+}
+
+/**
+ * @brief Layers multiply HElib ciphertexts with weights encoded by the factory of their inputs
+ */
+template<class WeightType>
+struct WeightEncoding<HELibCipherText, WeightType> {
+	typedef HELibConstant Encoded;
+
+	static HELibConstant encode( const HELibCipherText& like, const WeightType& w, bool integral ) {
+		if ( integral || std::is_integral<WeightType>::value )
+			return like.mFactory->encode( static_cast<long>( w ) );
+		return like.mFactory->encode( static_cast<double>( w ) );
+	}
+};
+
+
+
 // TODO move this somewhere nice
 /*
  *
@@ -333,6 +702,10 @@ public:
 		return std::make_shared<PolynomialActivation<HELibCipherText>>(a,b,c,tensor);
 	}
 
+	uint depth() override {
+		return 2;
+	}
+
 
 
 };
@@ -401,6 +774,10 @@ public:
 		return std::make_shared<PolynomialActivationDegree3<HELibCipherText>>(a,b,c,d,tensor);
 	}
 
+	uint depth() override {
+		return 3;
+	}
+
 };
 
 
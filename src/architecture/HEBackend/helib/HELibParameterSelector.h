@@ -0,0 +1,215 @@
+/*
+ * HELibParameterSelector.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef ARCHITECTURE_HEBACKEND_HELIB_HELIBPARAMETERSELECTOR_H_
+#define ARCHITECTURE_HEBACKEND_HELIB_HELIBPARAMETERSELECTOR_H_
+
+#include <cmath>
+#include <memory>
+#include <ostream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include "HELIbCipherText.h"
+
+
+/**
+ * @brief CKKS parameters for HELibCipherTextFactory( L, m, r, c ) together with what they were chosen for and
+ * the expected cost of the operations.
+ */
+struct HELibParameters {
+	long m = 0;				// cyclotomic index, a power of 2
+	long L = 0;				// bits of the modulus chain
+	long r = 0;				// bits of precision, the precisionBits of the selector
+	long c = 2;				// columns of the key switching matrices
+	long depth = 0;			// multiplicative depth the model needs, including the margin for the decryption
+	long valueBits = 0;		// bits of the largest value in the model
+	double security = 0;	// estimated security level
+
+	long phi() const {
+		return m / 2;
+	}
+
+	long slots() const {
+		return m / 4;
+	}
+
+	/**
+	 * @brief Number of small primes of the ciphertext modulus, HElib uses primes of up to NTL_SP_NBITS bits
+	 */
+	long primes() const {
+		return ( L + NTL_SP_NBITS - 1 ) / NTL_SP_NBITS;
+	}
+
+	/**
+	 * @brief Expected cost of an addition (or a multiplication with a constant) in word operations: one per
+	 * coefficient and prime
+	 */
+	double addCost() const {
+		return (double) phi() * primes();
+	}
+
+	/**
+	 * @brief Expected cost of a ciphertext product with relinearization in word operations. The key switching
+	 * converts c digits to and from the evaluation representation, an NTT per digit and prime.
+	 */
+	double multiplyCost() const {
+		return ( c + 2 ) * addCost() * std::log2( (double) phi() );
+	}
+};
+
+inline std::ostream& operator<<( std::ostream& output, const HELibParameters& p ) {
+	output << "m=" << p.m << " L=" << p.L << " r=" << p.r << " c=" << p.c << " (depth " << p.depth << ", " << p.valueBits
+			<< " value bits, " << p.slots() << " slots, " << p.primes() << " primes, security ~" << p.security << ")" << std::endl;
+	output << "expected cost per op [word ops]: add/constant " << p.addCost() << ", multiply+relinearize " << p.multiplyCost();
+	return output;
+}
+
+
+/**
+ * @brief Picks the smallest CKKS chain and ring that can run a model with a given precision, instead of the fixed
+ * m = 4096, L = 128 of the default factory.
+ *
+ * The precision r is an input, the bits of the fraction the values keep (precisionBits), it is not searched. The
+ * modulus chain L has to hold the multiplications the model does (Model::planDepths(), so it needs the
+ * multiplicative depth of every layer) and the largest value that shows up. The largest value is taken from a
+ * calibration run on plain values (calibrate()) if there is one. Otherwise it gets estimated from the input range
+ * and the fan-in of the layers, see analyze(). Every multiplication costs the precision plus noiseBits bits. m is the
+ * smallest power of 2 that gives at least minSlots() slots and reaches the security level for that chain, with
+ * HElib's estimate of the security.
+ *
+ *     HELibParameterSelector selector( 128, 16 );
+ *     selector.analyze( model ).calibrate( plainModel ).minSlots( batchSize );
+ *     auto factory = selector.build();
+ */
+class HELibParameterSelector {
+public:
+
+	/**
+	 * @brief Bits a multiplication costs on top of the precision, the headroom HElib keeps for the noise
+	 */
+	static const long noiseBits = HELibCipherTextFactory::levelNoiseBits;
+
+	HELibParameterSelector( double securityLevel = 128, long precisionBits = 20, long c = 2 ) :
+			mSecurity( securityLevel ), mPrecision( precisionBits ), mC( c ) {
+	}
+
+	/**
+	 * @brief Reads the multiplicative depth the model needs (see Model::planDepths()) and the fan-in of its layers.
+	 * Without calibrate() the value bits are estimated as the input bits plus log2 of the fan-in of every layer, as
+	 * if every layer added up fan-in values of the largest magnitude with weights of at most 1. That is a loose upper
+	 * bound which grows with the number of layers and inflates L for deep models, calibrate() gives the actual range.
+	 */
+	template<class ModelType>
+	HELibParameterSelector& analyze( ModelType& model ) {
+		auto depths = model.planDepths();
+		if ( depths.empty() )
+			throw std::logic_error( "can not select parameters for a model without layers" );
+		mDepth = depths.front();
+		mFanInBits = 0;
+		for ( auto layer : model.layers() ) {
+			Shape out = layer->output()->shape;
+			unsigned long outputs = out.capacity() / out[ 0 ];
+			unsigned long fanIn = outputs ? layer->multiplications() / outputs : 0;
+			if ( fanIn > 1 )
+				mFanInBits += (long) std::ceil( std::log2( (double) fanIn ) );
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Runs the model on plain values with the input it holds and records the largest magnitude of its input
+	 * and of the outputs of all layers. Use a copy of the model with plain tensors and a representative input.
+	 */
+	template<class ModelType>
+	HELibParameterSelector& calibrate( ModelType& model ) {
+		model.run();
+		double largest = maxMagnitude( model.input() );
+		for ( auto layer : model.layers() )
+			largest = std::max( largest, maxMagnitude( layer->output() ) );
+		mCalibratedBits = bitsFor( largest );
+		return *this;
+	}
+
+	/**
+	 * @brief Bits of the largest input value, used to estimate the value range if there was no calibration run
+	 */
+	HELibParameterSelector& inputBits( long bits ) {
+		mInputBits = bits;
+		return *this;
+	}
+
+	/**
+	 * @brief Smallest number of slots the ciphertexts need, the batch size
+	 */
+	HELibParameterSelector& minSlots( long slots ) {
+		mMinSlots = slots;
+		return *this;
+	}
+
+	HELibParameters select() const {
+		if ( mDepth == 0 )
+			throw std::logic_error( "analyze a model before selecting parameters" );
+		HELibParameters p;
+		p.r = mPrecision;
+		p.c = mC;
+		p.depth = mDepth;
+		p.valueBits = mCalibratedBits >= 0 ? mCalibratedBits : mInputBits + mFanInBits;
+		p.L = p.depth * ( mPrecision + noiseBits ) + p.valueBits;
+		// the special primes for the key switching add about L / c bits
+		double modulusBits = p.L + (double) p.L / mC;
+		for ( p.m = 8; p.m / 4 < mMinSlots || estimateSecurity( p.m / 2, modulusBits ) < mSecurity; p.m *= 2 )
+			if ( p.m > ( 1l << 20 ) )
+				throw std::logic_error( "no ring is large enough for a modulus chain of " + std::to_string( p.L ) + " bits" );
+		p.security = estimateSecurity( p.phi(), modulusBits );
+		return p;
+	}
+
+	/**
+	 * @brief Creates a factory with the selected parameters and prints them together with the expected cost per operation
+	 */
+	std::shared_ptr<HELibCipherTextFactory> build() const {
+		HELibParameters p = select();
+		std::cout << "selected HElib parameters " << p << std::endl;
+		auto factory = std::make_shared<HELibCipherTextFactory>( p.L, p.m, p.r, p.c );
+		std::cout << "security level of the context: " << factory->securityLevel() << std::endl;
+		return factory;
+	}
+
+	/**
+	 * @brief HElib's estimate of the security of a ring with phi(m) = phi and a modulus of modulusBits bits
+	 */
+	static double estimateSecurity( long phi, double modulusBits ) {
+		return 7.2 * phi / modulusBits - 110;
+	}
+
+private:
+	double mSecurity;
+	long mPrecision;
+	long mC;
+	long mDepth = 0;
+	long mFanInBits = 0;
+	long mInputBits = 8;
+	long mCalibratedBits = -1;
+	long mMinSlots = 1;
+
+	template<class TensorType>
+	static double maxMagnitude( const TensorType& tensor ) {
+		double largest = 0;
+		for ( long i = 0; i < (long) tensor->shape.capacity(); ++i )
+			largest = std::max( largest, std::abs( (double) ( *tensor )[ i ] ) );
+		return largest;
+	}
+
+	// bits of the integer part plus a sign bit
+	static long bitsFor( double magnitude ) {
+		return magnitude < 1 ? 1 : (long) std::ceil( std::log2( magnitude + 1 ) ) + 1;
+	}
+};
+
+
+#endif /* ARCHITECTURE_HEBACKEND_HELIB_HELIBPARAMETERSELECTOR_H_ */
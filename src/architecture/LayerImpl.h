@@ -22,7 +22,11 @@
 #include "Tensor.h"
 #include "TensorFactory.h"
 #include "LoadModelData.h"
+#include "SparseWeights.h"
+#include "ClusteredWeights.h"
+#include "DotProduct.h"
 #include "../tools/Config.h"
+#include "../tools/ThreadPool.h"
 
 
 #include "HEBackend/helib/HELIbCipherText.h"
@@ -35,9 +39,7 @@
 
 namespace {
 	const bool DEBUG = std::getenv( "DEBUG_LAYER" ) || Config::getConfig()->get<bool>( "general", "debug_layer");
-	const unsigned int POOL_SIZE = std::thread::hardware_concurrency() * 2;
 }
-//const uint POOL_SIZE = 1; // for debugging
 
 
 template< class Preconvert, class Postconvert>
@@ -45,10 +47,28 @@ class WeightConverter {
 public:
 	virtual TensorP<Postconvert> convert( TensorP<Preconvert> ) = 0;
 
-	virtual ~WeightConverter();
+	virtual ~WeightConverter() {
+	}
 };
 
+template<class ValueType, class WeightType, class DataTensorType, class WeightTensorType>
+class AveragePooling;
+
+template<class ValueType, class WeightType, class DataTensorType, class WeightTensorType, class ConvertedWeights>
+class ActivationLayer;
+
 
+/**
+ * How a layer splits the thread budget of the ThreadPool between its independent units (filters, neurons,
+ * channels) and the threads the HE backend uses inside a single ciphertext operation.
+ *
+ * AUTO_PARALLELISM runs the units on the pool and hands the threads the units can not use to the backend,
+ * OUTER_PARALLELISM only parallelizes over the units and INNER_PARALLELISM runs the units one after the
+ * other with the whole budget inside every operation.
+ */
+enum PARALLELISM_POLICY {
+	AUTO_PARALLELISM, OUTER_PARALLELISM, INNER_PARALLELISM
+};
 
 template<class ValueType, class WeightType, class DataTensorType=TensorP<ValueType>, class WeightTensorType=TensorP<WeightType>, class ConvertedWeights=float>
 class Layer {
@@ -121,6 +141,120 @@ public:
 	virtual void setup(){
 	}
 
+	/**
+	 * @brief Gets called by the model with the layer that is about to be added after this one.
+	 * If the layer can compute next as part of its own kernel it returns true. The model then
+	 * drops next and its output tensor is never created. A layer that fuses has to report the
+	 * fused output shape in outputShape().
+	 *
+	 * Does not fuse anything by default.
+	 */
+	virtual bool fuse( std::shared_ptr<Layer<ValueType, WeightType, DataTensorType, WeightTensorType>> next ) {
+		return false;
+	}
+
+	/**
+	 * @brief Returns a plaintext copy of the layer that works on weight types and shares the
+	 * weights of this layer. The copy always uses a linear activation. Layers that do not compute an
+	 * affine map (apart from their activation) return nullptr, which is also the default.
+	 *
+	 * The model uses these copies to compute the combined weights when folding linear layers.
+	 */
+	virtual std::shared_ptr<Layer<WeightType, WeightType>> linearTwin() {
+		return nullptr;
+	}
+
+	/**
+	 * @brief Number of multiplications with a weight (or another constant) for a single instance.
+	 * 0 by default.
+	 */
+	virtual unsigned long multiplications() {
+		return 0;
+	}
+
+	/**
+	 * @brief Multiplicative depth the layer consumes: one level if it multiplies with weights or other constants
+	 * (see multiplications()), one more if it undoes the scale of integerized weights and the depth of its activation.
+	 * Model::planLevels() adds these up. Layers that chain more multiplications override it.
+	 */
+	virtual uint multiplicativeDepth() {
+		uint depth = mActivation ? mActivation->depth() : 0;
+		if ( multiplications() > 0 )
+			++depth;
+		if ( mRescale != 0 )
+			++depth;
+		return depth;
+	}
+
+	/**
+	 * @brief Builds a compressed copy of the weights that only keeps the non-zero entries. Layers that
+	 * support it iterate the non-zeros in their kernels from then on. Has to be called again if the
+	 * weights are changed in place. Does nothing by default.
+	 */
+	virtual void sparsify() {
+	}
+
+	/**
+	 * @brief Groups the weights of every output unit by value (see ClusteredWeights). Layers that support
+	 * it add up the inputs of a group and multiply once per distinct weight in their kernels from then on.
+	 * If codebookSize is not 0 the weights get quantized in place to at most that many values first,
+	 * otherwise the weights are assumed to be quantized already. Does nothing by default.
+	 */
+	virtual void cluster( size_t codebookSize = 0 ) {
+	}
+
+	/**
+	 * @brief Scales the weights so that the largest one in magnitude becomes 2^bits - 1 and rounds them. Kernels then
+	 * multiply with long integers, which is much cheaper for CKKS ciphertexts than a multiplication with a rational,
+	 * and undo the scale with a single multiplication per output before the bias is added. A model passes the scale on
+	 * instead where it can, see scale(). The error of every weight is at most max|w| / ( 2^( bits + 1 ) - 2 ). Returns
+	 * false if the layer does not support integer weights, which is the default.
+	 */
+	virtual bool integerizeWeights( uint bits ) {
+		return false;
+	}
+
+	/**
+	 * @brief Degree k of the layer in its input: scaling the input by s scales the output by s^k, as long as the bias
+	 * gets scaled along (see scale()). 0 if a scaled input changes the result in another way, which is the default.
+	 */
+	virtual uint scaleDegree() {
+		return 0;
+	}
+
+	/**
+	 * @brief Whether the layer can remove the scale of its input and of its weights with one multiplication per
+	 * output before it adds the bias, see scale(). False by default.
+	 */
+	virtual bool removesScale() {
+		return false;
+	}
+
+	/**
+	 * @brief Tells the layer that its input is scaled by inputScale and returns the factor its output is scaled with.
+	 * If undo is set the layer removes the scale of its input and of its integerized weights (see removesScale()),
+	 * otherwise it scales its bias along and keeps them, which saves the multiplication and its level. Model::foldScales()
+	 * decides where a scale gets removed. By default the scale passes through with scaleDegree().
+	 */
+	virtual double scale( double inputScale, bool undo ) {
+		return std::pow( inputScale, scaleDegree() );
+	}
+
+	/**
+	 * @brief The factor the weights have been scaled with by integerizeWeights(), 0 if they have not been integerized
+	 */
+	double weightScale() const {
+		return mWeightScale;
+	}
+
+	PARALLELISM_POLICY parallelism() const {
+		return mParallelism;
+	}
+
+	void parallelism( PARALLELISM_POLICY policy ) {
+		mParallelism = policy;
+	}
+
 
 	virtual void description() {
 	}
@@ -139,6 +273,10 @@ public:
 		return this->mOutput;
 	}
 
+	ActivationP<ValueType> activation() {
+		return mActivation;
+	}
+
 
 	//setters
 	void input( TensorP<ValueType> input ) {
@@ -155,10 +293,17 @@ public:
 
 	void weights( TensorP<WeightType> weights ) {
 		this->mWeights = weights;
+		this->mSparseWeights = nullptr;
+		this->mClusteredWeights = nullptr;
+		this->mWeightScale = 0;
+		this->mRescale = 0;
+		this->mEncodedWeights.clear();
 	}
 
 	void biases( TensorP<WeightType> biases ) {
 		this->mBiases = biases;
+		this->mBiasScale = 1;
+		this->mEncodedBiases.clear();
 	}
 
 	TensorP<WeightType> weights(  ) {
@@ -169,6 +314,14 @@ public:
 		return this->mBiases;
 	}
 
+	SparseWeightsP<WeightType> sparseWeights() {
+		return this->mSparseWeights;
+	}
+
+	ClusteredWeightsP<WeightType> clusteredWeights() {
+		return this->mClusteredWeights;
+	}
+
 	/**
 	 * @brief Returns all the weights and bias tensors of the layer. Order is up to the individual layer.
 	 */
@@ -181,12 +334,33 @@ public:
 		mConvertedWeights = convertedWeights;
 	}
 
+	/**
+	 * @brief Encodes the weights and biases once into the form the backend multiplies with (see WeightEncoding in
+	 * DotProduct.h), for HElib that saves the rational approximation of every weight in every multiplication. The
+	 * kernels use the encodings from then on unless converted weights are set. Has to be called again if the weights
+	 * are changed in place; setting new weights, integerizing or quantizing them drops the encodings. Needs the input
+	 * tensor, its values tell which backend to encode for. Returns false for layers without weights.
+	 */
+	virtual bool encodeWeights() {
+		if ( !mWeights || !mBiases || !mInput )
+			return false;
+		ValueType like = mInput->empty();
+		mEncodedWeights = encode( mWeights, like );
+		mEncodedBiases = encode( mBiases, like );
+		return true;
+	}
+
+	bool weightsEncoded() const {
+		return !mEncodedWeights.empty();
+	}
+
 	virtual ~Layer() {
 	}
 
 	void clear(){
 		mInput->clear();
 		mConvertedWeights.clear();
+		dropEncodings();
 	}
 
 
@@ -204,6 +378,247 @@ protected:
 
 	std::vector<TensorP<ConvertedWeights>> mConvertedWeights;
 
+	typedef typename WeightEncoding<ValueType, WeightType>::Encoded EncodedWeight;
+	std::vector<EncodedWeight> mEncodedWeights, mEncodedBiases; // same order as mWeights and mBiases, empty if not encoded
+
+	SparseWeightsP<WeightType> mSparseWeights; // non-zeros of mWeights, nullptr if the layer is not sparsified
+	ClusteredWeightsP<WeightType> mClusteredWeights; // mWeights grouped by value, nullptr if the layer is not clustered
+	double mWeightScale = 0; // mWeights hold integers, the real weights scaled by this factor. 0 if not integerized
+	double mRescale = 0; // factor rescale() multiplies the weighted sums with, 0 if they are not rescaled
+	double mBiasScale = 1; // mBiases hold the loaded biases scaled by this factor, see scale()
+	PARALLELISM_POLICY mParallelism = AUTO_PARALLELISM;
+
+	/**
+	 * @brief Calls body for every unit in [ 0, units ) on the shared thread pool, splitting the thread budget
+	 * according to the parallelism policy of the layer. With AUTO_PARALLELISM a layer with fewer units than
+	 * threads, like the final Dense of a classifier, gives every unit threads / units inner threads.
+	 */
+	void parallelFor( long units, const std::function<void( long )>& body ) {
+		ThreadPool& pool = ThreadPool::getPool();
+		size_t inner = 1;
+		if ( mParallelism == INNER_PARALLELISM )
+			inner = pool.threads();
+		else if ( mParallelism == AUTO_PARALLELISM && units > 0 && (size_t) units < pool.threads() )
+			inner = pool.threads() / units;
+		if ( inner > 1 && inner >= pool.threads() ) { // the operations get the whole budget, run the units in order
+			InnerThreadsScope scope( pool, inner );
+			for ( long i = 0; i < units; ++i )
+				body( i );
+			return;
+		}
+		pool.parallelFor( 0, units, body, 1, inner );
+	}
+
+	/**
+	 * @brief Multiplies value with the weight w. Uses the integer overload if the weights are integerized
+	 */
+	void multiplyWeight( ValueType& value, const WeightType& w ) {
+		if ( mWeightScale != 0 )
+			value *= static_cast<long>( w );
+		else
+			value *= w;
+	}
+
+	/**
+	 * @brief Multiplies value with the weight at the flat index idx of mWeights, using its encoding if there is one
+	 */
+	void multiplyWeightAt( ValueType& value, size_t idx ) {
+		if ( !mEncodedWeights.empty() )
+			value *= mEncodedWeights[ idx ];
+		else
+			multiplyWeight( value, ( *mWeights )[ (long) idx ] );
+	}
+
+	/**
+	 * @brief value += the bias at idx, using its encoding if there is one
+	 */
+	void addBias( ValueType& value, size_t idx ) {
+		if ( !mEncodedBiases.empty() )
+			value += mEncodedBiases[ idx ];
+		else
+			value += ( *mBiases )[ { idx } ];
+	}
+
+	/**
+	 * @brief acc += the dot product of a window of inputs and the weights starting at the flat index weightIdx of
+	 * mWeights, see the strided dot() in DotProduct.h. Uses the encoded weights if there are any; like multiplyWeight
+	 * it uses long weights if the weights are integerized.
+	 */
+	void weightedSum( ValueType& acc, const ValueType* in, size_t rowLength, size_t rows, size_t inStride, size_t weightIdx, size_t weightStride ) {
+		if ( !mEncodedWeights.empty() ) {
+			dot( acc, in, rowLength, rows, inStride, &mEncodedWeights[ weightIdx ], weightStride );
+			return;
+		}
+		const WeightType* weights = &( *mWeights )[ (long) weightIdx ];
+		if ( mWeightScale == 0 ) {
+			dot( acc, in, rowLength, rows, inStride, weights, weightStride );
+			return;
+		}
+		std::vector<long> integers( rows * rowLength );
+		for ( size_t r = 0; r < rows; ++r )
+			for ( size_t k = 0; k < rowLength; ++k )
+				integers[ r * rowLength + k ] = static_cast<long>( weights[ r * weightStride + k ] );
+		dot( acc, in, rowLength, rows, inStride, integers.data(), rowLength );
+	}
+
+	/**
+	 * @brief acc += sum( *in[ k ] * the weight at the flat index weightIdx[ k ] ), for inputs that are not laid out
+	 * regularly like the non-zeros of sparse weights
+	 */
+	void weightedSum( ValueType& acc, const ValueType* const * in, const size_t* weightIdx, size_t n ) {
+		if ( !mEncodedWeights.empty() ) {
+			std::vector<EncodedWeight> weights( n );
+			for ( size_t k = 0; k < n; ++k )
+				weights[ k ] = mEncodedWeights[ weightIdx[ k ] ];
+			dot( acc, in, weights.data(), n );
+			return;
+		}
+		if ( mWeightScale == 0 ) {
+			std::vector<WeightType> weights( n );
+			for ( size_t k = 0; k < n; ++k )
+				weights[ k ] = ( *mWeights )[ (long) weightIdx[ k ] ];
+			dot( acc, in, weights.data(), n );
+			return;
+		}
+		std::vector<long> integers( n );
+		for ( size_t k = 0; k < n; ++k )
+			integers[ k ] = static_cast<long>( ( *mWeights )[ (long) weightIdx[ k ] ] );
+		dot( acc, in, integers.data(), n );
+	}
+
+	/**
+	 * @brief acc += sum( *in[ k ] * the weight at the flat index weightIdx + k ), for consecutive weights whose inputs
+	 * are gathered from several places, like all channels of a convolution window
+	 */
+	void weightedSum( ValueType& acc, const ValueType* const * in, size_t weightIdx, size_t n ) {
+		if ( !mEncodedWeights.empty() ) {
+			dot( acc, in, &mEncodedWeights[ weightIdx ], n );
+			return;
+		}
+		const WeightType* weights = &( *mWeights )[ (long) weightIdx ];
+		if ( mWeightScale == 0 ) {
+			dot( acc, in, weights, n );
+			return;
+		}
+		std::vector<long> integers( n );
+		for ( size_t k = 0; k < n; ++k )
+			integers[ k ] = static_cast<long>( weights[ k ] );
+		dot( acc, in, integers.data(), n );
+	}
+
+	/**
+	 * @brief *acc[ k ] += in * the weight at the flat index weightIdx[ k ], see scatter() in DotProduct.h. Uses the
+	 * encoded weights if there are any; like multiplyWeight it uses long weights if the weights are integerized.
+	 */
+	void weightedScatter( ValueType* const * acc, const ValueType& in, const size_t* weightIdx, size_t n ) {
+		if ( !mEncodedWeights.empty() ) {
+			std::vector<EncodedWeight> weights( n );
+			for ( size_t k = 0; k < n; ++k )
+				weights[ k ] = mEncodedWeights[ weightIdx[ k ] ];
+			scatter( acc, in, weights.data(), n );
+			return;
+		}
+		if ( mWeightScale == 0 ) {
+			std::vector<WeightType> weights( n );
+			for ( size_t k = 0; k < n; ++k )
+				weights[ k ] = ( *mWeights )[ (long) weightIdx[ k ] ];
+			scatter( acc, in, weights.data(), n );
+			return;
+		}
+		std::vector<long> integers( n );
+		for ( size_t k = 0; k < n; ++k )
+			integers[ k ] = static_cast<long>( ( *mWeights )[ (long) weightIdx[ k ] ] );
+		scatter( acc, in, integers.data(), n );
+	}
+
+	/**
+	 * @brief Encodes every entry of weights for the backend of like. Integerized weights get encoded as integers
+	 */
+	std::vector<EncodedWeight> encode( TensorP<WeightType> weights, const ValueType& like ) {
+		std::vector<EncodedWeight> encoded;
+		encoded.reserve( weights->shape.capacity() );
+		for ( size_t i = 0; i < weights->shape.capacity(); ++i )
+			encoded.push_back( WeightEncoding<ValueType, WeightType>::encode( like, ( *weights )[ (long) i ], mWeightScale != 0 && weights == mWeights ) );
+		return encoded;
+	}
+
+	/**
+	 * @brief Drops the encoded weights once they do not match the weights anymore
+	 */
+	virtual void dropEncodings() {
+		mEncodedWeights.clear();
+		mEncodedBiases.clear();
+	}
+
+	/**
+	 * @brief Undoes the scale of integerized weights (and of the input, see scale()) on a weighted sum. Does nothing if
+	 * there is no scale to undo or it is passed on to the next layers.
+	 */
+	void rescale( ValueType& value ) {
+		if ( mRescale != 0 )
+			value *= static_cast<WeightType>( mRescale );
+	}
+
+	/**
+	 * @brief Implements scale() for layers whose kernels use rescale() on the weighted sum before adding the bias
+	 */
+	double scaleWeightedSum( double inputScale, bool undo ) {
+		double factor = inputScale * ( mWeightScale != 0 ? mWeightScale : 1 );
+		mRescale = undo && factor != 1 ? 1 / factor : 0;
+		double biasScale = undo ? 1 : factor;
+		if ( mBiases && biasScale != mBiasScale ) {
+			TensorP<WeightType> biases = mWTF ? mWTF->create( mBiases->shape ) : mWeigthTensorFactory->create( mBiases->shape );
+			biases->init();
+			for ( size_t i = 0; i < biases->shape.capacity(); ++i )
+				( *biases )[ (long) i ] = ( *mBiases )[ (long) i ] * ( biasScale / mBiasScale );
+			mBiases = biases; // like the weights in integerize(), other layers may share the old tensor
+			mEncodedBiases.clear();
+		}
+		mBiasScale = biasScale;
+		return undo ? 1 : std::pow( factor, scaleDegree() );
+	}
+
+	/**
+	 * @brief Implements integerizeWeights() for layers whose kernels use multiplyWeight() and rescale(). Sparse and
+	 * clustered copies of the weights get rebuilt.
+	 */
+	bool integerize( uint bits ) {
+		if ( !std::is_floating_point<WeightType>::value || mWeightScale != 0 || bits == 0 || bits > 30 )
+			return false;
+		double maxWeight = 0;
+		for ( size_t i = 0; i < mWeights->shape.capacity(); ++i )
+			maxWeight = std::max<double>( maxWeight, std::abs( ( *mWeights )[ (long) i ] ) );
+		if ( maxWeight == 0 )
+			return false;
+		double scale = ( ( 1L << bits ) - 1 ) / maxWeight;
+		TensorP<WeightType> integers = mWTF ? mWTF->create( mWeights->shape ) : mWeigthTensorFactory->create( mWeights->shape );
+		integers->init();
+		for ( size_t i = 0; i < integers->shape.capacity(); ++i )
+			( *integers )[ (long) i ] = std::round( ( *mWeights )[ (long) i ] * scale );
+		bool sparse = mSparseWeights != nullptr, clustered = mClusteredWeights != nullptr;
+		mWeights = integers; // twins and other layers may still share the old tensor
+		mWeightScale = scale;
+		mRescale = 1 / scale;
+		dropEncodings();
+		if ( sparse )
+			sparsify();
+		if ( clustered )
+			cluster();
+		return true;
+	}
+
+	/**
+	 * @brief Takes over the activation function of next if next is an ActivationLayer and this
+	 * layer does not apply an activation itself. Used by layers that implement fuse().
+	 */
+	bool fuseActivation( std::shared_ptr<Layer<ValueType, WeightType, DataTensorType, WeightTensorType>> next ) {
+		auto activationLayer = std::dynamic_pointer_cast<ActivationLayer<ValueType, WeightType, DataTensorType, WeightTensorType, ConvertedWeights>>( next );
+		if ( !activationLayer || !std::dynamic_pointer_cast<LinearActivation<ValueType>>( mActivation ) )
+			return false;
+		mActivation = activationLayer->activation();
+		return true;
+	}
+
 
 private:
 	template<class V, class W, class DT, class WT, class CT>
@@ -233,6 +648,23 @@ enum PADDING_MODE {
 	SAME, VALID
 };
 
+/**
+ * @brief Offset from the position of an output pixel in the input to the top left corner of its filter window,
+ * shared by the convolution layers. For same padding the top padding follows the width when it is a multiple of
+ * the stride and the height otherwise, like the kernels have always done.
+ */
+inline int convolutionWindowOffset( PADDING_MODE pad, const Shape& input, int filterSize, int stride ) {
+	if ( pad == PADDING_MODE::SAME ) {
+		int pady;
+		if ( input[ 3 ] % stride == 0 )
+			pady = std::max<int>( filterSize - stride, 0 );
+		else
+			pady = std::max<int>( filterSize - ( input[ 2 ] % stride ), 0 );
+		return pady / 2;
+	}
+	return filterSize / 2;
+}
+
 template<class ValueType, class WeightType, class DataTensorType=TensorP<ValueType>, class WeightTensorType=TensorP<WeightType>, class ConvertedWeights=float>
 class Convolution2D: public Layer<ValueType, WeightType, DataTensorType, WeightTensorType, ConvertedWeights> {
 public:
@@ -276,6 +708,19 @@ public:
 
 	// computes the output shape for the layer
 	Shape outputShape() override {
+		Shape convShape = convOutputShape();
+		if ( mPoolSize == 0 )
+			return convShape;
+		// fused valid average pooling with stride == pool size
+		uint pooledX = std::ceil( ( convShape[ 2 ] - mPoolSize + 1 ) / ( mPoolSize * 1.0 ) );
+		uint pooledY = std::ceil( ( convShape[ 3 ] - mPoolSize + 1 ) / ( mPoolSize * 1.0 ) );
+		return Shape { convShape[ 0 ], mNoFilters, pooledX, pooledY };
+	}
+
+	/**
+	 * @brief The output shape of the convolution itself, without any fused pooling
+	 */
+	Shape convOutputShape() {
 		uint outputSizeX, outputSizeY;
 		if ( mPad == SAME ) {
 			// x direction
@@ -304,20 +749,18 @@ public:
 	}
 
 	void feedForward() override {
-		std::thread tt [ POOL_SIZE ];
-		uint j = 0;
-		while ( j < mNoFilters ) {
-			int noThreads = 0;
-			for ( unsigned int i = 0; i < POOL_SIZE; i++ ) {
-				tt [ i ] = std::thread( [=] {this->filterOperation( j );} );
-				j++;
-				noThreads = i + 1;
-				if ( j == mNoFilters )
-					break;
-			}
-			for ( int i = 0; i < noThreads; i++ )
-				tt[ i ].join();
+		if ( useInputStationary() ) {
+			// every thread owns a band of output rows for all filters
+			uint rows = this->mOutput->shape[ 2 ];
+			uint noBands = std::min<uint>( ThreadPool::getPool().threads(), rows );
+			this->parallelFor( noBands, [=]( long band ) {
+				this->inputStationaryOperation( band * rows / noBands, ( band + 1 ) * rows / noBands );
+			} );
+			this->mOutput->performChecks();
+			return;
 		}
+		FilterKernel kernel = filterKernel();
+		this->parallelFor( mNoFilters, [=]( long j ) {( this->*kernel )( j );} );
 		this->mOutput->performChecks();
 	}
 
@@ -352,7 +795,10 @@ public:
 	}
 
 	void description() override {
-		std::cout << this->mName << "\t" << this->mOutput->shape << std::endl;
+		std::cout << this->mName;
+		if ( mPoolSize != 0 )
+			std::cout << " (+" << mPoolSize << "x" << mPoolSize << " avg pool)";
+		std::cout << "\t" << this->mOutput->shape << std::endl;
 	}
 
 	/**
@@ -362,17 +808,133 @@ public:
 		return std::vector<TensorP<WeightType>>{ this->mWeights, this->mBiases };
 	}
 
+	/**
+	 * @brief Fuses a following average pooling layer (valid padding, stride equal to the pool size)
+	 * or a following activation layer if this layer is linear. The pooling has to come first:
+	 * once pooled, an activation would have to be applied after the average.
+	 */
+	bool fuse( LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> next ) override {
+		if ( mPoolSize != 0 )
+			return false;
+		auto pool = std::dynamic_pointer_cast<AveragePooling<ValueType, WeightType, DataTensorType, WeightTensorType>>( next );
+		if ( pool ) {
+			if ( pool->padding() != PADDING_MODE::VALID || pool->filterSize() != pool->stride() )
+				return false;
+			mPoolSize = pool->filterSize();
+			return true;
+		}
+		return this->fuseActivation( next );
+	}
+
+	uint poolSize() const {
+		return mPoolSize;
+	}
+
+	/**
+	 * @brief Switches to the input stationary schedule (see inputStationaryOperation) where it applies. Meant for
+	 * ciphertexts, where reloading every input once per filter dominates the memory traffic.
+	 */
+	void inputStationary( bool enable ) {
+		mInputStationary = enable;
+	}
+
+	bool inputStationary() const {
+		return mInputStationary;
+	}
+
+	LayerP<WeightType, WeightType> linearTwin() override {
+		auto twin = std::make_shared<Convolution2D<WeightType, WeightType>>( this->mName, LinearActivation<WeightType>::getSharedPointer(),
+				mNoFilters, mFilterSize, mStride, mPad );
+		if ( mPoolSize != 0 )
+			twin->fuse( std::make_shared<AveragePooling<WeightType, WeightType, TensorP<WeightType>, TensorP<WeightType>>>( this->mName, mPoolSize, mPoolSize, PADDING_MODE::VALID ) );
+		twin->weights( this->mWeights );
+		twin->biases( this->mBiases );
+		return twin;
+	}
+
+	unsigned long multiplications() override {
+		Shape convShape = convOutputShape();
+		unsigned long count = convShape.capacity() / convShape[ 0 ] * this->mInput->shape[ 1 ] * mFilterSize * mFilterSize;
+		if ( this->mClusteredWeights )
+			count = convShape.capacity() / convShape[ 0 ] / mNoFilters * this->mClusteredWeights->groups();
+		else if ( this->mSparseWeights )
+			count = convShape.capacity() / convShape[ 0 ] / mNoFilters * this->mSparseWeights->nonZeros();
+		if ( mPoolSize != 0 )
+			count += this->outputShape().capacity() / convShape[ 0 ];
+		return count;
+	}
+
+	// the fused pooling multiplies the activated pixels by 1 / poolSize^2
+	uint multiplicativeDepth() override {
+		return Layer<ValueType, WeightType, DataTensorType, WeightTensorType, ConvertedWeights>::multiplicativeDepth() + ( mPoolSize != 0 ? 1 : 0 );
+	}
+
+	void sparsify() override {
+		this->mSparseWeights = std::make_shared<SparseWeights<WeightType>>( this->mWeights, mNoFilters );
+	}
+
+	void cluster( size_t codebookSize = 0 ) override {
+		if ( codebookSize != 0 )
+			ClusteredWeights<WeightType>::quantize( this->mWeights, codebookSize, this->mWeightScale != 0 );
+		this->mSparseWeights = nullptr; // the sparse copy would be stale
+		if ( codebookSize != 0 )
+			this->dropEncodings();
+		this->mClusteredWeights = std::make_shared<ClusteredWeights<WeightType>>( this->mWeights, mNoFilters );
+	}
+
+	bool integerizeWeights( uint bits ) override {
+		return this->integerize( bits );
+	}
+
+	uint scaleDegree() override {
+		return this->mActivation->degree();
+	}
+
+	bool removesScale() override {
+		return true;
+	}
+
+	double scale( double inputScale, bool undo ) override {
+		return this->scaleWeightedSum( inputScale, undo );
+	}
+
 
 private:
 	uint mNoFilters, mFilterSize, mStride;
 	PADDING_MODE mPad;
+	uint mPoolSize = 0; // size of a fused average pooling, 0 if none is fused
+	bool mInputStationary = false;
+
+	typedef void ( Convolution2D::*FilterKernel )( uint sequence );
+
+	/**
+	 * @brief Picks the kernel that computes a single filter. Filter sizes 3 and 5 with stride 1 or 2 get a
+	 * kernel specialized at compile time unless the weights are sparse, clustered or pre-converted.
+	 */
+	FilterKernel filterKernel() {
+		if ( mPoolSize != 0 )
+			return &Convolution2D::pooledFilterOperation;
+		if ( this->mSparseWeights || this->mClusteredWeights )
+			return &Convolution2D::pixelFilterOperation;
+		if ( this->mConvertedWeights.empty() ) {
+			if ( mFilterSize == 3 && mStride == 1 )
+				return &Convolution2D::fixedFilterOperation<3, 1>;
+			if ( mFilterSize == 3 && mStride == 2 )
+				return &Convolution2D::fixedFilterOperation<3, 2>;
+			if ( mFilterSize == 5 && mStride == 1 )
+				return &Convolution2D::fixedFilterOperation<5, 1>;
+			if ( mFilterSize == 5 && mStride == 2 )
+				return &Convolution2D::fixedFilterOperation<5, 2>;
+		}
+		return &Convolution2D::filterOperation;
+	}
 
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wnarrowing"
 	void filterOperation( uint sequence ) {
 
-		bool useConvertedWeights = this->mConvertedWeights.size() < 0;
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
 		TensorP<ConvertedWeights> cWeights;
 		TensorP<ConvertedWeights> cBiases;
 		if( useConvertedWeights ){
@@ -400,25 +962,22 @@ private:
 					for ( int y = 0; y < (signed) this->mInput->shape [ 2 ]; y += mStride ) {
 						// iterating over the image columns
 						for ( int x = 0; x < (signed) this->mInput->shape [ 3 ]; x += mStride ) {
+							if ( !useConvertedWeights ) // we ignore any padded image area since n * 0 = 0 so it adds nothing to sum
+								windowSum( ( *this->mOutput ) [ { batchIdx, sequence, outY, outX } ], batchIdx, sequence, depthIdx, y - padTop, x - padLeft );
 							//iter over filter cols
-							for ( unsigned int filtery = 0;	filtery < mFilterSize; filtery++ ) {
+							for ( unsigned int filtery = 0;	filtery < mFilterSize && useConvertedWeights; filtery++ ) {
 								int iy = y + filtery - padTop;
 								//iter over filter rows
 								for ( unsigned int filterx = 0; filterx < mFilterSize; filterx++ ) {
 									int ix = x + filterx - padLeft;
-									//we ignore any padded image area since n * 0 = 0 so it adds nothing to sum
 									if ( ix >= 0
 											&& ix < (signed) this->mInput->shape [ 3 ]
 											&& iy >= 0
 											&& iy < (signed) this->mInput->shape [ 2 ] ) {
 										ValueType value = this->mInput->empty();
 										value += ( *this->mInput ) [ { batchIdx, depthIdx, iy, ix } ];
-										if( useConvertedWeights )
-											value *= ( *cWeights ) [ { sequence, depthIdx, filtery, filterx } ];
-										else
-											value *= ( *this->mWeights ) [ { sequence, depthIdx, filtery, filterx } ];
+										value *= ( *cWeights ) [ { sequence, depthIdx, filtery, filterx } ];
 										( *this->mOutput ) [ { batchIdx, sequence, outY, outX } ] += value;
-										//TODO: do we have to use empty()? Maybe for HE but even then, value should be the same?
 									}
 								}
 							}
@@ -434,10 +993,12 @@ private:
 				//run activation function over the output
 				for ( int y = 0; y < (signed) this->mOutput->shape [ 2 ]; ++y ) {
 					for ( int x = 0; x < (signed) this->mOutput->shape [ 3 ]; ++x ) {
+						finishSum( ( *this->mOutput ) [ { batchIdx, sequence, y, x } ] );
+						this->rescale( ( *this->mOutput ) [ { batchIdx, sequence, y, x } ] );
 						if( useConvertedWeights )
 							( *this->mOutput ) [ { batchIdx, sequence, y, x } ] += ( *cBiases ) [ { sequence } ];
 						else
-							( *this->mOutput ) [ { batchIdx, sequence, y, x } ] += ( *this->mBiases ) [ { sequence } ];
+							this->addBias( ( *this->mOutput ) [ { batchIdx, sequence, y, x } ], sequence );
 						this->mActivation->activate( ( *this->mOutput ) [ { batchIdx, sequence, y, x } ] );
 					}
 				}
@@ -460,44 +1021,24 @@ private:
 					uint outX = 0, outY = 0;
 					for ( int y = 0; y < (signed) this->mInput->shape[ 2 ]; y += mStride ) { // iterating over the image rows
 						for ( int x = 0; x < (signed) this->mInput->shape[ 3 ]; x += mStride ) { // iterating over the image columns
-							bool validFilter = true; // to break out of inner filter loop
+							// only windows that lie completely inside of the image are computed
+							bool validFilter = y + filterFrom >= 0 && y + filterTo < (signed) this->mInput->shape[ 2 ]
+									&& x + filterFrom >= 0 && x + filterTo < (signed) this->mInput->shape[ 3 ];
 							ValueType weightedSum = this->mInput->empty();
-							for ( int filtery = filterFrom; filtery <= filterTo; filtery++ ) { // iterating over the filter rows
+							if ( validFilter && !useConvertedWeights )
+								windowSum( weightedSum, batchIdx, sequence, depthIdx, y + filterFrom, x + filterFrom );
+							for ( int filtery = filterFrom; filtery <= filterTo && validFilter && useConvertedWeights; filtery++ ) { // iterating over the filter rows
 								int iy = y + filtery;
-								// check if we are in a valid filter area
-								// if at least on filter is not abort and move filter
-								if ( iy < 0 || iy >= (signed) this->mInput->shape[ 2 ] || !validFilter ) {
-									validFilter = false;
-									break;
-								}
 								for ( int filterx = filterFrom; filterx <= filterTo; filterx++ ) { // iterating over the filter columns
 									int ix = x + filterx;
-									// check if we are in a valid filter area
-									if ( ix < 0 || ix >= (signed) this->mInput->shape[ 3 ] ) {
-										validFilter = false;
-										break;
-									}
 									ValueType temp = this->mInput->empty();
-									if( DEBUG ){
-										if( outY == 0 && outX == 0 && sequence == 0 )
-											std::cout << "initial noise: " << reinterpret_cast<HELibCipherText*>(&temp)->mCtxt->getNoiseBound() << std::endl;
-									}
 									temp += ( *this->mInput ) [ { batchIdx, depthIdx, iy, ix } ];
-									if( DEBUG ){
-										if( outY == 0 && outX == 0 && sequence == 0 )
-											std::cout << "adding plain weight: " << reinterpret_cast<HELibCipherText*>(&temp)->mCtxt->getNoiseBound() << std::endl;
-									}
-									if( useConvertedWeights )
-										temp *= ( *cWeights ) [ { sequence, depthIdx, ( filtery + mFilterSize / 2 ), ( filterx + mFilterSize / 2 ) } ];
-									else
-										temp *= ( *this->mWeights ) [ { sequence, depthIdx, ( filtery + mFilterSize / 2 ), ( filterx + mFilterSize / 2 ) } ];
-									if( DEBUG ){
-										if( outY == 0 && outX == 0 && sequence == 0 )
-											std::cout << "mult by input : " << reinterpret_cast<HELibCipherText*>(&temp)->mCtxt->getNoiseBound() << std::endl;
-									}
+									temp *= ( *cWeights ) [ { sequence, depthIdx, ( filtery + mFilterSize / 2 ), ( filterx + mFilterSize / 2 ) } ];
 									weightedSum += temp;
 								}
 							}
+							if( DEBUG && validFilter && outY == 0 && outX == 0 && sequence == 0 )
+								std::cout << "weighted sum: " << reinterpret_cast<HELibCipherText*>(&weightedSum)->mCtxt->getNoiseBound() << std::endl;
 							if ( validFilter ) {
 								( *this->mOutput ) [ { batchIdx, sequence, outY, outX } ] += weightedSum;
 								++outIdx;
@@ -512,10 +1053,12 @@ private:
 				//FIXME this will be way cooler with slicing//TODO: this prob needs to be inside depthIdx forloop
 				for ( int y = 0; y < (signed) this->mOutput->shape[ 2 ]; ++y ) {
 					for ( int x = 0; x < (signed) this->mOutput->shape[ 3 ]; ++x ) {
+						finishSum( ( *this->mOutput )[ { batchIdx, sequence, y, x } ] );
+						this->rescale( ( *this->mOutput )[ { batchIdx, sequence, y, x } ] );
 						if( useConvertedWeights )
 							( *this->mOutput )[ { batchIdx, sequence, y, x } ] += ( *cBiases )[ { sequence } ];
 						else
-							( *this->mOutput )[ { batchIdx, sequence, y, x } ] += ( *this->mBiases )[ { sequence } ];
+							this->addBias( ( *this->mOutput )[ { batchIdx, sequence, y, x } ], sequence );
 						this->mActivation->activate( ( *this->mOutput )[ { batchIdx, sequence, y, x } ] );
 						if( DEBUG ){
 							if( sequence == 0 && x == 0 && y ==0 )
@@ -528,6 +1071,492 @@ private:
 	}
 
 
+	/**
+	 * @brief Offset from the position of an output pixel in the input to the top left corner of its filter window
+	 */
+	int windowOffset() {
+		return convolutionWindowOffset( mPad, this->mInput->shape, mFilterSize, mStride );
+	}
+
+	/**
+	 * @brief acc += the filter window of one channel whose top left corner lies at ( top, left ) in the input.
+	 * The rows and columns of the window that lie outside of the image are cut off (same padding).
+	 */
+	void windowSum( ValueType& acc, uint batchIdx, uint sequence, uint depthIdx, int top, int left ) {
+		const int height = this->mInput->shape[ 2 ], width = this->mInput->shape[ 3 ], K = mFilterSize;
+		const int y0 = std::max( 0, -top ), y1 = std::min( K, height - top );
+		const int x0 = std::max( 0, -left ), x1 = std::min( K, width - left );
+		if ( y0 >= y1 || x0 >= x1 )
+			return;
+		this->weightedSum( acc, &( *this->mInput )[ { batchIdx, depthIdx, (size_t) ( top + y0 ), (size_t) ( left + x0 ) } ], x1 - x0, y1 - y0, width,
+				( ( (size_t) sequence * this->mInput->shape[ 1 ] + depthIdx ) * K + y0 ) * K + x0, K );
+	}
+
+	/**
+	 * @brief True if the input stationary schedule is enabled and applies. It does not cover fused pooling,
+	 * sparse, clustered or pre-converted weights. It also needs the output pixels to form a regular grid in the
+	 * same order as the other kernels number them: square outputs (they number by the height only) and, for
+	 * valid padding, a first window that starts on the stride.
+	 */
+	bool useInputStationary() {
+		return mInputStationary && mPoolSize == 0 && !this->mSparseWeights && !this->mClusteredWeights
+				&& this->mConvertedWeights.empty() && this->mOutput->shape[ 2 ] == this->mOutput->shape[ 3 ]
+				&& ( mPad == PADDING_MODE::SAME || windowOffset() % mStride == 0 );
+	}
+
+	/**
+	 * @brief Input stationary convolution for the output rows [ rowFrom, rowTo ) of all filters.
+	 *
+	 * The filter-outer kernels read every input ciphertext once per filter. Here every input that one of the
+	 * rows needs is read once and right away multiplied into all filters and filter positions that use it, in a
+	 * single weightedScatter() into the band of the output the calling thread owns, so the backend reuses one
+	 * temporary for all of these products. Inputs in the rows between two bands are read by both threads. Bias,
+	 * rescale and activation get applied once the band is complete.
+	 */
+	void inputStationaryOperation( uint rowFrom, uint rowTo ) {
+		if ( rowFrom >= rowTo )
+			return;
+		const int height = this->mInput->shape[ 2 ], width = this->mInput->shape[ 3 ];
+		const int K = mFilterSize, S = mStride;
+		const int offset = windowOffset();
+		const int outWidth = this->mOutput->shape[ 3 ];
+		// position of the first window in the input, valid padding skips the windows hanging over the border
+		const int first = mPad == PADDING_MODE::SAME ? 0 : ( offset + S - 1 ) / S * S;
+		// input rows the band needs
+		const int inFrom = std::max( 0, first + (int) rowFrom * S - offset );
+		const int inTo = std::min( height, first + (int) ( rowTo - 1 ) * S - offset + K );
+		std::vector<ValueType*> targets; // the sums and weights one input goes to, reused for every input
+		std::vector<size_t> weightIdx;
+
+		for ( unsigned int batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; batchIdx++ ) {
+			for ( unsigned int depthIdx = 0; depthIdx < this->mInput->shape[ 1 ]; ++depthIdx ) {
+				for ( int iy = inFrom; iy < inTo; ++iy ) {
+					for ( int ix = 0; ix < width; ++ix ) {
+						ValueType& in = ( *this->mInput )[ { batchIdx, depthIdx, (size_t) iy, (size_t) ix } ];
+						targets.clear();
+						weightIdx.clear();
+						for ( int filtery = 0; filtery < K; ++filtery ) {
+							// output row whose window has this input at filtery
+							int y = iy - filtery + offset - first;
+							if ( y < 0 || y % S != 0 || y / S < (int) rowFrom || y / S >= (int) rowTo )
+								continue;
+							uint outY = y / S;
+							for ( int filterx = 0; filterx < K; ++filterx ) {
+								int x = ix - filterx + offset - first;
+								if ( x < 0 || x % S != 0 || x / S >= outWidth )
+									continue;
+								uint outX = x / S;
+								for ( uint sequence = 0; sequence < mNoFilters; ++sequence ) {
+									targets.push_back( &( *this->mOutput )[ { batchIdx, sequence, outY, outX } ] );
+									weightIdx.push_back( ( ( (size_t) sequence * this->mInput->shape[ 1 ] + depthIdx ) * K + filtery ) * K + filterx );
+								}
+							}
+						}
+						this->weightedScatter( targets.data(), in, weightIdx.data(), targets.size() );
+					}
+				}
+			}
+			for ( uint sequence = 0; sequence < mNoFilters; ++sequence ) {
+				for ( uint y = rowFrom; y < rowTo; ++y ) {
+					for ( uint x = 0; x < (uint) outWidth; ++x ) {
+						finishSum( ( *this->mOutput )[ { batchIdx, sequence, y, x } ] );
+						this->rescale( ( *this->mOutput )[ { batchIdx, sequence, y, x } ] );
+						this->addBias( ( *this->mOutput )[ { batchIdx, sequence, y, x } ], sequence );
+						this->mActivation->activate( ( *this->mOutput )[ { batchIdx, sequence, y, x } ] );
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * @brief filterOperation for a filter size K and stride S known at compile time. The taps of all channels of an
+	 * interior window go to a single dot product, so ciphertexts accumulate the whole pixel with one temporary like
+	 * the dense kernel does. Whether a window lies completely inside the image is decided once per pixel, only the
+	 * border pixels of same padding get clipped.
+	 * Produces the same pixels in the same order as filterOperation.
+	 */
+	template<uint K, uint S>
+	void fixedFilterOperation( uint sequence ) {
+		const int channels = this->mInput->shape[ 1 ], height = this->mInput->shape[ 2 ], width = this->mInput->shape[ 3 ];
+		const int offset = windowOffset();
+		const size_t filterStart = (size_t) sequence * channels * K * K;
+		std::vector<const ValueType*> window( (size_t) channels * K * K ); // the inputs of an interior window
+
+		for ( unsigned int batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; batchIdx++ ) {
+			const long batchOffset = (long) batchIdx * channels * height * width;
+			int outIdx = 0;
+			for ( int y = 0; y < height; y += S ) {
+				const int top = y - offset;
+				const bool rowInside = top >= 0 && top + (int) K <= height;
+				if ( mPad == PADDING_MODE::VALID && !rowInside )
+					continue;
+				for ( int x = 0; x < width; x += S ) {
+					const int left = x - offset;
+					const bool inside = rowInside && left >= 0 && left + (int) K <= width;
+					if ( mPad == PADDING_MODE::VALID && !inside )
+						continue;
+					uint outY = outIdx / this->mOutput->shape[ 2 ];
+					uint outX = outIdx % this->mOutput->shape[ 3 ];
+					++outIdx;
+
+					ValueType pixel = this->mInput->empty();
+					if ( inside ) {
+						const ValueType* start = &( *this->mInput )[ batchOffset + (long) top * width + left ];
+						for ( int depthIdx = 0; depthIdx < channels; ++depthIdx )
+#pragma GCC unroll 8
+							for ( uint filtery = 0; filtery < K; ++filtery )
+#pragma GCC unroll 8
+								for ( uint filterx = 0; filterx < K; ++filterx )
+									window[ ( depthIdx * K + filtery ) * K + filterx ] = start + ( (long) depthIdx * height + filtery ) * width + filterx;
+						this->weightedSum( pixel, window.data(), filterStart, window.size() );
+					} else { // same padding border, the padded taps add nothing
+						for ( int depthIdx = 0; depthIdx < channels; ++depthIdx )
+							windowSum( pixel, batchIdx, sequence, depthIdx, top, left );
+					}
+					finishSum( pixel );
+					this->rescale( pixel );
+					( *this->mOutput )[ { batchIdx, sequence, outY, outX } ] += pixel;
+					this->addBias( ( *this->mOutput )[ { batchIdx, sequence, outY, outX } ], sequence );
+					this->mActivation->activate( ( *this->mOutput )[ { batchIdx, sequence, outY, outX } ] );
+				}
+			}
+		}
+	}
+
+	/**
+	 * @brief Convolution of one filter one output pixel at a time. Every pixel is computed with
+	 * convolvePixel, which uses the sparse or clustered weights. Produces the same pixels in the same
+	 * order as filterOperation.
+	 */
+	void pixelFilterOperation( uint sequence ) {
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
+		TensorP<ConvertedWeights> cBiases;
+		if( useConvertedWeights )
+			cBiases = this->mConvertedWeights[ 1 ];
+
+		int offset = windowOffset();
+		int filterTo = mFilterSize % 2 == 0 ? (signed) mFilterSize / 2 - 1 : (signed) mFilterSize / 2;
+
+		for ( unsigned int batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; batchIdx++ ) {
+			int outIdx = 0;
+			for ( int y = 0; y < (signed) this->mInput->shape[ 2 ]; y += mStride ) { // iterating over the image rows
+				for ( int x = 0; x < (signed) this->mInput->shape[ 3 ]; x += mStride ) { // iterating over the image columns
+					if ( mPad == PADDING_MODE::VALID
+							&& ( y - offset < 0 || y + filterTo >= (signed) this->mInput->shape[ 2 ]
+							|| x - offset < 0 || x + filterTo >= (signed) this->mInput->shape[ 3 ] ) )
+						continue;
+					uint outY = outIdx / this->mOutput->shape[ 2 ];
+					uint outX = outIdx % this->mOutput->shape[ 3 ];
+					++outIdx;
+					ValueType pixel = convolvePixel( batchIdx, sequence, y - offset, x - offset );
+					finishSum( pixel );
+					this->rescale( pixel );
+					( *this->mOutput )[ { batchIdx, sequence, outY, outX } ] += pixel;
+					if( useConvertedWeights )
+						( *this->mOutput )[ { batchIdx, sequence, outY, outX } ] += ( *cBiases )[ { sequence } ];
+					else
+						this->addBias( ( *this->mOutput )[ { batchIdx, sequence, outY, outX } ], sequence );
+					this->mActivation->activate( ( *this->mOutput )[ { batchIdx, sequence, outY, outX } ] );
+				}
+			}
+		}
+	}
+
+	/**
+	 * @brief Computes the weighted sum of all channels for a single output pixel whose filter window
+	 * starts at ( top, left ). Parts of the window that lie outside of the image are skipped (same padding).
+	 */
+	ValueType convolvePixel( uint batchIdx, uint sequence, int top, int left ) {
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
+		TensorP<ConvertedWeights> cWeights;
+		if( useConvertedWeights )
+			cWeights = this->mConvertedWeights[ 0 ];
+
+		ValueType pixel = this->mInput->empty();
+		if ( this->mClusteredWeights ) { // add up the inputs sharing a weight, then multiply once
+			auto clustered = this->mClusteredWeights;
+			for ( size_t g = clustered->rowBegin( sequence ); g < clustered->rowEnd( sequence ); ++g ) {
+				ValueType groupSum = this->mInput->empty();
+				long firstCol = -1;
+				for ( size_t k = clustered->groupBegin( g ); k < clustered->groupEnd( g ); ++k ) {
+					size_t col = clustered->column( k ); // flat offset into [ channels, filterSize, filterSize ]
+					uint depthIdx = col / ( mFilterSize * mFilterSize );
+					int iy = top + ( col / mFilterSize ) % mFilterSize;
+					int ix = left + col % mFilterSize;
+					if ( iy < 0 || iy >= (signed) this->mInput->shape[ 2 ] || ix < 0 || ix >= (signed) this->mInput->shape[ 3 ] )
+						continue;
+					groupSum += ( *this->mInput )[ { batchIdx, depthIdx, iy, ix } ];
+					if ( firstCol < 0 )
+						firstCol = col;
+				}
+				if ( firstCol < 0 ) // the whole group lies in the padding
+					continue;
+				if( useConvertedWeights )
+					groupSum *= ( *cWeights )[ (long) ( sequence * clustered->rowLength() + firstCol ) ];
+				else // every column of the group carries the codeword
+					this->multiplyWeightAt( groupSum, sequence * clustered->rowLength() + firstCol );
+				pixel += groupSum;
+			}
+			return pixel;
+		}
+		if ( this->mSparseWeights ) { // only the non-zero weights of the filter contribute
+			auto sparse = this->mSparseWeights;
+			std::vector<const ValueType*> inputs;
+			std::vector<size_t> weightIdx;
+			for ( size_t k = sparse->rowBegin( sequence ); k < sparse->rowEnd( sequence ); ++k ) {
+				size_t col = sparse->column( k ); // flat offset into [ channels, filterSize, filterSize ]
+				uint depthIdx = col / ( mFilterSize * mFilterSize );
+				uint filtery = ( col / mFilterSize ) % mFilterSize;
+				uint filterx = col % mFilterSize;
+				int iy = top + filtery, ix = left + filterx;
+				if ( iy < 0 || iy >= (signed) this->mInput->shape[ 2 ] || ix < 0 || ix >= (signed) this->mInput->shape[ 3 ] )
+					continue;
+				if( useConvertedWeights ) {
+					ValueType temp = this->mInput->empty();
+					temp += ( *this->mInput )[ { batchIdx, depthIdx, iy, ix } ];
+					temp *= ( *cWeights )[ (long) ( sequence * sparse->rowLength() + col ) ];
+					pixel += temp;
+				} else {
+					inputs.push_back( &( *this->mInput )[ { batchIdx, depthIdx, iy, ix } ] );
+					weightIdx.push_back( sequence * sparse->rowLength() + col );
+				}
+			}
+			if ( !inputs.empty() )
+				this->weightedSum( pixel, inputs.data(), weightIdx.data(), inputs.size() );
+			return pixel;
+		}
+		for ( unsigned int depthIdx = 0; depthIdx < this->mInput->shape[ 1 ]; ++depthIdx ) { // all "subfilters"
+			ValueType weightedSum = this->mInput->empty();
+			if ( !useConvertedWeights )
+				windowSum( weightedSum, batchIdx, sequence, depthIdx, top, left );
+			for ( unsigned int filtery = 0; filtery < mFilterSize && useConvertedWeights; filtery++ ) {
+				int iy = top + filtery;
+				if ( iy < 0 || iy >= (signed) this->mInput->shape[ 2 ] )
+					continue;
+				for ( unsigned int filterx = 0; filterx < mFilterSize; filterx++ ) {
+					int ix = left + filterx;
+					if ( ix < 0 || ix >= (signed) this->mInput->shape[ 3 ] )
+						continue;
+					ValueType temp = this->mInput->empty();
+					temp += ( *this->mInput )[ { batchIdx, depthIdx, iy, ix } ];
+					temp *= ( *cWeights )[ { sequence, depthIdx, filtery, filterx } ];
+					weightedSum += temp;
+				}
+			}
+			pixel += weightedSum;
+		}
+		return pixel;
+	}
+
+	/**
+	 * @brief Convolution with the fused average pooling for one filter.
+	 *
+	 * Every convolution pixel is computed completely (all channels, bias and activation) and
+	 * added straight into the pooling window it belongs to. Since the pooling stride equals the
+	 * pool size every pixel belongs to at most one window and the full sized convolution output
+	 * never has to be stored. Pixels the pooling would drop at the border are not computed at all.
+	 */
+	void pooledFilterOperation( uint sequence ) {
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
+		TensorP<ConvertedWeights> cBiases;
+		if( useConvertedWeights )
+			cBiases = this->mConvertedWeights[ 1 ];
+
+		Shape convShape = convOutputShape();
+		int offset = windowOffset();
+		int filterTo = mFilterSize % 2 == 0 ? (signed) mFilterSize / 2 - 1 : (signed) mFilterSize / 2;
+
+		for ( unsigned int batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; batchIdx++ ) {
+			int outIdx = 0;
+			for ( int y = 0; y < (signed) this->mInput->shape[ 2 ]; y += mStride ) { // iterating over the image rows
+				for ( int x = 0; x < (signed) this->mInput->shape[ 3 ]; x += mStride ) { // iterating over the image columns
+					if ( mPad == PADDING_MODE::VALID
+							&& ( y - offset < 0 || y + filterTo >= (signed) this->mInput->shape[ 2 ]
+							|| x - offset < 0 || x + filterTo >= (signed) this->mInput->shape[ 3 ] ) )
+						continue;
+					// same pixel enumeration as in filterOperation
+					uint outY = outIdx / convShape[ 2 ];
+					uint outX = outIdx % convShape[ 3 ];
+					++outIdx;
+					uint poolY = outY / mPoolSize, poolX = outX / mPoolSize;
+					if ( poolY >= this->mOutput->shape[ 2 ] || poolX >= this->mOutput->shape[ 3 ] )
+						continue;
+					ValueType pixel = convolvePixel( batchIdx, sequence, y - offset, x - offset );
+					finishSum( pixel );
+					this->rescale( pixel );
+					if( useConvertedWeights )
+						pixel += ( *cBiases )[ { sequence } ];
+					else
+						this->addBias( pixel, sequence );
+					this->mActivation->activate( pixel );
+					( *this->mOutput )[ { batchIdx, sequence, poolY, poolX } ] += pixel;
+				}
+			}
+			for ( int y = 0; y < (signed) this->mOutput->shape[ 2 ]; ++y ) {
+				for ( int x = 0; x < (signed) this->mOutput->shape[ 3 ]; ++x ) {
+					( *this->mOutput )[ { batchIdx, sequence, y, x } ] *= 1.0 / (float) ( mPoolSize * mPoolSize ); /// average
+				}
+			}
+		}
+	}
+
+#pragma GCC diagnostic pop
+
+};
+
+/**
+ * Depthwise convolution (keras DepthwiseConv2D). Every input channel gets convolved with depthMultiplier
+ * kernels of its own, output channel c * depthMultiplier + d belongs to input channel c. An output pixel
+ * costs k * k multiplications instead of channels * k * k for Convolution2D.
+ *
+ * A depthwise separable convolution is this layer followed by a 1x1 Convolution2D (pointwise convolution).
+ * Padding, strides and the order of the output pixels are the same as for Convolution2D.
+ */
+template<class ValueType, class WeightType, class DataTensorType=TensorP<ValueType>, class WeightTensorType=TensorP<WeightType>, class ConvertedWeights=float>
+class DepthwiseConvolution2D: public Layer<ValueType, WeightType, DataTensorType, WeightTensorType, ConvertedWeights> {
+public:
+	DepthwiseConvolution2D( std::string name, ActivationP<ValueType> act, uint depthMultiplier, uint filterSize, uint stride, PADDING_MODE pad, TensorP<ValueType> input, TensorFactory<ValueType>* dataTensorFactory, TensorFactory<WeightType>* weigthTensorFactory )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, act, input, dataTensorFactory, weigthTensorFactory ), mDepthMultiplier( depthMultiplier ), mFilterSize( filterSize ), mStride( stride ), mPad( pad ) {
+		this->mOutput = this->mDataTensorFactory->create( outputShape() );
+	}
+
+	// This constructor is to be used when the layer is passed to the model and is not the first layer
+	DepthwiseConvolution2D( std::string name, ActivationP<ValueType> act, uint depthMultiplier, uint filterSize, uint stride, PADDING_MODE pad )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, act ), mDepthMultiplier( depthMultiplier ), mFilterSize( filterSize ), mStride( stride ), mPad( pad ) {
+	}
+
+	// computes the output shape for the layer
+	Shape outputShape() override {
+		uint outputSizeX, outputSizeY;
+		assert( mStride != 0 && "Do not want to mod 0" );
+		assert( this->mInput->shape.size >= 4 );
+		if ( mPad == SAME ) {
+			outputSizeX = std::ceil( this->mInput->shape[ 3 ] / ( mStride * 1.0 ) );
+			outputSizeY = std::ceil( this->mInput->shape[ 2 ] / ( mStride * 1.0 ) );
+		} else {
+			outputSizeX = std::ceil( ( this->mInput->shape[ 3 ] - mFilterSize + 1 ) / ( mStride * 1.0 ) );
+			outputSizeY = std::ceil( ( this->mInput->shape[ 2 ] - mFilterSize + 1 ) / ( mStride * 1.0 ) );
+		}
+		return Shape { this->mInput->shape[ 0 ], this->mInput->shape[ 1 ] * mDepthMultiplier, outputSizeX, outputSizeY };
+	}
+
+	void feedForward() override {
+		uint outChannels = this->mInput->shape[ 1 ] * mDepthMultiplier;
+		this->parallelFor( outChannels, [this]( long j ) {this->channelOperation( j );} );
+		this->mOutput->performChecks();
+	}
+
+	void loadWeights( std::string path, std::string fileName ) override {
+		uint channels = this->mInput->shape[ 1 ];
+		auto p = loadDepthwiseWeights<WeightType>( path + fileName, channels, mDepthMultiplier );
+		this->mWeights = this->mWeigthTensorFactory->create( Shape { channels * mDepthMultiplier, mFilterSize * mFilterSize } );
+		this->mBiases = this->mWeigthTensorFactory->create( Shape { channels * mDepthMultiplier } );
+		this->mWeights->init( p.first );
+		this->mBiases->init( p.second );
+		this->mWeights->reshape( Shape { channels * mDepthMultiplier, mFilterSize, mFilterSize } );
+	}
+
+	void loadWeights( std::string path ) override {
+		loadWeights( path, this->mName );
+	}
+
+	virtual void randomInit() override {
+		this->mWeights->initRandom();
+		this->mBiases->initRandom();
+	}
+
+	void description() override {
+		std::cout << this->mName << "\t" << this->mOutput->shape << std::endl;
+	}
+
+	/**
+	 * @brief Returns weights [ output channels, k, k ], biases
+	 */
+	virtual std::vector<TensorP<WeightType>> allWeights() override {
+		return std::vector<TensorP<WeightType>>{ this->mWeights, this->mBiases };
+	}
+
+	/**
+	 * @brief Fuses a following activation layer if this layer is linear
+	 */
+	bool fuse( LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> next ) override {
+		return this->fuseActivation( next );
+	}
+
+	LayerP<WeightType, WeightType> linearTwin() override {
+		auto twin = std::make_shared<DepthwiseConvolution2D<WeightType, WeightType>>( this->mName, LinearActivation<WeightType>::getSharedPointer(),
+				mDepthMultiplier, mFilterSize, mStride, mPad );
+		twin->weights( this->mWeights );
+		twin->biases( this->mBiases );
+		return twin;
+	}
+
+	unsigned long multiplications() override {
+		return outputShape().capacity() / this->mInput->shape[ 0 ] * mFilterSize * mFilterSize;
+	}
+
+	uint depthMultiplier() const {
+		return mDepthMultiplier;
+	}
+
+private:
+	uint mDepthMultiplier, mFilterSize, mStride;
+	PADDING_MODE mPad;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wnarrowing"
+	void channelOperation( uint sequence ) {
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
+		TensorP<ConvertedWeights> cWeights;
+		TensorP<ConvertedWeights> cBiases;
+		if( useConvertedWeights ){
+			cWeights = this->mConvertedWeights[ 0 ];
+			cBiases = this->mConvertedWeights[ 1 ];
+		}
+
+		uint channel = sequence / mDepthMultiplier;
+		int height = this->mInput->shape[ 2 ], width = this->mInput->shape[ 3 ];
+		int offset = convolutionWindowOffset( mPad, this->mInput->shape, mFilterSize, mStride );
+		int filterTo = mFilterSize % 2 == 0 ? (signed) mFilterSize / 2 - 1 : (signed) mFilterSize / 2;
+
+		for ( unsigned int batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; batchIdx++ ) {
+			int outIdx = 0;
+			for ( int y = 0; y < height; y += mStride ) { // iterating over the image rows
+				for ( int x = 0; x < width; x += mStride ) { // iterating over the image columns
+					if ( mPad == PADDING_MODE::VALID
+							&& ( y - offset < 0 || y + filterTo >= height || x - offset < 0 || x + filterTo >= width ) )
+						continue;
+					uint outY = outIdx / this->mOutput->shape[ 2 ];
+					uint outX = outIdx % this->mOutput->shape[ 3 ];
+					++outIdx;
+					ValueType weightedSum = this->mInput->empty();
+					// clip the window to the image, the padded area adds nothing
+					const int top = y - offset, left = x - offset, K = mFilterSize;
+					const int y0 = std::max( 0, -top ), y1 = std::min( K, height - top );
+					const int x0 = std::max( 0, -left ), x1 = std::min( K, width - left );
+					if ( !useConvertedWeights && y0 < y1 && x0 < x1 )
+						this->weightedSum( weightedSum, &( *this->mInput )[ { batchIdx, channel, (size_t) ( top + y0 ), (size_t) ( left + x0 ) } ],
+								x1 - x0, y1 - y0, width, ( (size_t) sequence * K + y0 ) * K + x0, K );
+					for ( int filtery = y0; filtery < y1 && useConvertedWeights; filtery++ ) {
+						for ( int filterx = x0; filterx < x1; filterx++ ) {
+							ValueType temp = this->mInput->empty();
+							temp += ( *this->mInput )[ { batchIdx, channel, (size_t) ( top + filtery ), (size_t) ( left + filterx ) } ];
+							temp *= ( *cWeights )[ { sequence, (size_t) filtery, (size_t) filterx } ];
+							weightedSum += temp;
+						}
+					}
+					finishSum( weightedSum );
+					if( useConvertedWeights )
+						weightedSum += ( *cBiases )[ { sequence } ];
+					else
+						this->addBias( weightedSum, sequence );
+					this->mActivation->activate( weightedSum );
+					( *this->mOutput )[ { batchIdx, sequence, outY, outX } ] = weightedSum;
+				}
+			}
+		}
+	}
 #pragma GCC diagnostic pop
 
 };
@@ -587,21 +1616,7 @@ public:
 	}
 
 	void feedForward() override {
-		// sanity checks
-		std::thread tt  [ POOL_SIZE ];
-		uint j = 0;
-		while( j < mNoNeurons ){
-			int noThreads = 0;
-			for ( uint i = 0; i < POOL_SIZE; i++ ) {
-				tt [ i ] = std::thread( [=] {this->neuron( j );} );
-				j++;
-				noThreads = i + 1;
-				if ( j == mNoNeurons )
-					break;
-			}
-			for ( int i = 0; i < noThreads; i++ )
-				tt[ i ].join();
-		}
+		this->parallelFor( mNoNeurons, [this]( long j ) {this->neuron( j );} );
 		//this->mOutput->performChecks();
 	}
 
@@ -642,6 +1657,57 @@ public:
 		return std::vector<TensorP<WeightType>>{ this->mWeights, this->mBiases };
 	}
 
+	/**
+	 * @brief Fuses a following activation layer if this layer is linear
+	 */
+	bool fuse( LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> next ) override {
+		return this->fuseActivation( next );
+	}
+
+	LayerP<WeightType, WeightType> linearTwin() override {
+		auto twin = std::make_shared<Dense<WeightType, WeightType>>( this->mName, LinearActivation<WeightType>::getSharedPointer(), mNoNeurons );
+		twin->weights( this->mWeights );
+		twin->biases( this->mBiases );
+		return twin;
+	}
+
+	unsigned long multiplications() override {
+		if ( this->mClusteredWeights )
+			return this->mClusteredWeights->groups();
+		if ( this->mSparseWeights )
+			return this->mSparseWeights->nonZeros();
+		return mNoNeurons * this->mInput->shape.capacity() / this->mInput->shape[ 0 ];
+	}
+
+	void sparsify() override {
+		this->mSparseWeights = std::make_shared<SparseWeights<WeightType>>( this->mWeights, mNoNeurons );
+	}
+
+	void cluster( size_t codebookSize = 0 ) override {
+		if ( codebookSize != 0 )
+			ClusteredWeights<WeightType>::quantize( this->mWeights, codebookSize, this->mWeightScale != 0 );
+		this->mSparseWeights = nullptr; // the sparse copy would be stale
+		if ( codebookSize != 0 )
+			this->dropEncodings();
+		this->mClusteredWeights = std::make_shared<ClusteredWeights<WeightType>>( this->mWeights, mNoNeurons );
+	}
+
+	bool integerizeWeights( uint bits ) override {
+		return this->integerize( bits );
+	}
+
+	uint scaleDegree() override {
+		return this->mActivation->degree();
+	}
+
+	bool removesScale() override {
+		return true;
+	}
+
+	double scale( double inputScale, bool undo ) override {
+		return this->scaleWeightedSum( inputScale, undo );
+	}
+
 private:
 	uint mNoNeurons;
 
@@ -651,7 +1717,7 @@ private:
 
 	void neuron( uint sequence ) { // TODO redo with slicing
 
-		bool useConvertedWeights = this->mConvertedWeights.size() < 0;
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
 		TensorP<ConvertedWeights> cWeights;
 		TensorP<ConvertedWeights> cBiases;
 		if( useConvertedWeights ){
@@ -662,19 +1728,59 @@ private:
 		for ( uint batchIdx = 0; batchIdx < this->mInput->shape [ 0 ]; ++batchIdx ) {
 			//TODO this could be done more efficently if we did not create need to create empties
 			ValueType temp = this->mInput->empty();
-			for ( uint i = 0; i < this->mWeights->shape [ 1 ]; ++i ) {
-				temp = this->mInput->empty();
-				temp += ( *this->mInput ) [ { batchIdx, i } ];
-				if( useConvertedWeights )
+			if ( this->mClusteredWeights ) { // add up the inputs sharing a weight, then multiply once
+				auto clustered = this->mClusteredWeights;
+				for ( size_t g = clustered->rowBegin( sequence ); g < clustered->rowEnd( sequence ); ++g ) {
+					temp = this->mInput->empty();
+					for ( size_t k = clustered->groupBegin( g ); k < clustered->groupEnd( g ); ++k )
+						temp += ( *this->mInput ) [ { batchIdx, clustered->column( k ) } ];
+					if( useConvertedWeights )
+						temp *= ( *cWeights ) [ { sequence, clustered->column( clustered->groupBegin( g ) ) } ];
+					else // every column of the group carries the codeword
+						this->multiplyWeightAt( temp, sequence * clustered->rowLength() + clustered->column( clustered->groupBegin( g ) ) );
+					( *this->mOutput ) [ { batchIdx, sequence } ] += temp;
+				}
+			}
+			else if ( this->mSparseWeights ) { // only the non-zero weights contribute
+				auto sparse = this->mSparseWeights;
+				size_t begin = sparse->rowBegin( sequence ), end = sparse->rowEnd( sequence );
+				if( useConvertedWeights ) {
+					for ( size_t k = begin; k < end; ++k ) {
+						size_t i = sparse->column( k );
+						temp = this->mInput->empty();
+						temp += ( *this->mInput ) [ { batchIdx, i } ];
+						temp *= ( *cWeights ) [ { sequence, i } ];
+						( *this->mOutput ) [ { batchIdx, sequence } ] += temp;
+					}
+				}
+				else if ( begin < end ) {
+					std::vector<const ValueType*> inputs;
+					std::vector<size_t> weightIdx;
+					for ( size_t k = begin; k < end; ++k ) {
+						inputs.push_back( &( *this->mInput ) [ { batchIdx, sparse->column( k ) } ] );
+						weightIdx.push_back( sequence * sparse->rowLength() + sparse->column( k ) );
+					}
+					this->weightedSum( ( *this->mOutput ) [ { batchIdx, sequence } ], inputs.data(), weightIdx.data(), end - begin );
+				}
+			}
+			else if( useConvertedWeights ) {
+				for ( uint i = 0; i < this->mWeights->shape [ 1 ]; ++i ) {
+					temp = this->mInput->empty();
+					temp += ( *this->mInput ) [ { batchIdx, i } ];
 					temp *= ( *cWeights ) [ { sequence, i } ];
-				else
-					temp *= ( *this->mWeights ) [ { sequence, i } ];
-				( *this->mOutput ) [ { batchIdx, sequence } ] += temp;
+					( *this->mOutput ) [ { batchIdx, sequence } ] += temp;
+				}
+			}
+			else {
+				this->weightedSum( ( *this->mOutput ) [ { batchIdx, sequence } ], &( *this->mInput ) [ { batchIdx, 0 } ],
+						this->mWeights->shape [ 1 ], 1, 0, sequence * this->mWeights->shape [ 1 ], 0 );
 			}
+			finishSum( ( *this->mOutput ) [ { batchIdx, sequence } ] );
+			this->rescale( ( *this->mOutput ) [ { batchIdx, sequence } ] );
 			if( useConvertedWeights )
 				( *this->mOutput ) [ { batchIdx, sequence } ] += ( *cBiases )[ { sequence } ];
 			else
-				( *this->mOutput ) [ { batchIdx, sequence } ] += ( *this->mBiases )[ { sequence } ];
+				this->addBias( ( *this->mOutput ) [ { batchIdx, sequence } ], sequence );
 			this->mActivation->activate( ( *this->mOutput )[ { batchIdx, sequence } ] );
 		}
 	}
@@ -803,6 +1909,14 @@ public:
 		return std::vector<TensorP<WeightType>>();
 	}
 
+	uint scaleDegree() override {
+		return 1;
+	}
+
+	LayerP<WeightType, WeightType> linearTwin() override {
+		return std::make_shared<Flatten<WeightType, WeightType>>( this->mName, mChannelsFirst );
+	}
+
 private:
 	bool mChannelsFirst = false;
 
@@ -927,56 +2041,26 @@ public:
 			// create index queues used in the activation. could be used in other places as well,
 			// TODO and FIXME should probably be used every where
 			// i could also be smarter about assembling this queue.
-			std::vector<std::vector<uint>> idq( POOL_SIZE, std::vector<uint>() );
+			ThreadPool& pool = ThreadPool::getPool();
+			std::vector<std::vector<uint>> idq( pool.threads(), std::vector<uint>() );
 			for( uint i = 0; i < mUnits; ++i )
-				idq[ i % POOL_SIZE ].push_back( i ); // balance out the indexes over the queues
+				idq[ i % pool.threads() ].push_back( i ); // balance out the indexes over the queues
 
 
-			std::thread tt  [ POOL_SIZE ];
 			for ( uint timeIdx = 0; timeIdx < this->mInput->shape[ 1 ]; ++timeIdx ) { // iterate over the timesteps
 				auto start = std::chrono::system_clock::now();
 				if( DEBUG ) std::cout << timeIdx << "/" << this->mInput->shape[ 1 ] << std::flush;
 				// calclutate part of the state based on the input at the time step
-				uint unitIdx = 0;
-				while( unitIdx < mUnits  ){ // iterate over the hidden units
-					int noThreads = 0;
-					for ( uint i = 0; i < POOL_SIZE; i++ ) {
-						tt [ i ] = std::thread( [this,unitIdx,timeIdx] {this->hiddenUnit( unitIdx, timeIdx );} );
-						++unitIdx;
-						noThreads = i + 1;
-						if ( unitIdx == mUnits )
-							break;
-					}
-					for ( int i = 0; i < noThreads; i++ )
-						tt[ i ].join();
-				}
-
-				// add reccurrent state
-				unitIdx = 0;
-				while( unitIdx < mUnits  ){ // iterate over the hidden units
-					int noThreads = 0;
-					for ( uint i = 0; i < POOL_SIZE; i++ ) {
-						tt [ i ] = std::thread( [this,unitIdx,timeIdx] {this->recurrentUnit( unitIdx, timeIdx );} );
-						++unitIdx;
-						noThreads = i + 1;
-						if ( unitIdx == mUnits )
-							break;
-					}
-					for ( int i = 0; i < noThreads; i++ )
-						tt[ i ].join();
-				}
+				this->parallelFor( mUnits, [this,timeIdx]( long unitIdx ) {this->hiddenUnit( unitIdx, timeIdx );} );
 
+				// add reccurrent state
+				this->parallelFor( mUnits, [this,timeIdx]( long unitIdx ) {this->recurrentUnit( unitIdx, timeIdx );} );
 
 				// add bias and apply activation
-				uint noThreads = 0;
-				for ( auto idxs : idq ) // iterate over index queues
-					tt [ noThreads++ ] = std::thread( [this, idxs, timeIdx] {this->activations( idxs, timeIdx );} );
-				for ( uint i = 0; i < noThreads; i++ )
-					tt[ i ].join();
+				this->parallelFor( idq.size(), [this,&idq,timeIdx]( long q ) {this->activations( idq[ q ], timeIdx );} );
 
 
-				if ( timeIdx % 27 == 0 )
-					this->innerStates->performChecks();
+				this->innerStates->performChecks();
 				auto end = std::chrono::system_clock::now();
 				std::chrono::duration<double> elapsed_seconds = end - start;
 				if( DEBUG ) std::cout << " Time: " << elapsed_seconds.count() << "s" << std::endl;
@@ -1039,6 +2123,8 @@ public:
 
 	void recurrentWeights( const TensorP<WeightType>& recurrentWeights ) {
 		mRecurrentWeights = recurrentWeights;
+		mSparseRecurrentWeights = nullptr;
+		mEncodedRecurrentWeights.clear();
 	}
 
 	/**
@@ -1048,11 +2134,43 @@ public:
 		return std::vector<TensorP<WeightType>>{ this->mWeights, this->mBiases, this->mRecurrentWeights };
 	}
 
+	/**
+	 * @brief Every time step multiplies the previous state with the recurrent weights and activates the sum
+	 */
+	uint multiplicativeDepth() override {
+		return this->mInput->shape[ 1 ] * ( 1 + this->mActivation->depth() );
+	}
+
+	/**
+	 * @brief Sparsifies the input and the recurrent weights
+	 */
+	void sparsify() override {
+		this->mSparseWeights = std::make_shared<SparseWeights<WeightType>>( this->mWeights, mUnits );
+		mSparseRecurrentWeights = std::make_shared<SparseWeights<WeightType>>( mRecurrentWeights, mUnits );
+	}
+
+	/**
+	 * @brief Encodes the recurrent weights as well
+	 */
+	bool encodeWeights() override {
+		if ( !mRecurrentWeights || !Layer<ValueType, WeightType, DataTensorType, WeightTensorType>::encodeWeights() )
+			return false;
+		mEncodedRecurrentWeights = this->encode( mRecurrentWeights, this->mInput->empty() );
+		return true;
+	}
+
+protected:
+	void dropEncodings() override {
+		Layer<ValueType, WeightType, DataTensorType, WeightTensorType>::dropEncodings();
+		mEncodedRecurrentWeights.clear();
+	}
 
 private:
 	uint mUnits;
 	bool mReturnSquences;
 	TensorP<WeightType> mRecurrentWeights;
+	SparseWeightsP<WeightType> mSparseRecurrentWeights;
+	std::vector<typename WeightEncoding<ValueType, WeightType>::Encoded> mEncodedRecurrentWeights; // empty if not encoded
 	TensorP<ValueType> innerStates;
 	TensorP<ValueType> lastInnerStates; // we only need this one if we don't return sequences
 
@@ -1072,7 +2190,7 @@ private:
 		 *
 		 */
 
-		bool useConvertedWeights = this->mConvertedWeights.size() < 0;
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
 		TensorP<ConvertedWeights> cWeights;
 		if( useConvertedWeights )
 			cWeights = this->mConvertedWeights[ 0 ];
@@ -1084,26 +2202,49 @@ private:
 				( *innerStates )[ { batchIdx, unitIdx } ] = innerStates->empty();
 			}
 
+		if ( this->mSparseWeights ) { // only visit the non-zero weights
+			auto sparse = this->mSparseWeights;
+			size_t begin = sparse->rowBegin( unitIdx ), end = sparse->rowEnd( unitIdx );
+			for ( uint batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; ++batchIdx ) { // iterate over the batch
+				ValueType& state = mReturnSquences ? ( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] : ( *innerStates )[ { batchIdx, unitIdx } ];
+				if ( !useConvertedWeights ) {
+					std::vector<const ValueType*> inputs;
+					std::vector<size_t> weightIdx;
+					for ( size_t k = begin; k < end; ++k ) {
+						inputs.push_back( &( *this->mInput )[ { batchIdx, timeIdx, sparse->column( k ) } ] );
+						weightIdx.push_back( unitIdx * sparse->rowLength() + sparse->column( k ) );
+					}
+					if ( begin < end )
+						this->weightedSum( state, inputs.data(), weightIdx.data(), end - begin );
+					continue;
+				}
+				for ( size_t k = begin; k < end; ++k ) {
+					size_t inIdx = sparse->column( k );
+					ValueType temp = this->mInput->empty();
+					temp += ( *this->mInput )[ { batchIdx, timeIdx, inIdx } ];
+					temp *= ( *cWeights )[ { unitIdx, inIdx } ];
+					state += temp;
+				}
+			}
+			return;
+		}
+
 		for ( uint batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; ++batchIdx ) { // iterate over the batch
+			// if we are in the last time step and are not returning the sequences
+			// write to the layer output instead
+			ValueType& state = mReturnSquences ? ( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] : ( *innerStates )[ { batchIdx, unitIdx } ];
+			if ( !useConvertedWeights ) {
+				this->weightedSum( state, &( *this->mInput )[ { batchIdx, timeIdx, 0 } ], this->mInput->shape[ 2 ], 1, 0, unitIdx * this->mInput->shape[ 2 ], 0 );
+				continue;
+			}
 			for ( uint inIdx = 0; inIdx < this->mInput->shape[ 2 ]; ++inIdx ) { // iterate over the data dimension
-				WeightType w = ( *this->mWeights )[ { unitIdx, inIdx } ];
 				// if w is 0 we can just skip the step because it will add nothing
-				if ( w == 0 )
+				if ( ( *this->mWeights )[ { unitIdx, inIdx } ] == 0 )
 					continue;
-				ValueType temp = this->mInput->empty(); //TODO this could be done more efficently if we did not create need to create empties
+				ValueType temp = this->mInput->empty();
 				temp += ( *this->mInput )[ { batchIdx, timeIdx, inIdx } ];
-				if( useConvertedWeights )
-					temp *= ( *cWeights )[ { unitIdx, inIdx } ];
-				else
-					temp *= w;
-
-				// if we are in the last time step and are not returning the sequences
-				// write to the layer output instead
-				if ( mReturnSquences ) {
-					( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] += temp;
-				}
-				else
-					( *innerStates )[ { batchIdx, unitIdx } ] += temp;
+				temp *= ( *cWeights )[ { unitIdx, inIdx } ];
+				state += temp;
 			}
 		}
 	}
@@ -1122,37 +2263,63 @@ private:
 		 *
 		 */
 
-		bool useConvertedWeights = this->mConvertedWeights.size() < 0;
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
 		TensorP<ConvertedWeights> cRecurrentWeights;
 		if( useConvertedWeights )
 			cRecurrentWeights = this->mConvertedWeights[ 2 ];
 
 
-		for ( uint batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; ++batchIdx ) { // iterate over the batch
-			if ( timeIdx > 0 ) { // currently we dont have an inital state so just skip it for the first timestep
-				for ( uint inIdx = 0; inIdx < mUnits; ++inIdx ) { // iterate over the incoming recurrent state
-					WeightType w = ( *this->mRecurrentWeights )[ { unitIdx, inIdx } ];
-					// if w is 0 we can just skip the step because it will add nothing
-					if ( w == 0 )
-						continue;
-					ValueType temp = this->mInput->empty(); //TODO this could be done more efficently if we did not need to create empties
-					if ( mReturnSquences )
-						temp += ( *innerStates )[ { batchIdx, timeIdx - 1, inIdx } ];
-					else
-						temp += ( *lastInnerStates )[ { batchIdx, inIdx } ];
-						
+		if ( timeIdx == 0 ) // currently we dont have an inital state so just skip it for the first timestep
+			return;
 
-					if( useConvertedWeights )
-						temp *= ( *cRecurrentWeights )[ { unitIdx, inIdx } ];
-					else
-						temp *= w;
-					// if we are in the last time step and are not returning the sequences
-					// write to the layer output instead
-					if ( mReturnSquences  )
-						( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] += temp;
-					else
-						( *innerStates )[ { batchIdx, unitIdx } ] += temp;
+		for ( uint batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; ++batchIdx ) { // iterate over the batch
+			// if we are in the last time step and are not returning the sequences
+			// write to the layer output instead
+			ValueType& state = mReturnSquences ? ( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] : ( *innerStates )[ { batchIdx, unitIdx } ];
+			const ValueType* previous = mReturnSquences ? &( *innerStates )[ { batchIdx, timeIdx - 1, 0 } ] : &( *lastInnerStates )[ { batchIdx, 0 } ];
+
+			if ( mSparseRecurrentWeights ) { // only visit the non-zero weights
+				auto sparse = mSparseRecurrentWeights;
+				size_t begin = sparse->rowBegin( unitIdx ), end = sparse->rowEnd( unitIdx );
+				if ( !useConvertedWeights ) {
+					std::vector<const ValueType*> inputs;
+					for ( size_t k = begin; k < end; ++k )
+						inputs.push_back( previous + sparse->column( k ) );
+					if ( begin < end && !mEncodedRecurrentWeights.empty() ) {
+						std::vector<typename WeightEncoding<ValueType, WeightType>::Encoded> weights;
+						for ( size_t k = begin; k < end; ++k )
+							weights.push_back( mEncodedRecurrentWeights[ unitIdx * mUnits + sparse->column( k ) ] );
+						dot( state, inputs.data(), weights.data(), end - begin );
+					}
+					else if ( begin < end )
+						dot( state, inputs.data(), &sparse->value( begin ), end - begin );
+					continue;
 				}
+				for ( size_t k = begin; k < end; ++k ) {
+					ValueType temp = this->mInput->empty();
+					temp += previous[ sparse->column( k ) ];
+					temp *= ( *cRecurrentWeights )[ { unitIdx, sparse->column( k ) } ];
+					state += temp;
+				}
+				continue;
+			}
+
+			if ( !useConvertedWeights && !mEncodedRecurrentWeights.empty() ) {
+				dot( state, previous, mUnits, 1, 0, &mEncodedRecurrentWeights[ unitIdx * mUnits ], 0 );
+				continue;
+			}
+			if ( !useConvertedWeights ) {
+				dot( state, previous, mUnits, 1, 0, &( *this->mRecurrentWeights )[ { unitIdx, 0 } ], 0 );
+				continue;
+			}
+			for ( uint inIdx = 0; inIdx < mUnits; ++inIdx ) { // iterate over the incoming recurrent state
+				// if w is 0 we can just skip the step because it will add nothing
+				if ( ( *this->mRecurrentWeights )[ { unitIdx, inIdx } ] == 0 )
+					continue;
+				ValueType temp = this->mInput->empty();
+				temp += previous[ inIdx ];
+				temp *= ( *cRecurrentWeights )[ { unitIdx, inIdx } ];
+				state += temp;
 			}
 		}
 	}
@@ -1161,24 +2328,26 @@ private:
 	 * @brief Add bias and apply activation for one unit
 	 */
 	void activation( uint unitIdx, uint timeIdx ){
-		bool useConvertedWeights = this->mConvertedWeights.size() < 0;
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
 		TensorP<ConvertedWeights> cBiases;
 		if( useConvertedWeights )
 			cBiases = this->mConvertedWeights[ 1 ];
 
 		for ( uint batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; ++batchIdx ) { // iterate over the batch
 			if ( mReturnSquences ) {
+				finishSum( ( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] );
 				if( useConvertedWeights )
 					( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] += ( *cBiases )[ { unitIdx } ];
 				else
-					( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] += ( *this->mBiases )[ { unitIdx } ];
+					this->addBias( ( *innerStates )[ { batchIdx, timeIdx, unitIdx } ], unitIdx );
 				this->mActivation->activate( ( *innerStates )[ { batchIdx, timeIdx, unitIdx } ] );
 			}
 			else {
+				finishSum( ( *innerStates )[ { batchIdx, unitIdx } ] );
 				if( useConvertedWeights )
 					( *innerStates )[ { batchIdx, unitIdx } ] += ( *cBiases )[ { unitIdx } ];
 				else
-					( *innerStates )[ { batchIdx, unitIdx } ] += ( *this->mBiases )[ { unitIdx } ];
+					this->addBias( ( *innerStates )[ { batchIdx, unitIdx } ], unitIdx );
 				this->mActivation->activate( ( *innerStates )[ { batchIdx, unitIdx } ] );
 			}
 		}
@@ -1291,20 +2460,7 @@ public:
 	}
 
 	void feedForward() override {
-		std::thread tt[ POOL_SIZE ];
-		uint j = 0;
-		while ( j < this->mInput->shape[ 1 ] ) {
-			int noThreads = 0;
-			for ( unsigned int i = 0; i < POOL_SIZE; i++ ) {
-				tt[ i ] = std::thread( [=] {this->pool( j );} );
-				j++;
-				noThreads = i + 1;
-				if ( j == this->mInput->shape[ 1 ] )
-					break;
-			}
-			for ( int i = 0; i < noThreads; i++ )
-				tt[ i ].join();
-		}
+		this->parallelFor( this->mInput->shape[ 1 ], [this]( long j ) {this->pool( j );} );
 	}
 
 	void loadWeights( std::string path, std::string fileName ) override {
@@ -1330,6 +2486,30 @@ public:
 		return std::vector<TensorP<WeightType>>();
 	}
 
+	uint filterSize() const {
+		return mFilterSize;
+	}
+
+	uint stride() const {
+		return mStride;
+	}
+
+	PADDING_MODE padding() const {
+		return mPad;
+	}
+
+	uint scaleDegree() override {
+		return 1;
+	}
+
+	LayerP<WeightType, WeightType> linearTwin() override {
+		return std::make_shared<AveragePooling<WeightType, WeightType, TensorP<WeightType>, TensorP<WeightType>>>( this->mName, mFilterSize, mStride, mPad );
+	}
+
+	unsigned long multiplications() override {
+		return this->mOutput->shape.capacity() / this->mOutput->shape[ 0 ];
+	}
+
 private:
 	uint mFilterSize, mStride;
 	PADDING_MODE mPad;
@@ -1460,6 +2640,88 @@ private:
 
 };
 
+/**
+ * Averages each channel over the whole image (keras GlobalAveragePooling2D). The output is
+ * [ batch, channels ], so a dense layer can follow directly without Flatten. Uses only
+ * additions and one multiplication with a constant per channel.
+ */
+template<class ValueType, class WeightType, class DataTensorType=TensorP<ValueType>, class WeightTensorType=TensorP<WeightType>, class ConvertedWeights=float>
+class GlobalAveragePooling2D: public Layer<ValueType, WeightType, DataTensorType, WeightTensorType> {
+public:
+
+	GlobalAveragePooling2D( std::string name, TensorP<ValueType> input, TensorFactory<ValueType>* dataTensorFactory, TensorFactory<WeightType>* weigthTensorFactory )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, LinearActivation<ValueType>::getSharedPointer(), input, dataTensorFactory, weigthTensorFactory )
+	{
+		this->mOutput = this->mDataTensorFactory->create( outputShape() );
+	}
+
+	// This constructor is to be used when the layer is passed to the model and is not the first layer
+	GlobalAveragePooling2D( std::string name )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, LinearActivation<ValueType>::getSharedPointer() )
+	{
+	}
+
+	// computes the outputshape for the layer
+	Shape outputShape() override {
+		assert( this->mInput->shape.size == 4 );
+		return Shape { this->mInput->shape[ 0 ], this->mInput->shape[ 1 ] };
+	}
+
+	void feedForward() override {
+		this->parallelFor( this->mInput->shape[ 1 ], [this]( long j ) {this->pool( j );} );
+		this->mOutput->performChecks();
+	}
+
+	void loadWeights( std::string path, std::string fileName ) override {
+		// nothing to do
+	}
+
+	void loadWeights( std::string path ) override {
+		// nothing to do
+	}
+
+	void randomInit() override {
+		// nothing to do
+	}
+
+	void description() override {
+		std::cout << this->mName << "\t" << this->mOutput->shape << std::endl;
+	}
+
+	/**
+	 * @brief Returns empty vector
+	 */
+	virtual std::vector<TensorP<WeightType>> allWeights() override {
+		return std::vector<TensorP<WeightType>>();
+	}
+
+	uint scaleDegree() override {
+		return 1;
+	}
+
+	LayerP<WeightType, WeightType> linearTwin() override {
+		return std::make_shared<GlobalAveragePooling2D<WeightType, WeightType>>( this->mName );
+	}
+
+	unsigned long multiplications() override {
+		return this->mInput->shape[ 1 ];
+	}
+
+private:
+
+	void pool( uint channel ) {
+		for ( uint batchIdx = 0; batchIdx < this->mInput->shape[ 0 ]; ++batchIdx ) {
+			ValueType sum = this->mInput->empty();
+			for ( uint y = 0; y < this->mInput->shape[ 2 ]; ++y )
+				for ( uint x = 0; x < this->mInput->shape[ 3 ]; ++x )
+					sum += ( *this->mInput )[ { batchIdx, channel, y, x } ];
+			( *this->mOutput )[ { batchIdx, channel } ] = sum;
+			( *this->mOutput )[ { batchIdx, channel } ] *= 1.0 / (float) ( this->mInput->shape[ 2 ] * this->mInput->shape[ 3 ] ); /// average
+		}
+	}
+
+};
+
 template<class ValueType, class WeightType, class DataTensorType=TensorP<ValueType>, class WeightTensorType=TensorP<WeightType>, class ConvertedWeights=float>
 class ZeroPadding2D: public Layer<ValueType, WeightType, DataTensorType, WeightTensorType> {
 public:
@@ -1538,10 +2800,243 @@ public:
 		return std::vector<TensorP<WeightType>>();
 	}
 
+	uint scaleDegree() override {
+		return 1;
+	}
+
+	LayerP<WeightType, WeightType> linearTwin() override {
+		return std::make_shared<ZeroPadding2D<WeightType, WeightType>>( this->mName, mPadding );
+	}
+
 private:
 	uint mPadding;
 
 };
 
 
+/**
+ * Applies an activation function on its own (keras Activation layer). The output is a tensor
+ * of its own, the output of the previous layer stays untouched.
+ * If the model fuses layers it gets merged into a preceding linear Convolution2D or Dense.
+ */
+template<class ValueType, class WeightType, class DataTensorType=TensorP<ValueType>, class WeightTensorType=TensorP<WeightType>, class ConvertedWeights=float>
+class ActivationLayer: public Layer<ValueType, WeightType, DataTensorType, WeightTensorType> {
+public:
+
+	ActivationLayer( std::string name, ActivationP<ValueType> act, TensorP<ValueType> input, TensorFactory<ValueType>* dataTensorFactory, TensorFactory<WeightType>* weigthTensorFactory )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, act, input, dataTensorFactory, weigthTensorFactory )
+	{
+		this->mOutput = this->mDataTensorFactory->create( outputShape() );
+	}
+
+	// This constructor is to be used when the layer is passed to the model and is not the first layer
+	ActivationLayer( std::string name, ActivationP<ValueType> act )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, act )
+	{
+	}
+
+	// computes the output shape for the layer
+	Shape outputShape() override {
+		return this->mInput->shape;
+	}
+
+	/**
+	 * @brief Applies the activation to a copy of the input. The input is the output of the previous layer, which
+	 * has to stay as it is. Ciphertext copies share their data, so the copy is an empty value plus the input.
+	 */
+	void feedForward() override {
+		this->mOutput->init();
+		// cheap per element work, let the pool pick the chunk size
+		ThreadPool::getPool().parallelFor( 0, this->mOutput->shape.capacity(), [this]( long i ) {
+			ValueType& out = ( *this->mOutput )[ i ];
+			out += ( *this->mInput )[ i ];
+			this->mActivation->activate( out );
+		}, 0 );
+		this->mOutput->performChecks();
+	}
+
+	void loadWeights( std::string path, std::string fileName ) {
+		// nothing to do
+	}
+
+	void loadWeights( std::string path ) {
+		// nothing to do
+	}
+
+	virtual void randomInit() override {
+	}
+
+	void description() override {
+		std::cout << this->mName << "\t" << this->mOutput->shape << std::endl;
+	}
+
+	/**
+	 * @brief Returns empty vector
+	 */
+	virtual std::vector<TensorP<WeightType>> allWeights() override {
+		return std::vector<TensorP<WeightType>>();
+	}
+
+	uint scaleDegree() override {
+		return this->mActivation->degree();
+	}
+
+};
+
+
+/**
+ * Batch normalization (keras BatchNormalization) over the features of dimension 1, which
+ * are the channels for image data and the units for the output of a dense layer.
+ *
+ * At inference the normalization is the affine map x * scale + shift per feature with
+ * scale = gamma / sqrt( variance + epsilon ) and shift = beta - mean * scale. The scale and
+ * shift are stored as weights and biases. The model folds them into a preceding linear
+ * Convolution2D or Dense layer when the weights get loaded, so the layer usually never runs.
+ * Otherwise it is applied in place on a view of its input.
+ */
+template<class ValueType, class WeightType, class DataTensorType=TensorP<ValueType>, class WeightTensorType=TensorP<WeightType>, class ConvertedWeights=float>
+class BatchNormalization: public Layer<ValueType, WeightType, DataTensorType, WeightTensorType> {
+public:
+
+	BatchNormalization( std::string name, float epsilon, TensorP<ValueType> input, TensorFactory<ValueType>* dataTensorFactory, TensorFactory<WeightType>* weigthTensorFactory )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, LinearActivation<ValueType>::getSharedPointer(), input, dataTensorFactory, weigthTensorFactory ), mEpsilon( epsilon )
+	{
+		buildOutputTensor();
+	}
+
+	// This constructor is to be used when the layer is passed to the model and is not the first layer
+	BatchNormalization( std::string name, float epsilon )
+			: Layer<ValueType, WeightType, DataTensorType, WeightTensorType>( name, LinearActivation<ValueType>::getSharedPointer() ), mEpsilon( epsilon )
+	{
+	}
+
+	// computes the output shape for the layer
+	Shape outputShape() override {
+		return this->mInput->shape;
+	}
+
+	void feedForward() override {
+		this->parallelFor( this->mInput->shape[ 1 ], [this]( long j ) {this->normalize( j );} );
+		this->mOutput->performChecks();
+	}
+
+	bool buildsOwnOutputTensor() override {
+		buildOutputTensor();
+		return true;
+	}
+
+	/**
+	 * @brief Loads gamma, beta and the moving mean and variance from <name>_gamma.txt,
+	 * <name>_beta.txt, <name>_moving_mean.txt and <name>_moving_variance.txt
+	 */
+	void loadWeights( std::string path, std::string fileName ) override {
+		std::vector<double> gamma = loadFilterWeights<double>( path + fileName + "_gamma.txt" );
+		std::vector<double> beta = loadFilterWeights<double>( path + fileName + "_beta.txt" );
+		std::vector<double> mean = loadFilterWeights<double>( path + fileName + "_moving_mean.txt" );
+		std::vector<double> variance = loadFilterWeights<double>( path + fileName + "_moving_variance.txt" );
+		statistics( gamma, beta, mean, variance );
+	}
+
+	void loadWeights( std::string path ) override {
+		loadWeights( path, this->mName );
+	}
+
+	/**
+	 * @brief Sets the learned parameters and computes scale and shift from them
+	 */
+	void statistics( const std::vector<double>& gamma, const std::vector<double>& beta,
+			const std::vector<double>& mean, const std::vector<double>& variance ) {
+		size_t features = gamma.size();
+		if ( beta.size() != features || mean.size() != features || variance.size() != features )
+			throw std::logic_error( "batch normalization " + this->mName + ": parameters differ in size" );
+		std::vector<WeightType> scale, shift;
+		for ( size_t i = 0; i < features; ++i ) {
+			double s = gamma[ i ] / std::sqrt( variance[ i ] + mEpsilon );
+			scale.push_back( static_cast<WeightType>( s ) );
+			shift.push_back( static_cast<WeightType>( beta[ i ] - mean[ i ] * s ) );
+		}
+		this->mWeights = this->mWeigthTensorFactory->create( Shape { features } );
+		this->mWeights->init( scale );
+		this->mBiases = this->mWeigthTensorFactory->create( Shape { features } );
+		this->mBiases->init( shift );
+	}
+
+	/**
+	 * @brief Multiplies the weights and biases belonging to each output feature of the previous layer
+	 * with the scale and adds the shift to its biases. Only valid if previous has a linear activation.
+	 * The first dimension of its weights has to be the output feature.
+	 */
+	void foldInto( LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> previous ) {
+		TensorP<WeightType> weights = previous->weights();
+		TensorP<WeightType> biases = previous->biases();
+		size_t features = this->mWeights->shape[ 0 ];
+		if ( weights->shape[ 0 ] != features || biases->shape.capacity() != features )
+			throw std::logic_error( "can not fold " + this->mName + " into " + previous->name() );
+		size_t row = weights->shape.capacity() / features;
+		for ( size_t f = 0; f < features; ++f ) {
+			WeightType scale = ( *this->mWeights )[ { f } ];
+			for ( size_t i = 0; i < row; ++i )
+				( *weights )[ (long) ( f * row + i ) ] *= scale;
+			( *biases )[ (long) f ] = ( *biases )[ (long) f ] * scale + ( *this->mBiases )[ { f } ];
+		}
+	}
+
+	virtual void randomInit() override {
+		this->mWeights->initRandom();
+		this->mBiases->initRandom();
+	}
+
+	void description() override {
+		std::cout << this->mName << "\t" << this->mOutput->shape << std::endl;
+	}
+
+	/**
+	 * @brief Returns scale, shift
+	 */
+	virtual std::vector<TensorP<WeightType>> allWeights() override {
+		return std::vector<TensorP<WeightType>>{ this->mWeights, this->mBiases };
+	}
+
+	unsigned long multiplications() override {
+		return this->mInput->shape.capacity() / this->mInput->shape[ 0 ];
+	}
+
+private:
+	float mEpsilon;
+
+	void buildOutputTensor() {
+		this->mOutput = this->mDataTensorFactory->createView( this->outputShape(), this->mInput );
+	}
+
+	/**
+	 * @brief Normalizes one feature over the whole batch
+	 */
+	void normalize( uint feature ) {
+		bool useConvertedWeights = !this->mConvertedWeights.empty();
+		TensorP<ConvertedWeights> cWeights;
+		TensorP<ConvertedWeights> cBiases;
+		if( useConvertedWeights ){
+			cWeights = this->mConvertedWeights[ 0 ];
+			cBiases = this->mConvertedWeights[ 1 ];
+		}
+		Shape s = this->mOutput->shape;
+		long features = s[ 1 ];
+		long inner = s.capacity() / ( s[ 0 ] * features ); // elements per feature in one instance
+		for ( long batchIdx = 0; batchIdx < (long) s[ 0 ]; ++batchIdx ) {
+			long offset = ( batchIdx * features + feature ) * inner;
+			for ( long i = offset; i < offset + inner; ++i ) {
+				if( useConvertedWeights ) {
+					( *this->mOutput )[ i ] *= ( *cWeights )[ { feature } ];
+					( *this->mOutput )[ i ] += ( *cBiases )[ { feature } ];
+				} else {
+					this->multiplyWeightAt( ( *this->mOutput )[ i ], feature );
+					this->addBias( ( *this->mOutput )[ i ], feature );
+				}
+			}
+		}
+	}
+
+};
+
+
 #endif /* ARCHITECTURE_LAYERIMPL_H_ */
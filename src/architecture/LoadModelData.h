@@ -95,6 +95,27 @@ std::pair<std::vector<std::vector<T>>, std::vector<T>> loadFilterWeights( std::s
 	return std::pair<std::vector<std::vector<T>>, std::vector<T>>( filters, bias );
 }
 
+/**
+ * Loads the kernels of a depthwise convolution. The kernel for output channel c * depthMultiplier + d
+ * is stored in <Address>-<c>_<d>.txt with its bias as the last value.
+ */
+template<class T>
+std::pair<std::vector<std::vector<T>>, std::vector<T>> loadDepthwiseWeights( std::string Address, int nomChannels,
+		int depthMultiplier ) {
+	std::vector<std::vector<T> > filters;
+	std::vector<T> bias;
+	for ( int c = 0; c < nomChannels; c++ ) {
+		for ( int d = 0; d < depthMultiplier; d++ ) {
+			std::string FilterFileName = Address + "-" + std::to_string( c ) + "_" + std::to_string( d ) + ".txt";
+			std::vector<T> weights = loadFilterWeights<T>( FilterFileName );
+			bias.push_back( weights.back() );
+			weights.pop_back();
+			filters.push_back( weights );
+		}
+	}
+	return std::pair<std::vector<std::vector<T>>, std::vector<T>>( filters, bias );
+}
+
 /// old
 template<class T>
 std::vector<std::vector<T> > loadingFilterWeights( std::string Address, int nomFilters, int nomFiltersPrevLayer,
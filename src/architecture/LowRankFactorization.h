@@ -0,0 +1,159 @@
+/*
+ * LowRankFactorization.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef ARCHITECTURE_LOWRANKFACTORIZATION_H_
+#define ARCHITECTURE_LOWRANKFACTORIZATION_H_
+
+#include <vector>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+/**
+ * @brief Truncated factorization W ~ L R of an m x n matrix with L of size m x rank and R of size rank x n.
+ * Both matrices are stored row major.
+ */
+struct LowRankFactors {
+	size_t rank;
+	std::vector<double> left;
+	std::vector<double> right;
+	double relativeError; // || W - L R ||_F / || W ||_F
+};
+
+/**
+ * @brief Eigen decomposition of the symmetric n x n matrix a (row major) with the cyclic Jacobi method.
+ * On return the eigenvalues are sorted in descending order and column i of vectors belongs to eigenvalue i.
+ */
+inline void symmetricEigen( std::vector<double> a, size_t n, std::vector<double>& values, std::vector<double>& vectors ) {
+	vectors.assign( n * n, 0 );
+	for ( size_t i = 0; i < n; ++i )
+		vectors[ i * n + i ] = 1;
+
+	for ( int sweep = 0; sweep < 100; ++sweep ) {
+		double offDiagonal = 0, diagonal = 0;
+		for ( size_t p = 0; p < n; ++p ) {
+			diagonal += a[ p * n + p ] * a[ p * n + p ];
+			for ( size_t q = p + 1; q < n; ++q )
+				offDiagonal += a[ p * n + q ] * a[ p * n + q ];
+		}
+		if ( offDiagonal <= 1e-30 * diagonal || offDiagonal == 0 )
+			break;
+		for ( size_t p = 0; p < n; ++p ) {
+			for ( size_t q = p + 1; q < n; ++q ) {
+				double apq = a[ p * n + q ];
+				if ( apq == 0 )
+					continue;
+				// rotation that zeroes a[ p, q ]
+				double theta = ( a[ q * n + q ] - a[ p * n + p ] ) / ( 2 * apq );
+				double t = ( theta >= 0 ? 1 : -1 ) / ( std::abs( theta ) + std::sqrt( theta * theta + 1 ) );
+				double c = 1 / std::sqrt( t * t + 1 ), s = t * c;
+				for ( size_t k = 0; k < n; ++k ) { // columns p and q
+					double akp = a[ k * n + p ], akq = a[ k * n + q ];
+					a[ k * n + p ] = c * akp - s * akq;
+					a[ k * n + q ] = s * akp + c * akq;
+				}
+				for ( size_t k = 0; k < n; ++k ) { // rows p and q
+					double apk = a[ p * n + k ], aqk = a[ q * n + k ];
+					a[ p * n + k ] = c * apk - s * aqk;
+					a[ q * n + k ] = s * apk + c * aqk;
+				}
+				for ( size_t k = 0; k < n; ++k ) {
+					double vkp = vectors[ k * n + p ], vkq = vectors[ k * n + q ];
+					vectors[ k * n + p ] = c * vkp - s * vkq;
+					vectors[ k * n + q ] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+
+	std::vector<size_t> order( n );
+	std::iota( order.begin(), order.end(), 0 );
+	std::sort( order.begin(), order.end(), [&a,n]( size_t i, size_t j ) { return a[ i * n + i ] > a[ j * n + j ]; } );
+	std::vector<double> sortedVectors( n * n );
+	values.resize( n );
+	for ( size_t i = 0; i < n; ++i ) {
+		values[ i ] = a[ order[ i ] * n + order[ i ] ];
+		for ( size_t k = 0; k < n; ++k )
+			sortedVectors[ k * n + i ] = vectors[ k * n + order[ i ] ];
+	}
+	vectors = sortedVectors;
+}
+
+/**
+ * @brief Finds the smallest rank whose truncated SVD of the m x n matrix w (row major) has a relative
+ * Frobenius error of at most maxRelativeError and returns the factors.
+ *
+ * The singular vectors come from the eigen decomposition of the Gram matrix of the smaller side. With the
+ * leading eigenvectors Q of W W^T (m <= n) the factors are L = Q and R = Q^T W, with the leading
+ * eigenvectors of W^T W they are L = W Q and R = Q^T. The squared error is the sum of the dropped eigenvalues.
+ */
+inline LowRankFactors lowRankFactorization( const std::vector<double>& w, size_t m, size_t n, double maxRelativeError ) {
+	bool leftGram = m <= n;
+	size_t k = std::min( m, n );
+	std::vector<double> gram( k * k, 0 );
+	for ( size_t i = 0; i < k; ++i ) {
+		for ( size_t j = i; j < k; ++j ) {
+			double sum = 0;
+			if ( leftGram )
+				for ( size_t l = 0; l < n; ++l )
+					sum += w[ i * n + l ] * w[ j * n + l ];
+			else
+				for ( size_t l = 0; l < m; ++l )
+					sum += w[ l * n + i ] * w[ l * n + j ];
+			gram[ i * k + j ] = gram[ j * k + i ] = sum;
+		}
+	}
+	std::vector<double> values, vectors;
+	symmetricEigen( gram, k, values, vectors );
+
+	double total = 0;
+	for ( double v : values )
+		total += std::max( v, 0. );
+	LowRankFactors factors;
+	factors.rank = k;
+	factors.relativeError = 0;
+	double dropped = 0;
+	for ( size_t r = k; r > 0; --r ) { // drop the smallest singular values as long as the error allows it
+		double error = total > 0 ? std::sqrt( ( dropped + std::max( values[ r - 1 ], 0. ) ) / total ) : 0;
+		if ( error > maxRelativeError )
+			break;
+		dropped += std::max( values[ r - 1 ], 0. );
+		factors.rank = r - 1;
+		factors.relativeError = error;
+	}
+	if ( factors.rank == 0 ) // keep at least one component so both factors are proper matrices
+		factors.rank = 1;
+	size_t rank = factors.rank;
+
+	factors.left.assign( m * rank, 0 );
+	factors.right.assign( rank * n, 0 );
+	for ( size_t r = 0; r < rank; ++r ) {
+		if ( leftGram ) {
+			for ( size_t i = 0; i < m; ++i )
+				factors.left[ i * rank + r ] = vectors[ i * k + r ];
+			for ( size_t j = 0; j < n; ++j ) {
+				double sum = 0;
+				for ( size_t i = 0; i < m; ++i )
+					sum += vectors[ i * k + r ] * w[ i * n + j ];
+				factors.right[ r * n + j ] = sum;
+			}
+		} else {
+			for ( size_t j = 0; j < n; ++j )
+				factors.right[ r * n + j ] = vectors[ j * k + r ];
+			for ( size_t i = 0; i < m; ++i ) {
+				double sum = 0;
+				for ( size_t j = 0; j < n; ++j )
+					sum += w[ i * n + j ] * vectors[ j * k + r ];
+				factors.left[ i * rank + r ] = sum;
+			}
+		}
+	}
+	return factors;
+}
+
+
+#endif /* ARCHITECTURE_LOWRANKFACTORIZATION_H_ */
@@ -10,11 +10,15 @@
 
 
 #include <vector>
+#include <algorithm>
 #include <chrono>
 #include <ctime>
+#include <type_traits>
 #include "Layer.h"
 #include "Tensor.h"
 #include "PlainTensor.h"
+#include "LowRankFactorization.h"
+#include "../tools/ThreadPool.h"
 #include "HEBackend/helib/HELIbCipherText.h"
 
 //TODO: have it do something
@@ -22,7 +26,15 @@ enum MemoryUsage {
 	lazy = 1,
 	greedy = 2,
 	free_after_use = 4,
-	pre_convert_weights = 8,
+	pre_convert_weights = 8, // convert the weights with the WeightConverter, or without one encode them for the backend (Layer::encodeWeights), once instead of in every multiplication
+	fuse_layers = 16, // merge layers into the previous one if it can compute them in its own kernel
+	fold_linear_layers = 32, // compose chains of linear layers into a single dense layer after loading the weights
+	sparse_weights = 64, // keep only the non-zero weights after loading and skip the zeros in the kernels (pruned models)
+	clustered_weights = 128, // group the weights by value after loading and multiply once per distinct weight (quantized models), skips zeros as well
+	factorize_dense = 256, // replace dense layers by two low rank dense layers after loading the weights if the approximation is close enough
+	integer_weights = 512, // scale and round the weights of every layer to integers after loading, multiplications with integers are cheaper for CKKS
+	input_stationary_conv = 1024, // convolutions read every input once for all filters instead of once per filter. Falls back to the filter-outer kernels for fused pooling, sparse, clustered or converted weights, non-square outputs and valid padding whose first window is off the stride (see Convolution2D::useInputStationary)
+	plan_levels = 2048, // run every layer on a copy of its input switched down to the lowest level of the modulus chain the remaining layers need (see planLevels)
 
 };
 
@@ -42,10 +54,6 @@ public:
 
 	Model( MemoryUsage usage, TensorFactory<ValueType>* dtf, TensorFactory<WeightType	>* wtf, WeightConverter<WeightType,ConvertType>* weightConverter )
 		: mLayers( { } ), mUsage( usage ), mDataFactory( dtf ), mWeightFactory( wtf ), mWeightConverter( weightConverter ) {
-		if( (usage & MemoryUsage::pre_convert_weights) && weightConverter == nullptr ){
-			std::cerr << "Can not create with with pre weight conversion and no converter" << std::endl;
-			std::exit( 1 );
-		}
 	}
 
 	Model( MemoryUsage usage, TensorFactory<ValueType>* dtf, TensorFactory<WeightType>* wtf )
@@ -62,6 +70,20 @@ public:
 			layer->mDataTensorFactory = mDataFactory;
 		if( layer->mWeigthTensorFactory == nullptr )
 			layer->mWeigthTensorFactory = mWeightFactory;
+
+		// fusion pass: let the previous layer absorb this one. This saves the intermediate tensor
+		if ( !mLayers.empty() && ( mUsage & MemoryUsage::fuse_layers ) && mLayers.back()->fuse( layer ) ) {
+			auto previous = mLayers.back();
+			Shape outputShape = previous->outputShape(); // @suppress("Invalid arguments")
+			std::cout << layer->name() << " fused into " << previous->name() << "   " << outputShape << std::endl;
+			if ( previous->output()->shape != outputShape ) {
+				previous->output( mDataFactory->create( outputShape ) );
+				if ( ( mUsage & MemoryUsage::greedy ) )
+					previous->output()->init();
+			}
+			return;
+		}
+
 		if ( !mLayers.empty() ) { //first layer needs to init output
 			TensorP<ValueType> outputPrev = mLayers.back()->output();
 			layer->input( outputPrev );
@@ -74,6 +96,12 @@ public:
 			std::cout << layer->name() << "   " << temp << std::endl;
 		}
 
+		if ( mUsage & MemoryUsage::input_stationary_conv ) {
+			auto conv = std::dynamic_pointer_cast<Convolution2D<ValueType, WeightType, DataTensorType, WeightTensorType>>( layer );
+			if ( conv )
+				conv->inputStationary( true );
+		}
+
 		// if the layer needs some extra setup
 		layer->setup();
 
@@ -82,12 +110,7 @@ public:
 		if ( ( mUsage & MemoryUsage::greedy ) ) { // greedy memory allocation
 			layer->input()->init();
 			layer->output()->init();
-			if ( ( mUsage & MemoryUsage::pre_convert_weights ) ){
-				std::vector<TensorP<ConvertType>> c;
-				for( auto tensor : layer->allWeights() )
-					c.push_back( mWeightConverter->convert( tensor ) );
-				layer->convertedWeights( c );
-			}
+			// the weights get pre-converted once they are loaded
 		} else { //lazy TODO (get it?? because it is lazy??:
 
 		}
@@ -104,17 +127,25 @@ public:
 		//ensure we have at least 1 layer
 		assert( mLayers.size() > 0 );
 
+		std::vector<long> levels;
+		if ( mUsage & MemoryUsage::plan_levels )
+			levels = planLevels();
+
 		//traverse through layers and feeds forward
-		for ( auto layer : mLayers ) {
+		for ( uint i = 0; i < mLayers.size(); ++i ) {
+			auto layer = mLayers[ i ];
 			std::cout << layer->name() << std::flush;
 			auto startLayer = std::chrono::system_clock::now();
-			if ( (mUsage & MemoryUsage::pre_convert_weights) && (mUsage & MemoryUsage::lazy) ){
-				std::vector<TensorP<ConvertType>> c;
-				for( auto tensor : layer->allWeights() )
-					c.push_back( mWeightConverter->convert( tensor ) );
-				layer->convertedWeights( c );
+			if ( (mUsage & MemoryUsage::pre_convert_weights) && (mUsage & MemoryUsage::lazy) )
+				convertWeights( layer );
+			TensorP<ValueType> input = layer->input();
+			if ( !levels.empty() ) { // the layer runs on a switched copy, the input itself keeps its level
+				TensorP<ValueType> switched = input->modDownToLevel( levels[ i ] );
+				if ( switched )
+					layer->input( switched );
 			}
 			layer->feedForward();
+			layer->input( input );
 			auto endLayer = std::chrono::system_clock::now();
 			std::chrono::duration<double> elapsed_seconds_layer = endLayer - startLayer;
 			std::cout << " " << elapsed_seconds_layer.count() << "s" << std::endl;
@@ -258,24 +289,297 @@ public:
 	void loadWeights( std::string path, std::vector<std::string> names =
 			std::vector<std::string>() ) {
 		uint i = 0;
-		std::thread tt[ mLayers.size() ];
+		TaskGroup loading;
 		auto start = std::chrono::system_clock::now();
 		for ( auto layer : mLayers ) {
 			std::cout << "loading weights for" << layer->name() << std::endl;
 
 			if ( names.empty() ) {
-				tt[ i ] = std::thread( [=] {layer->loadWeights( path );} );
+				loading.run( [=] {layer->loadWeights( path );} );
 			} else {
-				tt[ i ] = std::thread( [=] {layer->loadWeights( path, names[i] );} );
+				loading.run( [=] {layer->loadWeights( path, names[i] );} );
 			}
 			i++;
 		}
-		for ( uint j = 0; j < mLayers.size(); ++j )
-			tt[ j ].join();
+		loading.wait();
 		auto end = std::chrono::system_clock::now();
 		std::chrono::duration<double> elapsed_seconds = end - start;
 		std::cout << "loading weights took: " << elapsed_seconds.count() << "s" << std::endl;
 
+		foldBatchNormalization();
+		if ( mUsage & MemoryUsage::fold_linear_layers )
+			foldLinearLayers();
+		if ( mUsage & MemoryUsage::factorize_dense )
+			factorizeDense();
+		if ( mUsage & MemoryUsage::integer_weights )
+			integerizeWeights();
+		if ( mUsage & MemoryUsage::clustered_weights )
+			clusterWeights();
+		else if ( mUsage & MemoryUsage::sparse_weights )
+			for ( auto layer : mLayers )
+				layer->sparsify();
+		preConvertWeights();
+	}
+
+	/**
+	 * @brief Converts or encodes the weights of every layer if the model pre-converts weights greedily. Gets called by
+	 * loadWeights, call it after setting the weights of the layers by hand.
+	 */
+	void preConvertWeights() {
+		for ( auto layer : mLayers )
+			preConvertWeights( layer );
+	}
+
+	/**
+	 * @brief Computes for every layer the multiplicative depth its input still has to go through: the depth of the
+	 * layer and of all following ones (see Layer::multiplicativeDepth()) plus levelMargin() for the decryption. The
+	 * first entry is the depth of the whole model.
+	 */
+	std::vector<long> planDepths() {
+		std::vector<long> depths( mLayers.size() );
+		long needed = mLevelMargin;
+		for ( long i = (long) mLayers.size() - 1; i >= 0; --i ) {
+			needed += mLayers[ i ]->multiplicativeDepth();
+			depths[ i ] = needed;
+		}
+		return depths;
+	}
+
+	/**
+	 * @brief Computes for every layer the level of the modulus chain its input needs, the depth from planDepths()
+	 * converted by the input tensor of the layer (see Tensor::levelsForDepth()). For HElib these are primes of the
+	 * chain, for plain tensors the depth. The first entry is the level a fresh input has to have at least. With
+	 * MemoryUsage::plan_levels run() feeds every layer a copy of its input switched down to its level, so the early
+	 * layers work on ciphertexts with fewer primes instead of the whole chain.
+	 */
+	std::vector<long> planLevels() {
+		std::vector<long> levels = planDepths();
+		for ( size_t i = 0; i < mLayers.size(); ++i )
+			levels[ i ] = mLayers[ i ]->input()->levelsForDepth( levels[ i ] );
+		return levels;
+	}
+
+	/**
+	 * @brief Multiplications worth of modulus planDepths() keeps on top of the layers, so the decryption still has
+	 * the bits of a multiplication (the precision and the noise headroom) above the values. It gets converted to
+	 * levels along with the depth of the layers.
+	 */
+	long levelMargin() const {
+		return mLevelMargin;
+	}
+
+	void levelMargin( long margin ) {
+		mLevelMargin = margin;
+	}
+
+	/**
+	 * @brief Groups the weights of every layer by value, see Layer::cluster(). With a codebookSize other
+	 * than 0 the weights of each layer get quantized to that many values first, which changes the model.
+	 */
+	void clusterWeights( size_t codebookSize = 0 ) {
+		for ( auto layer : mLayers )
+			layer->cluster( codebookSize );
+	}
+
+	/**
+	 * @brief Folds every BatchNormalization layer that directly follows a Convolution2D, DepthwiseConvolution2D
+	 * or Dense layer with linear activation into the weights and biases of that layer and removes it from the model.
+	 * Gets called by loadWeights.
+	 */
+	void foldBatchNormalization() {
+		for ( uint i = 1; i < mLayers.size(); ++i ) {
+			auto bn = std::dynamic_pointer_cast<BatchNormalization<ValueType, WeightType, DataTensorType, WeightTensorType>>( mLayers[ i ] );
+			auto previous = mLayers[ i - 1 ];
+			if ( !bn || !std::dynamic_pointer_cast<LinearActivation<ValueType>>( previous->activation() ) )
+				continue;
+			if ( !std::dynamic_pointer_cast<Convolution2D<ValueType, WeightType, DataTensorType, WeightTensorType>>( previous )
+					&& !std::dynamic_pointer_cast<DepthwiseConvolution2D<ValueType, WeightType, DataTensorType, WeightTensorType>>( previous )
+					&& !std::dynamic_pointer_cast<Dense<ValueType, WeightType, DataTensorType, WeightTensorType>>( previous ) )
+				continue;
+			bn->foldInto( previous );
+			preConvertWeights( previous ); // the weights changed in place
+			// the output of bn is a view of the output of previous. The next layer can keep using it
+			std::cout << "folded " << bn->name() << " into " << previous->name() << std::endl;
+			mLayers.erase( mLayers.begin() + i );
+			--i;
+		}
+	}
+
+	/**
+	 * @brief Composes chains of layers that compute an affine map into a single Dense layer.
+	 *
+	 * A chain ends in a Dense layer and is made up of (depthwise) convolutions and Dense layers with a linear
+	 * activation, AveragePooling, GlobalAveragePooling2D, ZeroPadding2D and Flatten. The activation of the closing Dense layer is
+	 * kept. The combined weights get computed by running plaintext copies of the layers on the unit
+	 * vectors. If the input of the chain is not flat a Flatten view is put in front of the new layer.
+	 *
+	 * This saves multiplicative depth since the whole chain now needs a single multiplication with a constant.
+	 * A chain is only folded if the new layer needs at most maxWorkFactor times the multiplications
+	 * of the chain. Needs floating point weights, since averages can not be represented otherwise.
+	 */
+	void foldLinearLayers( double maxWorkFactor = 1. ) {
+		if ( !std::is_floating_point<WeightType>::value ) {
+			std::cerr << "folding linear layers needs floating point weights. Nothing folded" << std::endl;
+			return;
+		}
+		uint end = 0;
+		while ( end < mLayers.size() ) {
+			if ( !std::dynamic_pointer_cast<Dense<ValueType, WeightType, DataTensorType, WeightTensorType>>( mLayers[ end ] )
+					|| !mLayers[ end ]->linearTwin() ) {
+				++end;
+				continue;
+			}
+			uint start = end;
+			while ( start > 0 && isLinear( mLayers[ start - 1 ] ) )
+				--start;
+			// folding a dense layer with nothing or just a flatten in front of it gains nothing
+			uint computingLayers = 0;
+			unsigned long multiplications = 0;
+			for ( uint i = start; i <= end; ++i ) {
+				if ( !std::dynamic_pointer_cast<Flatten<ValueType, WeightType, DataTensorType, WeightTensorType>>( mLayers[ i ] ) )
+					++computingLayers;
+				multiplications += mLayers[ i ]->multiplications();
+			}
+			TensorP<ValueType> in = mLayers[ start ]->input();
+			unsigned long foldedMultiplications = mLayers[ end ]->output()->shape[ 1 ] * in->shape.capacity() / in->shape[ 0 ];
+			if ( computingLayers < 2 || foldedMultiplications > maxWorkFactor * multiplications ) {
+				++end;
+				continue;
+			}
+			end = foldLayers( start, end );
+			std::cout << "multiplications per instance: " << multiplications << " -> " << foldedMultiplications << std::endl;
+			++end;
+		}
+	}
+
+	/**
+	 * @brief Integerizes the weights of every layer that supports it with the given number of bits, see
+	 * Layer::integerizeWeights(), and passes the scales on with foldScales(). The output of the model is scaled
+	 * by outputScale() afterwards. Returns the number of integerized layers.
+	 */
+	uint integerizeWeights( uint bits = 12 ) {
+		uint integerized = 0;
+		for ( auto layer : mLayers ) {
+			if ( layer->integerizeWeights( bits ) ) {
+				std::cout << "integerized " << layer->name() << " with scale " << layer->weightScale() << std::endl;
+				++integerized;
+			}
+		}
+		if ( integerized > 0 )
+			foldScales();
+		return integerized;
+	}
+
+	/**
+	 * @brief Passes the scales of integerized weights on to the following layers instead of undoing them in every
+	 * layer, see Layer::scale(). A layer only removes the scale if a later layer can not take a scaled input before
+	 * another layer could remove it, whatever is left scales the output of the model: divide the decrypted (or plain)
+	 * output by outputScale(). Every scale that is not removed saves a multiplication per output and its level. The
+	 * values grow with the scale, the plaintext space (or the precision of CKKS) has to leave room for that.
+	 */
+	void foldScales() {
+		std::vector<bool> undo( mLayers.size(), false );
+		bool unscaled = false; // the layers after i need an input without scale
+		for ( long i = (long) mLayers.size() - 1; i >= 0; --i ) {
+			if ( mLayers[ i ]->removesScale() && ( unscaled || mLayers[ i ]->scaleDegree() == 0 ) ) {
+				undo[ i ] = true;
+				unscaled = false;
+			} else if ( mLayers[ i ]->scaleDegree() == 0 )
+				unscaled = true;
+		}
+		mOutputScale = 1;
+		for ( uint i = 0; i < mLayers.size(); ++i ) {
+			mOutputScale = mLayers[ i ]->scale( mOutputScale, undo[ i ] );
+			preConvertWeights( mLayers[ i ] ); // pre-converted weights would still be the old ones
+		}
+	}
+
+	/**
+	 * @brief The factor the output of the model is scaled with, see foldScales(). 1 unless weights got integerized
+	 */
+	double outputScale() const {
+		return mOutputScale;
+	}
+
+	/**
+	 * @brief Replaces every Dense layer with m x n weights W by two chained Dense layers computing U ( V x ), with U of size
+	 * m x r and V of size r x n taken from the truncated SVD of W. The rank r is the smallest one that keeps the relative
+	 * (Frobenius) error of the weights at or below maxRelativeError. The first layer is linear and has no bias, the second
+	 * one gets the bias and activation of the original layer. A layer is only replaced if r * ( m + n ) < m * n, the
+	 * number of multiplications per instance before and after.
+	 *
+	 * Needs floating point weights. Returns the number of replaced layers.
+	 */
+	uint factorizeDense( double maxRelativeError = 0.01 ) {
+		if ( !std::is_floating_point<WeightType>::value ) {
+			std::cerr << "factorizing dense layers needs floating point weights. Nothing factorized" << std::endl;
+			return 0;
+		}
+		uint factorized = 0;
+		for ( uint i = 0; i < mLayers.size(); ++i ) {
+			auto dense = std::dynamic_pointer_cast<Dense<ValueType, WeightType, DataTensorType, WeightTensorType>>( mLayers[ i ] );
+			if ( !dense || !dense->weights() )
+				continue;
+			TensorP<WeightType> weights = dense->weights();
+			size_t m = weights->shape[ 0 ], n = weights->shape[ 1 ];
+			std::vector<double> w( m * n );
+			for ( size_t j = 0; j < m * n; ++j )
+				w[ j ] = ( *weights )[ (long) j ];
+			LowRankFactors factors = lowRankFactorization( w, m, n, maxRelativeError );
+			if ( factors.rank * ( m + n ) >= m * n )
+				continue;
+
+			size_t r = factors.rank;
+			TensorP<WeightType> vWeights = mWeightFactory->create( Shape { r, n } );
+			TensorP<WeightType> uWeights = mWeightFactory->create( Shape { m, r } );
+			TensorP<WeightType> vBiases = mWeightFactory->create( Shape { r } );
+			vWeights->init();
+			uWeights->init();
+			vBiases->init();
+			for ( size_t j = 0; j < r * n; ++j )
+				( *vWeights )[ (long) j ] = factors.right[ j ];
+			for ( size_t j = 0; j < m * r; ++j )
+				( *uWeights )[ (long) j ] = factors.left[ j ];
+
+			auto v = std::make_shared<Dense<ValueType, WeightType, DataTensorType, WeightTensorType>>( dense->name() + "_v",
+					LinearActivation<ValueType>::getSharedPointer(), r, mDataFactory, mWeightFactory );
+			v->input( dense->input() );
+			v->output( mDataFactory->create( v->outputShape() ) );
+			if ( mUsage & MemoryUsage::greedy )
+				v->output()->init();
+			v->weights( vWeights );
+			v->biases( vBiases );
+			auto u = std::make_shared<Dense<ValueType, WeightType, DataTensorType, WeightTensorType>>( dense->name() + "_u",
+					dense->activation(), m, mDataFactory, mWeightFactory );
+			u->input( v->output() );
+			u->output( dense->output() ); // the following layer keeps its input
+			u->weights( uWeights );
+			u->biases( dense->biases() );
+			preConvertWeights( v );
+			preConvertWeights( u );
+
+			std::cout << "factorized " << dense->name() << " with rank " << r << " (relative error " << factors.relativeError
+					<< "), multiplications per instance: " << m * n << " -> " << r * ( m + n ) << std::endl;
+			mLayers[ i ] = v;
+			mLayers.insert( mLayers.begin() + i + 1, u );
+			++i;
+			++factorized;
+		}
+		return factorized;
+	}
+
+	/**
+	 * @brief Factorizes the dense layers like factorizeDense( maxRelativeError ) and reports the accuracy on the
+	 * calibration set X, Y before and after. Returns the change in accuracy.
+	 */
+	template<class InType, class LabelType>
+	float factorizeDense( double maxRelativeError, std::vector<std::vector<InType>>& X, std::vector<LabelType>& Y ) {
+		float before = evaluate( X, Y );
+		if ( factorizeDense( maxRelativeError ) == 0 )
+			return 0;
+		float after = evaluate( X, Y );
+		std::cout << "calibration accuracy after factorizing dense layers: " << before << " -> " << after << std::endl;
+		return after - before;
 	}
 
 	/**
@@ -300,9 +604,136 @@ public:
 
 	std::vector<LayerP<ValueType, WeightType, DataTensorType, WeightTensorType>> mLayers; //FIXME only here for debuggin
 private:
+
+	/**
+	 * @brief True if the layer computes an affine map without a nonlinear activation
+	 */
+	bool isLinear( LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> layer ) {
+		return std::dynamic_pointer_cast<LinearActivation<ValueType>>( layer->activation() ) && layer->linearTwin();
+	}
+
+	/**
+	 * @brief Converts the weights of a layer whose weights are new or changed, in case the model pre-converts
+	 * weights greedily.
+	 */
+	void preConvertWeights( LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> layer ) {
+		if ( ( mUsage & MemoryUsage::pre_convert_weights ) && ( mUsage & MemoryUsage::greedy ) )
+			convertWeights( layer );
+	}
+
+	/**
+	 * @brief Hands the layer its weights converted by the WeightConverter, or encoded for the backend if the model
+	 * has no converter. Layers without weights are skipped.
+	 */
+	void convertWeights( LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> layer ) {
+		if ( !mWeightConverter ) {
+			layer->encodeWeights();
+			return;
+		}
+		std::vector<TensorP<WeightType>> weights = layer->allWeights();
+		if ( weights.empty() || std::find( weights.begin(), weights.end(), nullptr ) != weights.end() )
+			return;
+		std::vector<TensorP<ConvertType>> c;
+		for( auto tensor : weights )
+			c.push_back( mWeightConverter->convert( tensor ) );
+		layer->convertedWeights( c );
+	}
+
+	/**
+	 * @brief Replaces the layers from start to end (inclusive) by a single dense layer. Returns the index
+	 * of the new layer.
+	 */
+	uint foldLayers( uint start, uint end ) {
+		auto last = mLayers[ end ];
+		TensorP<ValueType> in = mLayers[ start ]->input();
+		auto weightsAndBiases = composeAffineMap( start, end );
+
+		std::cout << "folding";
+		for ( uint i = start; i <= end; ++i )
+			std::cout << " " << mLayers[ i ]->name();
+		std::cout << std::endl;
+
+		std::vector<LayerP<ValueType, WeightType, DataTensorType, WeightTensorType>> folded;
+		if ( in->shape.size != 2 ) {
+			auto flatten = std::make_shared<Flatten<ValueType, WeightType, DataTensorType, WeightTensorType>>( last->name() + "_flatten", mDataFactory, mWeightFactory );
+			flatten->input( in );
+			flatten->buildsOwnOutputTensor();
+			in = flatten->output();
+			folded.push_back( flatten );
+		}
+		auto dense = std::make_shared<Dense<ValueType, WeightType, DataTensorType, WeightTensorType>>( last->name() + "_folded",
+				last->activation(), last->output()->shape[ 1 ], mDataFactory, mWeightFactory );
+		dense->input( in );
+		dense->output( last->output() ); // the following layer keeps its input
+		dense->weights( weightsAndBiases.first );
+		dense->biases( weightsAndBiases.second );
+		preConvertWeights( dense );
+		folded.push_back( dense );
+
+		mLayers.erase( mLayers.begin() + start, mLayers.begin() + end + 1 );
+		mLayers.insert( mLayers.begin() + start, folded.begin(), folded.end() );
+		return start + folded.size() - 1;
+	}
+
+	/**
+	 * @brief Computes weights W and biases b such that W x + b is the map that the layers from start to end compute,
+	 * ignoring the activation of the last one. The layers need to provide a linearTwin().
+	 *
+	 * b is the response to the zero vector and column j of W is the response to the unit vector e_j minus b.
+	 * The unit vectors are pushed through plaintext copies of the layers a batch at a time.
+	 */
+	std::pair<TensorP<WeightType>, TensorP<WeightType>> composeAffineMap( uint start, uint end ) {
+		const size_t probeBatch = 128;
+		PlainTensorFactory<WeightType> factory;
+		Shape inShape = mLayers[ start ]->input()->shape;
+		size_t n = inShape.capacity() / inShape[ 0 ];
+		std::vector<size_t> probeDims { probeBatch };
+		for ( uint i = 1; i < inShape.size; ++i )
+			probeDims.push_back( inShape[ i ] );
+
+		Model<WeightType, WeightType, TensorP<WeightType>, TensorP<WeightType>> twins( MemoryUsage::greedy, &factory, &factory );
+		for ( uint i = start; i <= end; ++i ) {
+			auto twin = mLayers[ i ]->linearTwin();
+			if ( i == start ) {
+				twin->input( factory.create( Shape( probeDims ) ) );
+				twin->output( factory.create( twin->outputShape() ) );
+			}
+			twins.addLayer( twin );
+		}
+		TensorP<WeightType> probe = twins.input();
+		TensorP<WeightType> response = twins.output();
+		size_t m = response->shape[ 1 ];
+
+		TensorP<WeightType> weights = mWeightFactory->create( Shape { m, n } );
+		TensorP<WeightType> biases = mWeightFactory->create( Shape { m } );
+		weights->init();
+		biases->init();
+
+		// the response to 0 is the bias
+		twins.clearGraph();
+		for ( auto twin : twins.layers() )
+			twin->feedForward();
+		for ( size_t i = 0; i < m; ++i )
+			( *biases )[ { i } ] = ( *response )[ { 0, i } ];
+
+		for ( size_t from = 0; from < n; from += probeBatch ) {
+			twins.clearGraph();
+			for ( size_t b = 0; b < probeBatch && from + b < n; ++b )
+				( *probe )[ (long) ( b * n + from + b ) ] = 1;
+			for ( auto twin : twins.layers() )
+				twin->feedForward();
+			for ( size_t b = 0; b < probeBatch && from + b < n; ++b )
+				for ( size_t i = 0; i < m; ++i )
+					( *weights )[ { i, from + b } ] = ( *response )[ { b, i } ] - ( *biases )[ { i } ];
+		}
+		return std::make_pair( weights, biases );
+	}
+
 	//need storage stuff here
 	MemoryUsage mUsage; //used to maintain the type of memory usage we want
 	bool built = false;
+	long mLevelMargin = 1; // multiplications planDepths() keeps on top of the depth of the layers
+	double mOutputScale = 1; // the output of the model is scaled by this factor, see foldScales()
 	TensorFactory<ValueType>* mDataFactory;
 	TensorFactory<WeightType>* mWeightFactory;
 	WeightConverter<WeightType,ConvertType>* mWeightConverter;
@@ -0,0 +1,96 @@
+/*
+ * SparseWeights.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef ARCHITECTURE_SPARSEWEIGHTS_H_
+#define ARCHITECTURE_SPARSEWEIGHTS_H_
+
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include "Tensor.h"
+
+/**
+ * @brief Compressed sparse row (CSR) copy of a weight tensor. The tensor is viewed as a matrix with
+ * one row per output unit (neuron, filter, hidden unit) and capacity / rows columns, and only the
+ * non-zero weights are kept. Kernels iterate the non-zeros of their row instead of the full row, so
+ * a pruned model saves one ciphertext multiplication per zero weight.
+ *
+ * The column is the flat offset inside the row of the original tensor. Kernels that work on converted
+ * weights use it to index the converted tensor, which has the same layout.
+ */
+template<class WeightType>
+class SparseWeights {
+public:
+	SparseWeights( TensorP<WeightType> weights, size_t rows ) : mRows( rows ), mRowStart( rows + 1, 0 ) {
+		if ( rows == 0 || weights->shape.capacity() % rows != 0 )
+			throw std::logic_error( "weights can not be split into the requested number of rows" );
+		mRowLength = weights->shape.capacity() / rows;
+		for ( size_t row = 0; row < rows; ++row ) {
+			for ( size_t col = 0; col < mRowLength; ++col ) {
+				WeightType w = ( *weights )[ (long) ( row * mRowLength + col ) ];
+				if ( w == 0 )
+					continue;
+				mColumns.push_back( col );
+				mValues.push_back( w );
+			}
+			mRowStart[ row + 1 ] = mValues.size();
+		}
+	}
+
+	/**
+	 * @brief Index of the first non-zero of row in column() and value()
+	 */
+	size_t rowBegin( size_t row ) const {
+		return mRowStart[ row ];
+	}
+
+	/**
+	 * @brief One past the index of the last non-zero of row
+	 */
+	size_t rowEnd( size_t row ) const {
+		return mRowStart[ row + 1 ];
+	}
+
+	size_t column( size_t idx ) const {
+		return mColumns[ idx ];
+	}
+
+	const WeightType& value( size_t idx ) const {
+		return mValues[ idx ];
+	}
+
+	size_t rows() const {
+		return mRows;
+	}
+
+	size_t rowLength() const {
+		return mRowLength;
+	}
+
+	size_t nonZeros() const {
+		return mValues.size();
+	}
+
+	/**
+	 * @brief Fraction of the weights that are not zero
+	 */
+	double density() const {
+		return mValues.size() / (double) ( mRows * mRowLength );
+	}
+
+private:
+	size_t mRows, mRowLength;
+	std::vector<size_t> mRowStart;
+	std::vector<size_t> mColumns;
+	std::vector<WeightType> mValues;
+};
+
+template<class WeightType>
+using SparseWeightsP = std::shared_ptr<SparseWeights<WeightType>>;
+
+
+#endif /* ARCHITECTURE_SPARSEWEIGHTS_H_ */
@@ -276,6 +276,21 @@ public:
 	 */
 	virtual void performChecks(){}; // default does nothing
 
+	/**
+	 * @brief Copy of the tensor with its ciphertexts switched down to the given level of the modulus chain if they
+	 * are above it, the following operations work on fewer primes then. Does not change the values, the tensor
+	 * itself keeps its level. Returns nullptr if there is nothing to switch, plain tensors always. Model::run()
+	 * feeds the copies to the layers with the levels from Model::planLevels().
+	 */
+	virtual std::shared_ptr<Tensor<ValueType>> modDownToLevel( long level ){ return nullptr; }; // default does nothing
+
+	/**
+	 * @brief Level of the modulus chain a ciphertext needs to go through depth multiplications, in the unit of
+	 * modDownToLevel(). Model::planLevels() converts the depth of the layers with it. Plain tensors count one level
+	 * per multiplication.
+	 */
+	virtual long levelsForDepth( long depth ){ return depth; };
+
 
 	/*
 	 *
@@ -0,0 +1,210 @@
+/*
+ * ThreadPool.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#include "ThreadPool.h"
+#include "Config.h"
+#include <algorithm>
+#include <chrono>
+
+
+namespace {
+	// index of the worker running on this thread, -1 for threads outside of the pool
+	thread_local long tWorkerIdx = -1;
+	// threads the backend uses inside a single operation on this thread
+	thread_local size_t tInnerThreads = 1;
+	// the handler tInnerThreads got reported to, see ThreadPool::mInnerParallelismVersion
+	thread_local long tInnerParallelismVersion = 0;
+}
+
+
+ThreadPool& ThreadPool::getPool() {
+	static ThreadPool pool( [] {
+		long threads = Config::getConfig()->get<long>( "general", "threads" );
+		if ( threads <= 0 )
+			threads = std::max( 1u, std::thread::hardware_concurrency() );
+		return (size_t) threads;
+	}() );
+	return pool;
+}
+
+ThreadPool::ThreadPool( size_t threads ) : mQueued( 0 ), mNextQueue( 0 ), mStop( false ), mInnerParallelismVersion( 0 ) {
+	for ( size_t i = 0; i < threads; ++i )
+		mQueues.emplace_back( new WorkQueue );
+	for ( size_t i = 0; i < threads; ++i )
+		mWorkers.emplace_back( [this, i] {this->work( i );} );
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock( mSleepMutex );
+		mStop = true;
+	}
+	mWakeUp.notify_all();
+	for ( auto& worker : mWorkers )
+		worker.join();
+}
+
+void ThreadPool::submit( Task task ) {
+	size_t idx = tWorkerIdx >= 0 ? tWorkerIdx : mNextQueue++ % mQueues.size();
+	{
+		std::lock_guard<std::mutex> lock( mQueues[ idx ]->mutex );
+		mQueues[ idx ]->tasks.push_back( std::move( task ) );
+	}
+	{
+		std::lock_guard<std::mutex> lock( mSleepMutex );
+		++mQueued;
+	}
+	mWakeUp.notify_one();
+}
+
+bool ThreadPool::pop( size_t idx, Task& task ) {
+	std::lock_guard<std::mutex> lock( mQueues[ idx ]->mutex );
+	if ( mQueues[ idx ]->tasks.empty() )
+		return false;
+	task = std::move( mQueues[ idx ]->tasks.back() );
+	mQueues[ idx ]->tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::steal( size_t thief, Task& task ) {
+	for ( size_t i = 1; i <= mQueues.size(); ++i ) {
+		WorkQueue& victim = *mQueues[ ( thief + i ) % mQueues.size() ];
+		std::lock_guard<std::mutex> lock( victim.mutex );
+		if ( victim.tasks.empty() )
+			continue;
+		task = std::move( victim.tasks.front() );
+		victim.tasks.pop_front();
+		return true;
+	}
+	return false;
+}
+
+bool ThreadPool::runPendingTask() {
+	Task task;
+	bool found = tWorkerIdx >= 0 ? pop( tWorkerIdx, task ) || steal( tWorkerIdx, task ) : steal( 0, task );
+	if ( !found )
+		return false;
+	if ( --mQueued == 0 ) {
+		std::lock_guard<std::mutex> lock( mSleepMutex );
+		mIdle.notify_all();
+	}
+	task();
+	return true;
+}
+
+void ThreadPool::waitForIdle( const std::function<bool()>& stop ) {
+	std::unique_lock<std::mutex> lock( mSleepMutex );
+	mIdle.wait( lock, [this, &stop] {return mQueued <= 0 || stop();} );
+}
+
+void ThreadPool::interruptIdleWaits() {
+	std::lock_guard<std::mutex> lock( mSleepMutex );
+	mIdle.notify_all();
+}
+
+void ThreadPool::work( size_t idx ) {
+	tWorkerIdx = idx;
+	while ( true ) {
+		if ( runPendingTask() )
+			continue;
+		std::unique_lock<std::mutex> lock( mSleepMutex );
+		mWakeUp.wait( lock, [this] {return mStop || mQueued > 0;} );
+		if ( mStop && mQueued <= 0 )
+			return;
+	}
+}
+
+ThreadPool::InnerParallelism ThreadPool::innerParallelism( InnerParallelism handler ) {
+	std::lock_guard<std::mutex> lock( mInnerParallelismMutex );
+	InnerParallelism previous = mInnerParallelism ? *mInnerParallelism : nullptr;
+	mInnerParallelism = handler ? std::make_shared<const InnerParallelism>( handler ) : nullptr;
+	++mInnerParallelismVersion;
+	return previous;
+}
+
+void ThreadPool::useInnerThreads( size_t threads ) {
+	if ( tInnerThreads == threads && tInnerParallelismVersion == mInnerParallelismVersion )
+		return;
+	std::shared_ptr<const InnerParallelism> handler;
+	{
+		std::lock_guard<std::mutex> lock( mInnerParallelismMutex );
+		handler = mInnerParallelism;
+		tInnerParallelismVersion = mInnerParallelismVersion;
+	}
+	if ( handler ) // a copy, a handler registered meanwhile does not pull it away under the call
+		( *handler )( threads );
+	tInnerThreads = threads;
+}
+
+size_t ThreadPool::innerThreads() const {
+	return tInnerThreads;
+}
+
+void ThreadPool::parallelFor( long begin, long end, const std::function<void( long )>& body, long grain, size_t innerThreads ) {
+	if ( end <= begin )
+		return;
+	if ( grain <= 0 )
+		grain = std::max<long>( 1, ( end - begin ) / ( 4 * threads() ) );
+	InnerThreadsScope scope( *this, tInnerThreads ); // restores the calling thread, which runs tasks in wait() as well
+	if ( end - begin <= grain ) {
+		useInnerThreads( innerThreads );
+		for ( long i = begin; i < end; ++i )
+			body( i );
+		return;
+	}
+	TaskGroup group( *this );
+	for ( long from = begin; from < end; from += grain ) {
+		long to = std::min( from + grain, end );
+		group.run( [this, &body, from, to, innerThreads] {
+			useInnerThreads( innerThreads );
+			for ( long i = from; i < to; ++i )
+				body( i );
+		} );
+	}
+	group.wait();
+}
+
+
+TaskGroup::~TaskGroup() {
+	try {
+		wait();
+	} catch ( ... ) {
+		// the error was not collected by the owner, nothing sensible left to do with it
+	}
+}
+
+void TaskGroup::run( std::function<void()> task ) {
+	++mPending;
+	mPool.submit( [this, task] {
+		try {
+			task();
+		} catch ( ... ) {
+			std::lock_guard<std::mutex> lock( mMutex );
+			if ( !mError )
+				mError = std::current_exception();
+		}
+		// notify while holding the lock, the group may be gone as soon as the waiter sees zero
+		std::lock_guard<std::mutex> lock( mMutex );
+		--mPending;
+		mDone.notify_all();
+	} );
+}
+
+void TaskGroup::wait() {
+	while ( mPending > 0 ) {
+		if ( mPool.runPendingTask() )
+			continue;
+		std::unique_lock<std::mutex> lock( mMutex );
+		mDone.wait_for( lock, std::chrono::milliseconds( 1 ), [this] {return mPending == 0;} );
+	}
+	std::lock_guard<std::mutex> lock( mMutex ); // last task has left the group
+	if ( mError ) {
+		std::exception_ptr error = mError;
+		mError = nullptr;
+		std::rethrow_exception( error );
+	}
+}
@@ -0,0 +1,184 @@
+/*
+ * ThreadPool.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#ifndef TOOLS_THREADPOOL_H_
+#define TOOLS_THREADPOOL_H_
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <memory>
+
+/**
+ * @brief Process wide work stealing scheduler. Every worker owns a deque of tasks; it pops its own
+ * tasks from the back and steals from the front of the other deques once its own deque runs dry.
+ * Threads that wait for a TaskGroup execute pending tasks instead of blocking, so groups can be
+ * nested (a task may start and wait for its own group) without exhausting the workers.
+ *
+ * The number of workers is read once from the config (general/threads). A missing or non positive
+ * value uses std::thread::hardware_concurrency(). The worker count is the thread budget of the whole
+ * process: a backend that can parallelize inside a single operation (NTL for HElib) registers an
+ * InnerParallelism handler, and parallelFor() tells every task how many of those inner threads it may
+ * use, so that outer tasks times inner threads stays within the budget.
+ */
+class ThreadPool {
+public:
+	typedef std::function<void()> Task;
+	typedef std::function<void( size_t )> InnerParallelism;
+
+	static ThreadPool& getPool();
+
+	/**
+	 * @brief Calls body( i ) for every i in [ begin, end ) on the pool and returns after all calls
+	 * finished. The range is split into chunks of at least grain indexes; a grain of 0 picks a chunk
+	 * size that gives every worker a few chunks to balance uneven work. The calling thread takes part
+	 * in the work. The first exception thrown by body is rethrown here.
+	 *
+	 * Every thread executing body is set to innerThreads threads inside a single operation first. The
+	 * calling thread gets its previous inner parallelism back before parallelFor returns.
+	 */
+	void parallelFor( long begin, long end, const std::function<void( long )>& body, long grain = 1, size_t innerThreads = 1 );
+
+	/**
+	 * @brief Registers the function that sets the number of threads the backend uses inside a single
+	 * operation on the calling thread and returns the one it replaces (empty if there was none), so it can
+	 * be put back. Every thread tells a newly registered handler its inner thread count on its next task.
+	 */
+	InnerParallelism innerParallelism( InnerParallelism handler );
+
+	/**
+	 * @brief Sets the inner parallelism of the calling thread. The handler is only called if the value
+	 * or the handler changes, backends tend to tear down and rebuild their threads on every call.
+	 */
+	void useInnerThreads( size_t threads );
+
+	/**
+	 * @brief Inner parallelism of the calling thread, see useInnerThreads()
+	 */
+	size_t innerThreads() const;
+
+	/**
+	 * @brief Queues a task. Tasks queued from a worker go to its own deque, other threads spread
+	 * their tasks over all deques.
+	 */
+	void submit( Task task );
+
+	/**
+	 * @brief Runs one pending task on the calling thread if there is one.
+	 * @return false if all deques were empty
+	 */
+	bool runPendingTask();
+
+	size_t threads() const {
+		return mWorkers.size();
+	}
+
+	/**
+	 * @brief Number of queued tasks no thread has picked up yet. Background work can wait for 0 to stay out of the way.
+	 */
+	long pendingTasks() const {
+		return mQueued;
+	}
+
+	/**
+	 * @brief Blocks until no task is queued or stop() returns true, see pendingTasks(). The waiting threads get
+	 * notified when the last queued task is picked up and by interruptIdleWaits(), stop() is checked then.
+	 */
+	void waitForIdle( const std::function<bool()>& stop );
+
+	/**
+	 * @brief Wakes the threads in waitForIdle() so they check their stop condition again
+	 */
+	void interruptIdleWaits();
+
+	~ThreadPool();
+
+	void operator=( ThreadPool const& ) = delete;
+	ThreadPool( ThreadPool const& ) = delete;
+private:
+	explicit ThreadPool( size_t threads );
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> mQueues;
+	std::vector<std::thread> mWorkers;
+	std::mutex mSleepMutex;
+	std::condition_variable mWakeUp;
+	std::condition_variable mIdle; // waits on mSleepMutex as well, see waitForIdle()
+	std::atomic<long> mQueued;
+	std::atomic<size_t> mNextQueue;
+	bool mStop;
+	std::mutex mInnerParallelismMutex; // guards mInnerParallelism, the handler itself gets called outside of it
+	std::shared_ptr<const InnerParallelism> mInnerParallelism;
+	std::atomic<long> mInnerParallelismVersion; // counts the registered handlers
+
+	void work( size_t idx );
+
+	bool pop( size_t idx, Task& task );
+
+	bool steal( size_t thief, Task& task );
+};
+
+/**
+ * @brief Sets the inner parallelism of the calling thread for its lifetime and puts the previous value back
+ * afterwards, so code that runs on the thread later does not keep the budget of a loop.
+ */
+class InnerThreadsScope {
+public:
+	InnerThreadsScope( ThreadPool& pool, size_t threads ) : mPool( pool ), mPrevious( pool.innerThreads() ) {
+		pool.useInnerThreads( threads );
+	}
+
+	~InnerThreadsScope() {
+		mPool.useInnerThreads( mPrevious );
+	}
+
+	InnerThreadsScope( InnerThreadsScope const& ) = delete;
+	void operator=( InnerThreadsScope const& ) = delete;
+private:
+	ThreadPool& mPool;
+	size_t mPrevious;
+};
+
+/**
+ * @brief Set of tasks that can be waited for as a whole. wait() is called by the destructor as well,
+ * exceptions are only rethrown by an explicit wait().
+ */
+class TaskGroup {
+public:
+	explicit TaskGroup( ThreadPool& pool = ThreadPool::getPool() ) : mPool( pool ), mPending( 0 ) {}
+
+	~TaskGroup();
+
+	void run( std::function<void()> task );
+
+	/**
+	 * @brief Blocks until all tasks of the group finished, executing pending tasks of the pool in the
+	 * meantime. Rethrows the first exception a task of the group threw.
+	 */
+	void wait();
+
+	TaskGroup( TaskGroup const& ) = delete;
+	void operator=( TaskGroup const& ) = delete;
+private:
+	ThreadPool& mPool;
+	std::atomic<long> mPending;
+	std::mutex mMutex;
+	std::condition_variable mDone;
+	std::exception_ptr mError;
+};
+
+
+#endif /* TOOLS_THREADPOOL_H_ */
@@ -14,10 +14,15 @@ bool isValidLayerClass( std::string layer ) {
 	//container of all valid
 	std::unordered_map<std::string, bool> validLayers;
 	validLayers [ "Conv2D" ] = true;
+	validLayers [ "DepthwiseConv2D" ] = true;
+	validLayers [ "SeparableConv2D" ] = true;
 	validLayers [ "Dense" ] = true;
 	validLayers [ "Flatten" ] = true;
 	validLayers [ "ZeroPadding2D" ] = true;
 	validLayers [ "SimpleRNN" ] = true;
+	validLayers [ "Activation" ] = true;
+	validLayers [ "BatchNormalization" ] = true;
+	validLayers [ "GlobalAveragePooling2D" ] = true;
 
 	//check if in container
 	if ( validLayers.find( layer ) == validLayers.end() )
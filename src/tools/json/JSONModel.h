@@ -147,6 +147,13 @@ public:
 				//find correct layer usage
 				if ( layerType == "Conv2D" )
 					layer = grabConv2D( layerJson [ "config" ] );
+				else if ( layerType == "DepthwiseConv2D" )
+					layer = grabDepthwiseConv2D( layerJson [ "config" ] );
+				else if ( layerType == "SeparableConv2D" ) {
+					// a separable convolution is a depthwise convolution followed by a pointwise one
+					addLayer( model, grabDepthwiseConv2D( layerJson [ "config" ], true ), input, isFirstKnown );
+					layer = grabPointwiseConv2D( layerJson [ "config" ] );
+				}
 				else if ( layerType == "Flatten" )
 					layer = grabFlatten( layerJson [ "config"]  );
 				else if ( layerType == "Dense" )
@@ -155,21 +162,21 @@ public:
 					layer = grabRNN( layerJson [ "config" ] );
 				else if ( layerType == "AveragePooling2D" )
 					layer = grabAveragePooling( layerJson [ "config" ] );
+				else if ( layerType == "GlobalAveragePooling2D" )
+					layer = grabGlobalAveragePooling( layerJson [ "config" ] );
 				else if ( layerType == "ZeroPadding2D" )
 					layer = grabZeroPadding2D( layerJson [ "config" ] );
+				else if ( layerType == "Activation" )
+					layer = grabActivationLayer( layerJson [ "config" ] );
+				else if ( layerType == "BatchNormalization" )
+					layer = grabBatchNormalization( layerJson [ "config" ] );
 				else if( mSkipUnknown )
 					continue;
 				else
 					throw InvalidLayer( layerType );
 
-				if( isFirstKnown ){
-					layer->input( input );
-					isFirstKnown = false;
-					layer->output( mDtf->create( layer->outputShape() ) );
-				}
-
 				//add layer
-				model.addLayer( layer );
+				addLayer( model, layer, input, isFirstKnown );
 
 		}
 
@@ -191,6 +198,42 @@ public:
 						WeightTensorType>>( name, act, noFilters, filterSize,stride, pad );
 	}
 
+	/**
+	 * @brief Depthwise convolution. For separable convolutions only the depthwise part gets created,
+	 * with the suffix _depthwise and without activation. The bias belongs to the pointwise part.
+	 */
+	LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> grabDepthwiseConv2D( json config, bool separable=false ) {
+		//grab layer attributes
+		std::string name = config[ "name" ];
+		ActivationP<ValueType> act = LinearActivation<ValueType>::getSharedPointer();
+		if ( separable )
+			name += "_depthwise";
+		else
+			act = grabActivation<ValueType>( config[ "activation" ], mActivationMap );
+		int depthMultiplier = config[ "depth_multiplier" ];
+		int filterSize = config[ "kernel_size" ] [ 0 ];
+		int stride = config[ "strides" ] [ 0 ];
+		PADDING_MODE pad = grabPadding( config[ "padding" ] );
+		//is not the first layer in the model
+		return std::make_shared<
+				DepthwiseConvolution2D<ValueType, WeightType, DataTensorType,
+						WeightTensorType>>( name, act, depthMultiplier, filterSize, stride, pad );
+	}
+
+	/**
+	 * @brief The pointwise (1x1) part of a separable convolution. Gets the suffix _pointwise
+	 */
+	LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> grabPointwiseConv2D( json config ) {
+		//grab layer attributes
+		std::string name = config[ "name" ];
+		ActivationP<ValueType> act = grabActivation<ValueType>( config[ "activation" ], mActivationMap );
+		int noFilters = config[ "filters" ];
+		//is not the first layer in the model
+		return std::make_shared<
+				Convolution2D<ValueType, WeightType, DataTensorType,
+						WeightTensorType>>( name + "_pointwise", act, noFilters, 1, 1, PADDING_MODE::VALID );
+	}
+
 	LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> grabDense(	json dense) {
 		//grab layer attributes
 		std::string name = dense [ "name" ];
@@ -228,6 +271,34 @@ public:
 						WeightTensorType>>( name, filterSize,stride, pad );
 	}
 
+	LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> grabActivationLayer( json config) {
+		//grab layer attributes
+		std::string name = config[ "name" ];
+		ActivationP<ValueType> act = grabActivation<ValueType>(	config[ "activation" ], mActivationMap );
+		//is not the first layer in the model
+		return std::make_shared<ActivationLayer<ValueType, WeightType, DataTensorType,
+						WeightTensorType>>( name, act );
+	}
+
+	LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> grabBatchNormalization( json config) {
+		//grab layer attributes
+		std::string name = config[ "name" ];
+		float epsilon = config[ "epsilon" ];
+		// keras normalizes the last axis (channels last). Our tensors are channels first, which
+		// makes this dimension 1 for images as well as for dense outputs
+		//is not the first layer in the model
+		return std::make_shared<BatchNormalization<ValueType, WeightType, DataTensorType,
+						WeightTensorType>>( name, epsilon );
+	}
+
+	LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> grabGlobalAveragePooling( json config) {
+		//grab layer attribute
+		std::string name = config[ "name" ];
+		//is not the first layer in the model
+		return std::make_shared<GlobalAveragePooling2D<ValueType, WeightType, DataTensorType,
+						WeightTensorType>>( name );
+	}
+
 	LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> grabRNN( json config) {
 		//grab layer attributes
 		std::string name = config[ "name" ];
@@ -259,6 +330,16 @@ private:
 
 
 
+	void addLayer( Model<ValueType, WeightType, DataTensorType, WeightTensorType>& model, LayerP<ValueType, WeightType, DataTensorType, WeightTensorType> layer,
+			TensorP<ValueType> input, bool& isFirstKnown ) {
+		if( isFirstKnown ){
+			layer->input( input );
+			isFirstKnown = false;
+			layer->output( mDtf->create( layer->outputShape() ) );
+		}
+		model.addLayer( layer );
+	}
+
 	TensorP<ValueType> grabInputTensor( json config, std::string layerType = "", int batchSize=1 ) {
 		//grab input shape and 'clean' since shapes in keras can be null, we convert them to 1 to avoid issues
 		std::vector<size_t> shapeVector;
@@ -16,6 +16,7 @@
 #include "../src/architecture/ActivationFunction.h"
 #include "../src/architecture/Layer.h"
 #include "../src/architecture/PlainTensor.h"
+#include "../src/architecture/Model.h"
 #include "TestCommons.h"
 
 extern std::vector<std::vector<std::vector<long>>> loadConvLayerOutput( std::string filename, int batchSize, int depth,
@@ -115,6 +116,10 @@ bool convMultipleChannelsMultipleFiltersRangeSameEvenTest1();
 
 bool convMultipleChannelsMultipleFiltersRangeSameOddTest1();
 
+bool inputStationaryConvTest1();
+
+bool encodedWeightsConvTest1();
+
 // valid padding
 template<class T>
 bool executeConvTestValid( std::string funcName,
@@ -179,4 +184,20 @@ bool flattenImages();
 
 bool convTest_validPad_secondLayer_cryptonet();
 
+// depthwise convolutions
+bool depthwiseConvTest1_validPad();
+bool depthwiseConvTest2_samePad();
+bool separableConvTest1();
+
+// sparse weights
+bool sparseConvTest1_validPad();
+bool sparseConvTest2_samePad();
+bool clusteredConvTest1_samePad();
+
+// integer weights
+bool integerWeightsConvTest1_validPad();
+
+// compile time specialized kernels
+bool fixedConvKernelTest1();
+
 #endif /* TEST_CONVTEST_H_ */
@@ -1019,6 +1019,95 @@ bool convMultipleChannelsMultipleFiltersRangeSameOddTest1() {
 	return finishTest( layer.output(), expectedOutput, __func__ );
 }
 
+/**
+ * The input stationary schedule against the default one for several filter sizes, strides and both
+ * padding modes. More threads than output rows for the small outputs, so some bands are empty.
+ */
+bool inputStationaryConvTest1() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> input = factory.range( Shape( { 2, 3, 8, 8 } ) );
+	for ( uint filterSize : { 2, 3, 5 } ) {
+		for ( uint stride : { 1, 2 } ) {
+			for ( PADDING_MODE pad : { PADDING_MODE::SAME, PADDING_MODE::VALID } ) {
+				TensorP<float> weights = factory.create( Shape( { 4, 3, filterSize, filterSize } ) );
+				weights->init();
+				for ( long i = 0; i < (long) weights->shape.capacity(); ++i )
+					( *weights )[ i ] = i % 5 - 2.f;
+				TensorP<float> biases = factory.range( Shape( { 4 } ) );
+				std::vector<TensorP<float>> outputs;
+				for ( bool inputStationary : { false, true } ) {
+					Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> layer( "test", SquareActivation<float>::getSharedPointer(), 4,
+							filterSize, stride, pad, input, &factory, &factory );
+					layer.output()->init();
+					layer.weights( weights );
+					layer.biases( biases );
+					layer.inputStationary( inputStationary );
+					layer.feedForward();
+					outputs.push_back( layer.output() );
+				}
+				std::string name = std::string( __func__ ) + " " + std::to_string( filterSize ) + "x" + std::to_string( filterSize )
+						+ " stride " + std::to_string( stride ) + ( pad == PADDING_MODE::SAME ? " same" : " valid" );
+				if ( !finishTest( outputs[ 1 ], outputs[ 0 ], name ) )
+					return false;
+			}
+		}
+	}
+	return true;
+}
 
-
-
+/**
+ * Encoded and pre-converted weights against the plain weights, for the generic and the fixed kernels, sparse,
+ * clustered and integerized weights. Plain values use the weights as their encoding, so the outputs have to match.
+ */
+bool encodedWeightsConvTest1() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> input = factory.range( Shape( { 2, 3, 7, 7 } ) );
+	for ( uint filterSize : { 3, 4 } ) {
+		for ( PADDING_MODE pad : { PADDING_MODE::SAME, PADDING_MODE::VALID } ) {
+			for ( std::string variant : { "dense", "sparse", "clustered", "integer" } ) {
+				TensorP<float> weights = factory.create( Shape( { 4, 3, filterSize, filterSize } ) );
+				weights->init();
+				for ( long i = 0; i < (long) weights->shape.capacity(); ++i )
+					( *weights )[ i ] = i % 3 == 0 ? 0.f : i % 5 - 2.f;
+				TensorP<float> biases = factory.range( Shape( { 4 } ) );
+				std::vector<TensorP<float>> outputs;
+				for ( std::string weightForm : { "plain", "encoded", "converted" } ) {
+					Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> layer( "test", SquareActivation<float>::getSharedPointer(), 4,
+							filterSize, 1, pad, input, &factory, &factory );
+					layer.output()->init();
+					layer.weights( weights );
+					layer.biases( biases );
+					if ( variant == "sparse" )
+						layer.sparsify();
+					else if ( variant == "clustered" )
+						layer.cluster();
+					else if ( variant == "integer" )
+						layer.integerizeWeights( 8 );
+					if ( weightForm == "encoded" && ( !layer.encodeWeights() || !layer.weightsEncoded() ) ) {
+						std::cout << "FAILED: weights did not get encoded" << std::endl;
+						return false;
+					}
+					if ( weightForm == "converted" ) {
+						std::vector<TensorP<float>> converted;
+						for ( auto tensor : layer.allWeights() ) {
+							converted.push_back( factory.create( tensor->shape ) );
+							converted.back()->init();
+							for ( long i = 0; i < (long) tensor->shape.capacity(); ++i )
+								( *converted.back() )[ i ] = ( *tensor )[ i ];
+						}
+						layer.convertedWeights( converted );
+					}
+					layer.feedForward();
+					outputs.push_back( layer.output() );
+				}
+				std::string name = std::string( __func__ ) + " " + std::to_string( filterSize ) + "x" + std::to_string( filterSize )
+						+ ( pad == PADDING_MODE::SAME ? " same " : " valid " ) + variant;
+				if ( !finishTest( outputs[ 1 ], outputs[ 0 ], name + " encoded" ) || !finishTest( outputs[ 2 ], outputs[ 1 ], name + " converted" ) )
+					return false;
+			}
+		}
+	}
+	return true;
+}
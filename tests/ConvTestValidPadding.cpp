@@ -621,42 +621,151 @@ bool convTest_validPad_secondLayer_cryptonet() {
 	return false; //finishTest( secondLayer->output(), refFilterTensor, __func__ );
 }
 
+/**
+ * Runs a convolution with pruned weights once dense and once sparsified. Only every third
+ * weight is not zero, so the outputs have to match while the multiplications drop to a third.
+ */
+bool executeSparseConvTest( std::string funcName, uint stride, PADDING_MODE pad ) {
+	PlainTensorFactory<float> factory;
+	TensorP<float> input = factory.range( Shape( { 2, 3, 7, 7 } ) );
+	TensorP<float> weights = factory.create( Shape( { 4, 3, 3, 3 } ) );
+	weights->init();
+	for ( size_t i = 0; i < weights->shape.capacity(); ++i )
+		( *weights )[ (long) i ] = i % 3 == 0 ? i + 1 : 0;
+	TensorP<float> biases = factory.range( Shape( { 4 } ) );
+
+	std::vector<TensorP<float>> outputs;
+	std::vector<unsigned long> multiplications;
+	for ( bool sparse : { false, true } ) {
+		Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> layer( "test", SquareActivation<float>::getSharedPointer(), 4,
+				3, stride, pad, input, &factory, &factory );
+		layer.output()->init();
+		layer.weights( weights );
+		layer.biases( biases );
+		if ( sparse )
+			layer.sparsify();
+		layer.feedForward();
+		outputs.push_back( layer.output() );
+		multiplications.push_back( layer.multiplications() );
+	}
+	if ( multiplications[ 1 ] * 3 != multiplications[ 0 ] ) {
+		std::cout << "sparse layer reports " << multiplications[ 1 ] << " of " << multiplications[ 0 ] << " multiplications" << std::endl;
+		return false;
+	}
+	return finishTest( outputs[ 1 ], outputs[ 0 ], funcName );
+}
 
+bool sparseConvTest1_validPad() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	return executeSparseConvTest( __func__, 1, PADDING_MODE::VALID );
+}
 
+bool sparseConvTest2_samePad() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	return executeSparseConvTest( __func__, 2, PADDING_MODE::SAME );
+}
 
+/**
+ * Quantizes the weights of a convolution to 4 values and runs it once clustered and once
+ * with the quantized weights as they are. Same padding, so some groups lie partly in the padding.
+ */
+bool clusteredConvTest1_samePad() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> input = factory.range( Shape( { 2, 3, 6, 6 } ) );
+	TensorP<float> weights = factory.range( Shape( { 4, 3, 3, 3 } ) );
+	TensorP<float> biases = factory.range( Shape( { 4 } ) );
+
+	Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> clustered( "clustered", SquareActivation<float>::getSharedPointer(), 4,
+			3, 1, PADDING_MODE::SAME, input, &factory, &factory );
+	clustered.output()->init();
+	clustered.weights( weights );
+	clustered.biases( biases );
+	clustered.cluster( 4 );
+	clustered.feedForward();
+	if ( clustered.clusteredWeights()->codebook().size() > 4 || clustered.multiplications() > 36 * 4 * 4 ) {
+		std::cout << "weights did not get clustered" << std::endl;
+		return false;
+	}
 
+	Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> layer( "test", SquareActivation<float>::getSharedPointer(), 4,
+			3, 1, PADDING_MODE::SAME, input, &factory, &factory );
+	layer.output()->init();
+	layer.weights( weights ); // quantized in place by cluster()
+	layer.biases( biases );
+	layer.feedForward();
 
+	return finishTest( clustered.output(), layer.output(), __func__ );
+}
 
+/**
+ * Integer weights for a convolution. Weights are multiples of 1/4 up to 31/4, so with 5 bits the scale
+ * is 4 and there is no rounding error. Also checks that the sparse copy gets rebuilt.
+ */
+bool integerWeightsConvTest1_validPad() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> input = factory.range( Shape( { 2, 3, 6, 6 } ) );
+	TensorP<float> weights = factory.create( Shape( { 4, 3, 3, 3 } ) );
+	weights->init();
+	for ( long i = 0; i < (long) weights->shape.capacity(); ++i )
+		( *weights )[ i ] = ( ( i * 5 ) % 63 - 31 ) / 4.f;
+	TensorP<float> biases = factory.range( Shape( { 4 } ) );
+
+	std::vector<TensorP<float>> outputs;
+	for ( bool integerize : { false, true } ) {
+		Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> layer( "test", SquareActivation<float>::getSharedPointer(), 4,
+				3, 1, PADDING_MODE::VALID, input, &factory, &factory );
+		layer.output()->init();
+		layer.weights( weights );
+		layer.biases( biases );
+		if ( integerize ) {
+			layer.sparsify();
+			if ( !layer.integerizeWeights( 5 ) || layer.weightScale() != 4 || layer.sparseWeights()->value( 0 ) != -31 ) {
+				std::cout << "weights did not get integerized with scale 4" << std::endl;
+				return false;
+			}
+		}
+		layer.feedForward();
+		outputs.push_back( layer.output() );
+	}
+	return finishTest( outputs[ 1 ], outputs[ 0 ], __func__ );
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+/**
+ * The kernels specialized for 3x3 and 5x5 filters with stride 1 and 2 against the per pixel kernel,
+ * which gets picked for sparsified layers (none of the weights is zero here).
+ */
+bool fixedConvKernelTest1() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> input = factory.range( Shape( { 2, 2, 7, 7 } ) );
+	for ( uint filterSize : { 3, 5 } ) {
+		for ( uint stride : { 1, 2 } ) {
+			for ( PADDING_MODE pad : { PADDING_MODE::SAME, PADDING_MODE::VALID } ) {
+				TensorP<float> weights = factory.create( Shape( { 3, 2, filterSize, filterSize } ) );
+				weights->init();
+				for ( long i = 0; i < (long) weights->shape.capacity(); ++i )
+					( *weights )[ i ] = i % 7 - 3.5f;
+				TensorP<float> biases = factory.range( Shape( { 3 } ) );
+				std::vector<TensorP<float>> outputs;
+				for ( bool perPixel : { false, true } ) {
+					Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> layer( "test", SquareActivation<float>::getSharedPointer(), 3,
+							filterSize, stride, pad, input, &factory, &factory );
+					layer.output()->init();
+					layer.weights( weights );
+					layer.biases( biases );
+					if ( perPixel )
+						layer.sparsify();
+					layer.feedForward();
+					outputs.push_back( layer.output() );
+				}
+				std::string name = std::string( __func__ ) + " " + std::to_string( filterSize ) + "x" + std::to_string( filterSize )
+						+ " stride " + std::to_string( stride ) + ( pad == PADDING_MODE::SAME ? " same" : " valid" );
+				if ( !finishTest( outputs[ 0 ], outputs[ 1 ], name ) )
+					return false;
+			}
+		}
+	}
+	return true;
+}
@@ -8,10 +8,13 @@
 
 
 #include <vector>
+#include <atomic>
 #include "DenseTest.h"
 #include "TestCommons.h"
 #include "../src/architecture/PlainTensor.h"
 #include "../src/architecture/Layer.h"
+#include "../src/architecture/Model.h"
+#include "../src/tools/ThreadPool.h"
 
 bool flattenTest1(){
 	std::cout << "Running " << __func__ << " " << std::flush;
@@ -270,3 +273,357 @@ bool denseTest2(){
 //}
 
 
+/**
+ * A linear dense layer followed by an activation layer. Once as seperate layers and once
+ * with the activation fused into the dense layer.
+ */
+bool fusedDenseActivationTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<long> factory;
+	TensorP<long> data = factory.range( Shape( { 2, 6 } ) );
+	TensorP<long> weights = factory.range( Shape( { 4, 6 } ) );
+	TensorP<long> biases = factory.range( Shape( { 4 } ) );
+
+	std::vector<TensorP<long>> outputs;
+	for ( auto usage : { MemoryUsage::greedy, MemoryUsage::greedy | MemoryUsage::fuse_layers } ) {
+		Model<long, long, PlainTensor<long>, PlainTensor<long>> model( usage, &factory, &factory );
+		model.addLayer( std::make_shared<Dense<long, long, PlainTensor<long>, PlainTensor<long>>>( "dense",
+				LinearActivation<long>::getSharedPointer(), 4, factory.create( data->shape ), &factory, &factory ) );
+		model.addLayer( std::make_shared<ActivationLayer<long, long, PlainTensor<long>, PlainTensor<long>>>( "activation",
+				SquareActivation<long>::getSharedPointer() ) );
+		if ( ( usage & MemoryUsage::fuse_layers ) && model.layers().size() != 1 ) {
+			std::cout << "activation did not get fused" << std::endl;
+			return false;
+		}
+		model.layers().front()->weights( weights );
+		model.layers().front()->biases( biases );
+		model.input()->feed( *data );
+		model.run();
+		outputs.push_back( model.output() );
+		// unfused, the dense output must not be squared in place by the activation layer
+		if ( model.layers().size() == 2 ) {
+			TensorP<long> dense = model.layers().front()->output();
+			for ( long i = 0; i < (long) dense->shape.capacity(); ++i ) {
+				if ( ( *dense )[ i ] * ( *dense )[ i ] != ( *model.output() )[ i ] ) {
+					std::cout << "activation layer changed the output of the dense layer" << std::endl;
+					return false;
+				}
+			}
+		}
+	}
+
+	return finishTest( outputs[ 1 ], outputs[ 0 ], __func__ );
+}
+
+/**
+ * Convolution with linear activation -> average pooling -> flatten -> dense gets folded
+ * into a single dense layer. The output has to stay the same.
+ */
+bool foldLinearLayersTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> data = factory.range( Shape( { 2, 2, 6, 6 } ) );
+
+	Model<float, float, PlainTensor<float>, PlainTensor<float>> model( MemoryUsage::greedy, &factory, &factory );
+	model.addLayer( std::make_shared<Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>>>( "conv",
+			LinearActivation<float>::getSharedPointer(), 2, 3, 1, PADDING_MODE::VALID, factory.create( data->shape ), &factory, &factory ) );
+	model.addLayer( std::make_shared<AveragePooling<float, float, PlainTensor<float>, PlainTensor<float>>>( "pool", 2, 2, PADDING_MODE::VALID ) );
+	model.addLayer( std::make_shared<Flatten<float, float, PlainTensor<float>, PlainTensor<float>>>( "flatten" ) );
+	model.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense",
+			SquareActivation<float>::getSharedPointer(), 3 ) );
+	model.layers()[ 0 ]->weights( factory.range( Shape( { 2, 2, 3, 3 } ) ) );
+	model.layers()[ 0 ]->biases( factory.range( Shape( { 2 } ) ) );
+	model.layers()[ 3 ]->weights( factory.ones( Shape( { 3, 8 } ) ) );
+	model.layers()[ 3 ]->biases( factory.range( Shape( { 3 } ) ) );
+
+	model.input()->feed( *data );
+	model.run();
+	TensorP<float> expectedOutput = factory.create( model.output()->shape );
+	expectedOutput->init();
+	expectedOutput->feed( *model.output() );
+
+	model.foldLinearLayers();
+	if ( model.layers().size() != 2 ) {
+		std::cout << "layers did not get folded" << std::endl;
+		return false;
+	}
+	model.clearGraph();
+	model.input()->feed( *data );
+	model.run();
+
+	return finishTest( model.output(), expectedOutput, __func__ );
+}
+
+/**
+ * A batch normalization after a linear dense layer. Once applied by itself and once folded
+ * into the dense layer. Scales are powers of two so both ways are exact.
+ */
+bool batchNormalizationFoldTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> data = factory.range( Shape( { 2, 6 } ) );
+
+	Model<float, float, PlainTensor<float>, PlainTensor<float>> model( MemoryUsage::greedy, &factory, &factory );
+	model.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense",
+			LinearActivation<float>::getSharedPointer(), 4, factory.create( data->shape ), &factory, &factory ) );
+	model.addLayer( std::make_shared<BatchNormalization<float, float, PlainTensor<float>, PlainTensor<float>>>( "bn", 0 ) );
+	model.layers()[ 0 ]->weights( factory.range( Shape( { 4, 6 } ) ) );
+	model.layers()[ 0 ]->biases( factory.range( Shape( { 4 } ) ) );
+	auto bn = std::dynamic_pointer_cast<BatchNormalization<float, float, PlainTensor<float>, PlainTensor<float>>>( model.layers()[ 1 ] );
+	bn->statistics( { 1, 2, 1, 3 }, { 0, 1, -2, 5 }, { 3, 0, 1, -1 }, { 0.25, 1, 4, 0.25 } );
+
+	model.input()->feed( *data );
+	model.run();
+	TensorP<float> expectedOutput = factory.create( model.output()->shape );
+	expectedOutput->init();
+	expectedOutput->feed( *model.output() );
+
+	model.foldBatchNormalization();
+	if ( model.layers().size() != 1 ) {
+		std::cout << "batch normalization did not get folded" << std::endl;
+		return false;
+	}
+	model.clearGraph();
+	model.input()->feed( *data );
+	model.run();
+
+	return finishTest( model.output(), expectedOutput, __func__ );
+}
+
+/**
+ * A model with a pruned dense layer loaded with and without sparse_weights. Half of the
+ * weights are zero, the output has to stay the same.
+ */
+bool sparseDenseTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<long> factory;
+	TensorP<long> data = factory.range( Shape( { 3, 8 } ) );
+	TensorP<long> weights = factory.create( Shape( { 5, 8 } ) );
+	weights->init();
+	for ( long i = 0; i < (long) weights->shape.capacity(); ++i )
+		( *weights )[ i ] = i % 2 == 0 ? i + 1 : 0;
+	TensorP<long> biases = factory.range( Shape( { 5 } ) );
+
+	std::vector<TensorP<long>> outputs;
+	for ( auto usage : { MemoryUsage::greedy, MemoryUsage::greedy | MemoryUsage::sparse_weights } ) {
+		Model<long, long, PlainTensor<long>, PlainTensor<long>> model( usage, &factory, &factory );
+		model.addLayer( std::make_shared<Dense<long, long, PlainTensor<long>, PlainTensor<long>>>( "dense",
+				SquareActivation<long>::getSharedPointer(), 5, factory.create( data->shape ), &factory, &factory ) );
+		model.layers().front()->weights( weights );
+		model.layers().front()->biases( biases );
+		if ( usage & MemoryUsage::sparse_weights ) {
+			model.layers().front()->sparsify();
+			if ( model.layers().front()->multiplications() != 20 ) {
+				std::cout << "zero weights did not get dropped" << std::endl;
+				return false;
+			}
+		}
+		model.input()->feed( *data );
+		model.run();
+		outputs.push_back( model.output() );
+	}
+
+	return finishTest( outputs[ 1 ], outputs[ 0 ], __func__ );
+}
+
+/**
+ * A dense layer whose weights only take the values -2, 0 and 3, run with and without
+ * clustered_weights. Each neuron needs 2 multiplications instead of 8.
+ */
+bool clusteredDenseTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<long> factory;
+	TensorP<long> data = factory.range( Shape( { 3, 8 } ) );
+	TensorP<long> weights = factory.create( Shape( { 5, 8 } ) );
+	weights->init();
+	for ( long i = 0; i < (long) weights->shape.capacity(); ++i )
+		( *weights )[ i ] = std::vector<long>{ -2, 0, 3 }[ i % 3 ];
+	TensorP<long> biases = factory.range( Shape( { 5 } ) );
+
+	std::vector<TensorP<long>> outputs;
+	for ( auto usage : { MemoryUsage::greedy, MemoryUsage::greedy | MemoryUsage::clustered_weights } ) {
+		Model<long, long, PlainTensor<long>, PlainTensor<long>> model( usage, &factory, &factory );
+		model.addLayer( std::make_shared<Dense<long, long, PlainTensor<long>, PlainTensor<long>>>( "dense",
+				SquareActivation<long>::getSharedPointer(), 5, factory.create( data->shape ), &factory, &factory ) );
+		model.layers().front()->weights( weights );
+		model.layers().front()->biases( biases );
+		if ( usage & MemoryUsage::clustered_weights ) {
+			model.clusterWeights();
+			if ( model.layers().front()->multiplications() != 10 ) {
+				std::cout << "weights did not get clustered" << std::endl;
+				return false;
+			}
+		}
+		model.input()->feed( *data );
+		model.run();
+		outputs.push_back( model.output() );
+	}
+
+	return finishTest( outputs[ 1 ], outputs[ 0 ], __func__ );
+}
+
+/**
+ * A 6 x 8 dense layer with rank 2 weights gets replaced by a 2 neuron and a 6 neuron layer.
+ * Weights, biases and inputs are integers, so the outputs are too up to rounding errors.
+ */
+bool factorizeDenseTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<double> factory;
+	TensorP<double> data = factory.range( Shape( { 3, 8 } ) );
+	TensorP<double> weights = factory.create( Shape( { 6, 8 } ) );
+	weights->init();
+	for ( size_t i = 0; i < 6; ++i )
+		for ( size_t j = 0; j < 8; ++j )
+			( *weights )[ { i, j } ] = ( i + 1.0 ) * ( j % 3 ) - ( i % 2 ) * ( j + 1.0 );
+	TensorP<double> biases = factory.range( Shape( { 6 } ) );
+
+	Model<double, double, PlainTensor<double>, PlainTensor<double>> model( MemoryUsage::greedy, &factory, &factory );
+	model.addLayer( std::make_shared<Dense<double, double, PlainTensor<double>, PlainTensor<double>>>( "dense",
+			SquareActivation<double>::getSharedPointer(), 6, factory.create( data->shape ), &factory, &factory ) );
+	model.layers().front()->weights( weights );
+	model.layers().front()->biases( biases );
+	model.input()->feed( *data );
+	model.run();
+	TensorP<double> expectedOutput = factory.create( model.output()->shape );
+	expectedOutput->init();
+	expectedOutput->feed( *model.output() );
+
+	if ( model.factorizeDense( 1e-6 ) != 1 || model.layers().front()->output()->shape[ 1 ] != 2 ) {
+		std::cout << "dense layer did not get factorized with rank 2" << std::endl;
+		return false;
+	}
+	model.clearGraph();
+	model.input()->feed( *data );
+	model.run();
+	for ( long i = 0; i < (long) model.output()->shape.capacity(); ++i )
+		( *model.output() )[ i ] = std::round( ( *model.output() )[ i ] );
+
+	return finishTest( model.output(), expectedOutput, __func__ );
+}
+
+/**
+ * Weights are multiples of 1/4 with a maximum magnitude of 31/4, so integerizing them with 5 bits
+ * gives the scale 4 and no rounding error. Neither layer undoes its scale: the first one passes 4^2
+ * through its square activation, the second one folds it into its bias and the model output is
+ * scaled by ( 16 * 4 )^1. Divided by that the outputs have to match exactly.
+ */
+bool integerWeightsDenseTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<double> factory;
+	TensorP<double> data = factory.range( Shape( { 3, 8 } ) );
+	std::vector<TensorP<double>> weights { factory.create( Shape( { 5, 8 } ) ), factory.create( Shape( { 3, 5 } ) ) };
+	for ( auto w : weights ) {
+		w->init();
+		for ( long i = 0; i < (long) w->shape.capacity(); ++i )
+			( *w )[ i ] = ( ( i * 7 ) % 63 - 31 ) / 4.;
+	}
+	std::vector<TensorP<double>> biases { factory.range( Shape( { 5 } ) ), factory.range( Shape( { 3 } ) ) };
+
+	std::vector<TensorP<double>> outputs;
+	for ( bool integerize : { false, true } ) {
+		Model<double, double, PlainTensor<double>, PlainTensor<double>> model( MemoryUsage::greedy, &factory, &factory );
+		model.addLayer( std::make_shared<Dense<double, double, PlainTensor<double>, PlainTensor<double>>>( "dense1",
+				SquareActivation<double>::getSharedPointer(), 5, factory.create( data->shape ), &factory, &factory ) );
+		model.addLayer( std::make_shared<Dense<double, double, PlainTensor<double>, PlainTensor<double>>>( "dense2",
+				LinearActivation<double>::getSharedPointer(), 3, &factory, &factory ) );
+		for ( uint l = 0; l < 2; ++l ) {
+			model.layers()[ l ]->weights( weights[ l ] );
+			model.layers()[ l ]->biases( biases[ l ] );
+		}
+		if ( integerize && ( model.integerizeWeights( 5 ) != 2 || model.layers().front()->weightScale() != 4 ) ) {
+			std::cout << "weights did not get integerized with scale 4" << std::endl;
+			return false;
+		}
+		if ( integerize && ( model.outputScale() != 64 || model.layers()[ 0 ]->multiplicativeDepth() != 2
+				|| model.layers()[ 1 ]->multiplicativeDepth() != 1 ) ) {
+			std::cout << "the scales did not get passed on to the output" << std::endl;
+			return false;
+		}
+		model.input()->feed( *data );
+		model.run();
+		TensorP<double> output = model.output();
+		for ( long i = 0; i < (long) output->shape.capacity(); ++i )
+			( *output )[ i ] /= model.outputScale();
+		outputs.push_back( output );
+	}
+
+	return finishTest( outputs[ 1 ], outputs[ 0 ], __func__ );
+}
+
+bool parallelismDenseTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> data = factory.range( Shape( { 3, 8 } ) );
+	TensorP<float> weights = factory.range( Shape( { 2, 8 } ) );
+	TensorP<float> biases = factory.range( Shape( { 2 } ) );
+
+	// record the inner threads the workers get, the plain backend has no use for them
+	std::atomic<size_t> maxInner( 1 );
+	ThreadPool& pool = ThreadPool::getPool();
+	ThreadPool::InnerParallelism previous = pool.innerParallelism( [&maxInner]( size_t threads ) {
+		size_t seen = maxInner;
+		while ( threads > seen && !maxInner.compare_exchange_weak( seen, threads ) );
+	} );
+
+	const size_t callerInner = pool.innerThreads();
+	bool restored = true;
+	std::vector<TensorP<float>> outputs;
+	for ( PARALLELISM_POLICY policy : { OUTER_PARALLELISM, AUTO_PARALLELISM, INNER_PARALLELISM } ) {
+		Model<float, float, PlainTensor<float>, PlainTensor<float>> model( MemoryUsage::greedy, &factory, &factory );
+		model.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense",
+				SquareActivation<float>::getSharedPointer(), 2, factory.create( data->shape ), &factory, &factory ) );
+		model.layers().front()->weights( weights );
+		model.layers().front()->biases( biases );
+		model.layers().front()->parallelism( policy );
+		model.input()->feed( *data );
+		model.run();
+		outputs.push_back( model.output() );
+		restored &= pool.innerThreads() == callerInner;
+	}
+	pool.innerParallelism( previous ); // the backend may have registered one
+
+	if ( !restored ) {
+		std::cout << "the calling thread kept the inner threads of the layer" << std::endl;
+		return false;
+	}
+	if ( maxInner != pool.threads() ) {
+		std::cout << "inner parallelism did not get the whole thread budget" << std::endl;
+		return false;
+	}
+	return finishTest( outputs[ 0 ], outputs[ 1 ], __func__ ) && finishTest( outputs[ 0 ], outputs[ 2 ], __func__ );
+}
+
+/**
+ * Convolution with square activation (depth 2) -> average pooling (1) -> flatten (0) -> linear dense (1).
+ * With a margin of one level the inputs need 5, 3, 2 and 2 levels. Planning must not change the output.
+ */
+bool planLevelsDenseTest1(){
+	std::cout << "Running " << __func__ << " " << std::flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> data = factory.range( Shape( { 2, 2, 6, 6 } ) );
+
+	std::vector<TensorP<float>> outputs;
+	for ( MemoryUsage usage : { MemoryUsage::greedy, MemoryUsage::greedy | MemoryUsage::plan_levels } ) {
+		Model<float, float, PlainTensor<float>, PlainTensor<float>> model( usage, &factory, &factory );
+		model.addLayer( std::make_shared<Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>>>( "conv",
+				SquareActivation<float>::getSharedPointer(), 2, 3, 1, PADDING_MODE::VALID, factory.create( data->shape ), &factory, &factory ) );
+		model.addLayer( std::make_shared<AveragePooling<float, float, PlainTensor<float>, PlainTensor<float>>>( "pool", 2, 2, PADDING_MODE::VALID ) );
+		model.addLayer( std::make_shared<Flatten<float, float, PlainTensor<float>, PlainTensor<float>>>( "flatten" ) );
+		model.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense",
+				LinearActivation<float>::getSharedPointer(), 3 ) );
+		model.layers()[ 0 ]->weights( factory.range( Shape( { 2, 2, 3, 3 } ) ) );
+		model.layers()[ 0 ]->biases( factory.range( Shape( { 2 } ) ) );
+		model.layers()[ 3 ]->weights( factory.ones( Shape( { 3, 8 } ) ) );
+		model.layers()[ 3 ]->biases( factory.range( Shape( { 3 } ) ) );
+
+		if ( model.planLevels() != std::vector<long>( { 5, 3, 2, 2 } ) ) {
+			std::cout << "planned levels " << model.planLevels() << " instead of [5 3 2 2 ]" << std::endl;
+			return false;
+		}
+		model.input()->feed( *data );
+		model.run();
+		outputs.push_back( model.output() );
+	}
+
+	return finishTest( outputs[ 1 ], outputs[ 0 ], __func__ );
+}
@@ -23,6 +23,23 @@ bool denseTest2();
 
 bool denseTest3();
 
+bool fusedDenseActivationTest1();
+
+bool foldLinearLayersTest1();
+
+bool batchNormalizationFoldTest1();
+
+bool sparseDenseTest1();
+
+bool clusteredDenseTest1();
+
+bool factorizeDenseTest1();
+
+bool integerWeightsDenseTest1();
+bool parallelismDenseTest1();
+
+bool planLevelsDenseTest1();
+
 
 
 #endif /* TEST_DENSETEST_H_ */
@@ -0,0 +1,86 @@
+/*
+ * DepthwiseConvTest.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: agent
+ */
+
+#include "ConvTest.h"
+
+using namespace std;
+
+/**
+ * A depthwise convolution is a Convolution2D whose filters are zero for every input channel
+ * except the one they belong to. Runs both and compares the outputs.
+ */
+bool executeDepthwiseConvTest( string funcName, uint depthMultiplier, uint filterSize, uint stride, PADDING_MODE pad ) {
+	PlainTensorFactory<float> factory;
+	uint channels = 3;
+	uint outChannels = channels * depthMultiplier;
+	TensorP<float> input = factory.range( Shape( { 2, channels, 7, 7 } ) );
+	TensorP<float> depthwiseWeights = factory.range( Shape( { outChannels, filterSize, filterSize } ) );
+	TensorP<float> biases = factory.range( Shape( { outChannels } ) );
+
+	TensorP<float> convWeights = factory.zeros( Shape( { outChannels, channels, filterSize, filterSize } ) );
+	for ( uint f = 0; f < outChannels; ++f )
+		for ( uint y = 0; y < filterSize; ++y )
+			for ( uint x = 0; x < filterSize; ++x )
+				( *convWeights )[ { f, f / depthMultiplier, y, x } ] = ( *depthwiseWeights )[ { f, y, x } ];
+
+	DepthwiseConvolution2D<float, float, PlainTensor<float>, PlainTensor<float>> depthwise( "depthwise",
+			SquareActivation<float>::getSharedPointer(), depthMultiplier, filterSize, stride, pad, input, &factory, &factory );
+	depthwise.weights( depthwiseWeights );
+	depthwise.biases( biases );
+	depthwise.output()->init();
+	depthwise.feedForward();
+
+	Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>> conv( "conv",
+			SquareActivation<float>::getSharedPointer(), outChannels, filterSize, stride, pad, input, &factory, &factory );
+	conv.weights( convWeights );
+	conv.biases( biases );
+	conv.output()->init();
+	conv.feedForward();
+
+	return finishTest( depthwise.output(), conv.output(), funcName );
+}
+
+bool depthwiseConvTest1_validPad() {
+	cout << "Running " << __func__ << " " << flush;
+	return executeDepthwiseConvTest( __func__, 1, 3, 1, PADDING_MODE::VALID );
+}
+
+bool depthwiseConvTest2_samePad() {
+	cout << "Running " << __func__ << " " << flush;
+	return executeDepthwiseConvTest( __func__, 2, 3, 2, PADDING_MODE::SAME );
+}
+
+/**
+ * Depthwise followed by a pointwise convolution as the model loader builds separable convolutions
+ */
+bool separableConvTest1() {
+	cout << "Running " << __func__ << " " << flush;
+	PlainTensorFactory<float> factory;
+	TensorP<float> data = factory.ones( Shape( { 1, 2, 5, 5 } ) );
+
+	Model<float, float, PlainTensor<float>, PlainTensor<float>> model( MemoryUsage::greedy, &factory, &factory );
+	model.addLayer( std::make_shared<DepthwiseConvolution2D<float, float, PlainTensor<float>, PlainTensor<float>>>( "sep_depthwise",
+			LinearActivation<float>::getSharedPointer(), 1, 3, 1, PADDING_MODE::VALID, factory.create( data->shape ), &factory, &factory ) );
+	model.addLayer( std::make_shared<Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>>>( "sep_pointwise",
+			LinearActivation<float>::getSharedPointer(), 3, 1, 1, PADDING_MODE::VALID ) );
+	model.layers()[ 0 ]->weights( factory.ones( Shape( { 2, 3, 3 } ) ) );
+	model.layers()[ 0 ]->biases( factory.zeros( Shape( { 2 } ) ) );
+	model.layers()[ 1 ]->weights( factory.range( Shape( { 3, 2, 1, 1 } ) ) );
+	model.layers()[ 1 ]->biases( factory.ones( Shape( { 3 } ) ) );
+	model.input()->feed( *data );
+	model.run();
+
+	// every depthwise pixel is 9. filter f of the pointwise conv has the weights 2f and 2f + 1
+	vector<vector<vector<vector<float>>>> expectedOutputV { vector<vector<vector<float>>> {
+		vector<vector<float>>( 3, vector<float>( 3, 10 ) ),
+		vector<vector<float>>( 3, vector<float>( 3, 46 ) ),
+		vector<vector<float>>( 3, vector<float>( 3, 82 ) ) } };
+	TensorP<float> expectedOutput = factory.create( Shape( { 1, 3, 3, 3 } ) );
+	expectedOutput->init( expectedOutputV );
+
+	return finishTest( model.output(), expectedOutput, __func__ );
+}
@@ -7,10 +7,15 @@
  */
 
 #include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
 #include "../src/architecture/Tensor.h"
 #include "../src/architecture/PlainTensor.h"
 #include "../src/architecture/HEBackend/HETensor.h"
 #include "../src/architecture/HEBackend/helib/HELIbCipherText.h"
+#include "../src/architecture/HEBackend/helib/HELibParameterSelector.h"
 #include "../src/architecture/Layer.h"
 #include "../src/data/DatasetOperations.h"
 #include "HEBackendTests.h"
@@ -578,6 +583,38 @@ bool HE_convTest2_Valid_CKKS() {
 //	}
 //}
 
+/**
+ * Global average pooling of an encrypted batch against the same layer on plain values.
+ */
+bool HE_globalAveragePoolingTest1_CKKS() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<float> ptFactory;
+	PlainTensorFactory<double> pdFactory;
+
+	Shape shape( { ctxtFactory.batchsize(), 3, 4, 4 } );
+	TensorP<double> plain = pdFactory.range( shape );
+	TensorP<float> plainFloat = ptFactory.create( shape );
+	plainFloat->init();
+	for ( long i = 0; i < (long) shape.capacity(); ++i )
+		( *plainFloat )[ i ] = ( *plain )[ i ];
+	TensorP<HELibCipherText> input = hetfactory.create( shape );
+	ctxtFactory.feedCipherTensor( plain, input );
+
+	GlobalAveragePooling2D<HELibCipherText, float, HETensor<HELibCipherText>, PlainTensor<float>> layer( "test", input, &hetfactory, &ptFactory );
+	layer.output()->init();
+	layer.feedForward();
+
+	GlobalAveragePooling2D<float, float, PlainTensor<float>, PlainTensor<float>> plainLayer( "plain", plainFloat, &ptFactory, &ptFactory );
+	plainLayer.output()->init();
+	plainLayer.feedForward();
+
+	TensorP<double> decrypted = ( (HETensor<HELibCipherText>*) layer.output().get() )->decryptDouble();
+	return finishTest<double, float>( decrypted, plainLayer.output(), __func__ );
+}
+
 bool HE_denseTest1() {
 	cout << "Running " << __func__ << " " << endl;
 
@@ -703,3 +740,601 @@ bool HE_SamePaddFloats() {
 
 
 
+
+/**
+ * Two convolutions with a square activation in between, the squares are left unrelinearized for the second
+ * convolution to add up. Compared with the same layers on plain longs.
+ */
+bool HE_lazyRelinearizationTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory;
+	ctxtFactory.lazyRelinearization( true );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<long> ptFactory;
+
+	TensorP<long> weights = ptFactory.create( Shape( { 1, 1, 3, 3 } ) );
+	weights->init();
+	for ( long i = 0; i < 9; ++i )
+		( *weights )[ i ] = i % 3 - 1;
+	TensorP<long> biases = ptFactory.create( Shape( { 1 } ) );
+	biases->init();
+	( *biases )[ 0 ] = 1;
+
+	try {
+		TensorP<long> plainInput = ptFactory.range( Shape( { 1, 1, 4, 4 } ) );
+		Convolution2D<long, long, PlainTensor<long>, PlainTensor<long>> plain1( "plain1", SquareActivation<long>::getSharedPointer(), 1, 3, 1,
+				PADDING_MODE::SAME, plainInput, &ptFactory, &ptFactory );
+		plain1.output()->init();
+		Convolution2D<long, long, PlainTensor<long>, PlainTensor<long>> plain2( "plain2", LinearActivation<long>::getSharedPointer(), 1, 3, 1,
+				PADDING_MODE::SAME, plain1.output(), &ptFactory, &ptFactory );
+		plain2.output()->init();
+
+		vector<vector<vector<vector<HELibCipherText>>>> inputVolume( 1, vector<vector<vector<HELibCipherText>>>( 1, vector<vector<HELibCipherText>>( 4 ) ) );
+		for ( long i = 0; i < 16; ++i )
+			inputVolume[ 0 ][ 0 ][ i / 4 ].push_back( ctxtFactory.createCipherText( i ) );
+		TensorP<HELibCipherText> input = hetfactory.create( Shape( { 1, 1, 4, 4 } ) );
+		input->init( inputVolume );
+		Convolution2D<HELibCipherText, long, HETensor<HELibCipherText>, PlainTensor<long>> layer1( "layer1",
+				SquareActivation<HELibCipherText>::getSharedPointer(), 1, 3, 1, PADDING_MODE::SAME, input, &hetfactory, &ptFactory );
+		layer1.output()->init();
+		Convolution2D<HELibCipherText, long, HETensor<HELibCipherText>, PlainTensor<long>> layer2( "layer2",
+				LinearActivation<HELibCipherText>::getSharedPointer(), 1, 3, 1, PADDING_MODE::SAME, layer1.output(), &hetfactory, &ptFactory );
+		layer2.output()->init();
+
+		for ( auto layer : { &plain1, &plain2 } ) {
+			layer->weights( weights );
+			layer->biases( biases );
+			layer->feedForward();
+		}
+		for ( auto layer : { &layer1, &layer2 } ) {
+			layer->weights( weights );
+			layer->biases( biases );
+			layer->feedForward();
+		}
+
+		TensorP<long> decrypted = ( (HETensor<HELibCipherText>*) layer2.output().get() )->decryptLong();
+		return finishTest<long, long>( decrypted, plain2.output(), __func__ );
+	} catch ( const std::bad_alloc& e ) {
+		cout << "Allocation failed: " << e.what() << endl;
+		return false;
+	}
+}
+
+/**
+ * Two dense layers need 4 levels (dense + square, dense, decryption margin). The selected ring has to be the
+ * smallest power of 2 that reaches the security level and the number of slots.
+ */
+bool HE_parameterSelectionTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	PlainTensorFactory<float> factory;
+	TensorP<float> data = factory.range( Shape( { 2, 8 } ) );
+	Model<float, float, PlainTensor<float>, PlainTensor<float>> model( MemoryUsage::greedy, &factory, &factory );
+	model.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense1",
+			SquareActivation<float>::getSharedPointer(), 4, factory.create( data->shape ), &factory, &factory ) );
+	model.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense2",
+			LinearActivation<float>::getSharedPointer(), 2 ) );
+	model.layers()[ 0 ]->weights( factory.ones( Shape( { 4, 8 } ) ) );
+	model.layers()[ 0 ]->biases( factory.ones( Shape( { 4 } ) ) );
+	model.layers()[ 1 ]->weights( factory.ones( Shape( { 2, 4 } ) ) );
+	model.layers()[ 1 ]->biases( factory.ones( Shape( { 2 } ) ) );
+	model.input()->feed( *data );
+
+	HELibParameterSelector selector( 128, 20 );
+	selector.analyze( model ).calibrate( model ).minSlots( 16 );
+	HELibParameters p = selector.select();
+	cout << p << endl;
+
+	// largest output: 4 * ( 8 + 9 + ... + 15 + 1 )^2 + 1
+	long valueBits = (long) std::ceil( std::log2( 4. * 93 * 93 + 2 ) ) + 1;
+	bool success = p.depth == 4 && p.valueBits == valueBits && p.L == 4 * ( 20 + HELibParameterSelector::noiseBits ) + valueBits
+			&& p.slots() >= 16 && p.security >= 128 && ( p.m & ( p.m - 1 ) ) == 0
+			&& ( p.m / 8 < 16 || HELibParameterSelector::estimateSecurity( p.phi() / 2, p.L * 1.5 ) < 128 );
+	if ( success )
+		cout << "Passed " << endl;
+	else
+		cout << "FAILED: parameters are not the smallest ones for depth 4 and " << valueBits << " value bits" << endl;
+	return success;
+}
+
+/**
+ * Runs two dense layers with MemoryUsage::plan_levels, which feeds every layer a copy of its input switched down
+ * to the primes the remaining layers need. The output has to match the same model on plain values, the first layer
+ * has to run at the planned level and the input and a copy of it made before run() have to keep theirs.
+ */
+bool HE_planLevelsTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<float> ptFactory;
+	PlainTensorFactory<double> pdFactory;
+
+	Shape shape( { ctxtFactory.batchsize(), 8 } );
+	Model<HELibCipherText, float, HETensor<HELibCipherText>, PlainTensor<float>> model( MemoryUsage::greedy | MemoryUsage::plan_levels,
+			&hetfactory, &ptFactory );
+	model.addLayer( std::make_shared<Dense<HELibCipherText, float, HETensor<HELibCipherText>, PlainTensor<float>>>( "dense1",
+			SquareActivation<HELibCipherText>::getSharedPointer(), 4, hetfactory.create( shape ), &hetfactory, &ptFactory ) );
+	model.addLayer( std::make_shared<Dense<HELibCipherText, float, HETensor<HELibCipherText>, PlainTensor<float>>>( "dense2",
+			LinearActivation<HELibCipherText>::getSharedPointer(), 2 ) );
+	Model<float, float, PlainTensor<float>, PlainTensor<float>> plainModel( MemoryUsage::greedy, &ptFactory, &ptFactory );
+	plainModel.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense1",
+			SquareActivation<float>::getSharedPointer(), 4, ptFactory.create( shape ), &ptFactory, &ptFactory ) );
+	plainModel.addLayer( std::make_shared<Dense<float, float, PlainTensor<float>, PlainTensor<float>>>( "dense2",
+			LinearActivation<float>::getSharedPointer(), 2 ) );
+
+	for ( size_t l = 0; l < 2; ++l ) {
+		size_t units = l == 0 ? 4 : 2;
+		size_t inputs = l == 0 ? 8 : 4;
+		TensorP<float> weights = ptFactory.create( Shape( { units, inputs } ) );
+		weights->init();
+		for ( long i = 0; i < (long) ( units * inputs ); ++i )
+			( *weights )[ i ] = ( i % 5 - 2 ) / 4.f;
+		TensorP<float> biases = ptFactory.create( Shape( { units } ) );
+		biases->init();
+		for ( long i = 0; i < (long) units; ++i )
+			( *biases )[ i ] = 0.5f;
+		model.layers()[ l ]->weights( weights );
+		model.layers()[ l ]->biases( biases );
+		plainModel.layers()[ l ]->weights( weights );
+		plainModel.layers()[ l ]->biases( biases );
+	}
+
+	TensorP<double> data = pdFactory.create( shape );
+	data->init();
+	for ( long i = 0; i < (long) shape.capacity(); ++i ) {
+		( *data )[ i ] = ( i % 7 ) / 8.;
+		( *plainModel.input() )[ i ] = ( i % 7 ) / 8.f;
+	}
+	ctxtFactory.feedCipherTensor( data, model.input() );
+
+	std::vector<long> levels = model.planLevels();
+	HELibCipherText copy = ( (HETensor<HELibCipherText>*) model.input().get() )->data()[ 0 ];
+	long freshLevel = copy.level();
+	model.run();
+	plainModel.run();
+
+	long inputLevel = ( (HETensor<HELibCipherText>*) model.input().get() )->data()[ 0 ].level();
+	if ( copy.level() != freshLevel || inputLevel != freshLevel ) {
+		cout << "FAILED: the input dropped from level " << freshLevel << " to " << copy.level() << " and " << inputLevel << endl;
+		return false;
+	}
+	long outputLevel = ( (HETensor<HELibCipherText>*) model.layers().front()->output().get() )->data()[ 0 ].level();
+	if ( outputLevel > levels.front() ) {
+		cout << "FAILED: the first layer ran at level " << outputLevel << " instead of " << levels.front() << endl;
+		return false;
+	}
+	TensorP<double> decrypted = ( (HETensor<HELibCipherText>*) model.layers().back()->output().get() )->decryptDouble();
+	TensorP<float> expected = plainModel.layers().back()->output();
+	for ( long i = 0; i < (long) expected->shape.capacity(); ++i ) {
+		if ( std::abs( ( *decrypted )[ i ] - ( *expected )[ i ] ) > 1e-3 ) {
+			cout << "FAILED: element " << i << " decrypted to " << ( *decrypted )[ i ] << " instead of " << ( *expected )[ i ] << endl;
+			return false;
+		}
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * Encrypts a batch of two instances in parallel and decrypts it again, element i of instance b has to end up
+ * in the same place.
+ */
+bool HE_feedDecryptTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<double> ptFactory;
+
+	Shape shape( { ctxtFactory.batchsize(), 2, 3, 3 } );
+	TensorP<double> plain = ptFactory.create( shape );
+	plain->init();
+	for ( long i = 0; i < (long) shape.capacity(); ++i )
+		( *plain )[ i ] = i / 4.;
+	TensorP<HELibCipherText> encrypted = hetfactory.create( shape );
+	ctxtFactory.feedCipherTensor( plain, encrypted );
+	TensorP<double> decrypted = ( (HETensor<HELibCipherText>*) encrypted.get() )->decryptDouble();
+
+	if ( decrypted->shape != shape ) {
+		cout << "FAILED: decrypted shape " << decrypted->shape << " instead of " << shape << endl;
+		return false;
+	}
+	for ( long i = 0; i < (long) shape.capacity(); ++i ) {
+		if ( std::abs( ( *decrypted )[ i ] - ( *plain )[ i ] ) > 1e-3 ) {
+			cout << "FAILED: element " << i << " decrypted to " << ( *decrypted )[ i ] << " instead of " << ( *plain )[ i ] << endl;
+			return false;
+		}
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * Two factories with the same keys encrypt the same values. With the same stream seed the ciphertexts have to be
+ * the same, with streams keyed from the system they must differ.
+ */
+bool HE_randomStreamsTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	auto serialize = []( HELibCipherTextFactory& factory ) {
+		std::ostringstream out( std::ios::out | std::ios::binary );
+		factory.writeCipherText( factory.createCipherText( std::vector<double> { 1.25, -3.5 } ), out );
+		return out.str();
+	};
+	HELibCipherTextFactory first( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	HELibCipherTextFactory second( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	std::string unseeded1 = serialize( first );
+	std::string unseeded2 = serialize( second );
+	first.seedRandomStreams( 7 );
+	second.seedRandomStreams( 7 );
+	std::string seeded1 = serialize( first );
+	std::string seeded2 = serialize( second );
+
+	if ( seeded1 != seeded2 || unseeded1 == unseeded2 ) {
+		cout << "FAILED: seeded streams " << ( seeded1 == seeded2 ? "match" : "differ" ) << ", system streams "
+				<< ( unseeded1 == unseeded2 ? "match" : "differ" ) << endl;
+		return false;
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * Encrypts with precomputed zeros once the background thread filled the pool, the values have to decrypt as
+ * with a regular encryption.
+ */
+bool HE_precomputedZerosTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	ctxtFactory.precomputeZeros( 4 );
+	for ( int wait = 0; wait < 6000 && ctxtFactory.precomputedZeros() < 4; ++wait )
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+	if ( ctxtFactory.precomputedZeros() != 4 ) {
+		cout << "FAILED: the pool did not fill up" << endl;
+		return false;
+	}
+
+	std::vector<double> values { 1.25, -3.5 };
+	HELibCipherText pooled = ctxtFactory.createCipherText( values );
+	HELibCipherText constant = ctxtFactory.createCipherText( 7l );
+	ctxtFactory.precomputeZeros( 0 );
+	HELibCipherText regular = ctxtFactory.createCipherText( values );
+
+	std::vector<double> decrypted = ctxtFactory.decryptDouble( pooled );
+	std::vector<double> expected = ctxtFactory.decryptDouble( regular );
+	std::vector<double> decryptedConstant = ctxtFactory.decryptDouble( constant );
+	for ( size_t i = 0; i < values.size(); ++i ) {
+		if ( std::abs( decrypted[ i ] - values[ i ] ) > 1e-3 || std::abs( expected[ i ] - values[ i ] ) > 1e-3
+				|| std::abs( decryptedConstant[ i ] - 7 ) > 1e-3 ) {
+			cout << "FAILED: slot " << i << " decrypted to " << decrypted[ i ] << " and " << decryptedConstant[ i ]
+					<< " instead of " << values[ i ] << " and 7" << endl;
+			return false;
+		}
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * Writes an encrypted batch to a file and reads it back whole and element by element through the mapping.
+ * A factory with other parameters must not be able to read it.
+ */
+bool HE_tensorFileTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<double> ptFactory;
+	const std::string file = "he_tensor_file_test.bin";
+
+	Shape shape( { ctxtFactory.batchsize(), 2, 3, 3 } );
+	TensorP<double> plain = ptFactory.create( shape );
+	plain->init();
+	for ( long i = 0; i < (long) shape.capacity(); ++i )
+		( *plain )[ i ] = i / 4.;
+	TensorP<HELibCipherText> encrypted = hetfactory.create( shape );
+	ctxtFactory.feedCipherTensor( plain, encrypted );
+	encrypted->writeToFile( file );
+
+	auto read = HETensor<HELibCipherText>::readFromFile( file, &ctxtFactory );
+	TensorP<double> decrypted = read->decryptDouble();
+	MappedHETensorFile<HELibCipherText> mapped( file, &ctxtFactory );
+	std::vector<double> single = ctxtFactory.decryptDouble( mapped.element( 5 ) );
+
+	bool rejected = false;
+	try {
+		HELibCipherTextFactory otherFactory( /*L*/4096, /*m*/2 * 4, /*r*/30 );
+		HETensor<HELibCipherText>::readFromFile( file, &otherFactory );
+	} catch ( const std::runtime_error& e ) {
+		rejected = true;
+	}
+	std::remove( file.c_str() );
+
+	if ( read->shape != encrypted->shape || mapped.size() != encrypted->shape.capacity() || !rejected ) {
+		cout << "FAILED: read shape " << read->shape << ", " << mapped.size() << " mapped ciphertexts, "
+				<< ( rejected ? "" : "not " ) << "rejected by another context" << endl;
+		return false;
+	}
+	for ( long i = 0; i < (long) shape.capacity(); ++i ) {
+		if ( std::abs( ( *decrypted )[ i ] - ( *plain )[ i ] ) > 1e-3 ) {
+			cout << "FAILED: element " << i << " read back as " << ( *decrypted )[ i ] << " instead of " << ( *plain )[ i ] << endl;
+			return false;
+		}
+	}
+	// ciphertext 5 holds element 5 of every instance
+	if ( std::abs( single[ 1 ] - ( *plain )[ 5 + (long) ( shape.capacity() / shape[ 0 ] ) ] ) > 1e-3 ) {
+		cout << "FAILED: mapped ciphertext 5 decrypted to " << single[ 1 ] << endl;
+		return false;
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * A compact file holds the ciphertexts at the level of two multiplications, it has to be less than half the size
+ * of the full one and decrypt to the same values.
+ */
+bool HE_compactTensorFileTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<double> ptFactory;
+	const std::string fullFile = "he_tensor_full_test.bin";
+	const std::string compactFile = "he_tensor_compact_test.bin";
+	const long level = ctxtFactory.levelsForDepth( 2 );
+
+	Shape shape( { ctxtFactory.batchsize(), 4 } );
+	TensorP<double> plain = ptFactory.create( shape );
+	plain->init();
+	for ( long i = 0; i < (long) shape.capacity(); ++i )
+		( *plain )[ i ] = i % 7 - 3.5;
+	TensorP<HELibCipherText> encrypted = hetfactory.create( shape );
+	ctxtFactory.feedCipherTensor( plain, encrypted );
+	auto tensor = std::dynamic_pointer_cast<HETensor<HELibCipherText>>( encrypted );
+	tensor->writeToFile( fullFile );
+	tensor->writeToFile( compactFile, level );
+
+	uint64_t fullSize, compactSize;
+	uint32_t flags;
+	long fileLevel;
+	{
+		MappedHETensorFile<HELibCipherText> full( fullFile, &ctxtFactory ), compact( compactFile, &ctxtFactory );
+		fullSize = full.header().offsets.back();
+		compactSize = compact.header().offsets.back();
+		flags = compact.header().flags;
+		fileLevel = compact.header().level;
+	}
+	TensorP<double> decrypted = HETensor<HELibCipherText>::readFromFile( compactFile, &ctxtFactory )->decryptDouble();
+	long tensorLevel = tensor->data()[ 0 ].level();
+	std::remove( fullFile.c_str() );
+	std::remove( compactFile.c_str() );
+
+	if ( !( flags & HETensorFileHeader::droppedLevels ) || fileLevel > level || tensorLevel <= level || 2 * compactSize >= fullSize ) {
+		cout << "FAILED: compact file of " << compactSize << " bytes at level " << fileLevel << " (flags " << flags << "), full file of "
+				<< fullSize << " bytes, tensor at level " << tensorLevel << endl;
+		return false;
+	}
+	for ( long i = 0; i < (long) shape.capacity(); ++i ) {
+		if ( std::abs( ( *decrypted )[ i ] - ( *plain )[ i ] ) > 1e-3 ) {
+			cout << "FAILED: element " << i << " read back as " << ( *decrypted )[ i ] << " instead of " << ( *plain )[ i ] << endl;
+			return false;
+		}
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * Headers that do not fit their file have to be rejected before anything gets allocated for them: a ciphertext
+ * count that is not the capacity of the shape, offsets that shrink and a payload beyond the end of the file.
+ */
+bool HE_corruptTensorFileTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	auto rejects = []( const HETensorFileHeader& header, uint64_t payload ) {
+		std::ostringstream out( std::ios::out | std::ios::binary );
+		header.write( out );
+		std::string file = out.str() + std::string( payload, '\0' );
+		std::istringstream in( file, std::ios::in | std::ios::binary );
+		try {
+			HETensorFileHeader read;
+			read.read( in, file.size() );
+		} catch ( const std::runtime_error& ) {
+			return true;
+		}
+		return false;
+	};
+
+	HETensorFileHeader valid;
+	valid.shape = { 1, 2 };
+	valid.plainTextShape = { 4, 2 };
+	valid.offsets = { 0, 3, 6 };
+	HETensorFileHeader wrongCount = valid;
+	wrongCount.shape = { 1, 1u << 30 };
+	HETensorFileHeader shrinking = valid;
+	shrinking.offsets = { 0, 6, 3 };
+	HETensorFileHeader beyondEnd = valid;
+	beyondEnd.offsets = { 0, 3, 7 };
+
+	if ( rejects( valid, 6 ) || !rejects( wrongCount, 6 ) || !rejects( shrinking, 6 ) || !rejects( beyondEnd, 6 ) ) {
+		cout << "FAILED: valid " << rejects( valid, 6 ) << ", wrong count " << rejects( wrongCount, 6 ) << ", shrinking offsets "
+				<< rejects( shrinking, 6 ) << ", payload beyond the end " << rejects( beyondEnd, 6 ) << " rejected" << endl;
+		return false;
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * Refreshes through a key holder process: with a minimum noise budget no fresh ciphertext reaches every ciphertext
+ * gets refreshed in a single round trip and keeps its value, with a minimum of 0 bits none does. The key holder is
+ * spawned while the ThreadPool and the threads of the zero pool run.
+ */
+bool HE_keyHolderRefreshTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( /*L*/4096, /*m*/2 * 4, /*r*/32 );
+	ctxtFactory.precomputeZeros( 2 );
+	auto keyHolder = std::make_shared<KeyHolder<HELibCipherText>>( &ctxtFactory );
+	ctxtFactory.useKeyHolder( keyHolder );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<double> ptFactory;
+
+	Shape shape( { ctxtFactory.batchsize(), 3, 2 } );
+	TensorP<double> plain = ptFactory.create( shape );
+	plain->init();
+	for ( long i = 0; i < (long) shape.capacity(); ++i )
+		( *plain )[ i ] = ( i % 11 ) / 2.;
+	TensorP<HELibCipherText> encrypted = hetfactory.create( shape );
+	ctxtFactory.feedCipherTensor( plain, encrypted );
+
+	ctxtFactory.enableRefreshOnHighNoise( 0 );
+	encrypted->performChecks();
+	long roundTripsUnneeded = keyHolder->statistics().roundTrips;
+	ctxtFactory.enableRefreshOnHighNoise( 1e9 );
+	encrypted->performChecks();
+	auto statistics = keyHolder->statistics();
+	cout << "refreshed " << statistics.cipherTexts << " ciphertexts in " << statistics.roundTrips << " round trips, "
+			<< statistics.bytesSent << " bytes sent, " << statistics.bytesReceived << " bytes received, " << statistics.seconds << "s" << endl;
+	ctxtFactory.useKeyHolder( nullptr );
+
+	if ( roundTripsUnneeded != 0 || statistics.roundTrips != 1 || statistics.cipherTexts != (long) encrypted->shape.capacity() ) {
+		cout << "FAILED: " << roundTripsUnneeded << " round trips without stale ciphertexts" << endl;
+		return false;
+	}
+	TensorP<double> decrypted = std::dynamic_pointer_cast<HETensor<HELibCipherText>>( encrypted )->decryptDouble();
+	for ( long i = 0; i < (long) shape.capacity(); ++i ) {
+		if ( std::abs( ( *decrypted )[ i ] - ( *plain )[ i ] ) > 1e-3 ) {
+			cout << "FAILED: element " << i << " refreshed to " << ( *decrypted )[ i ] << " instead of " << ( *plain )[ i ] << endl;
+			return false;
+		}
+	}
+	cout << "Passed " << endl;
+	return true;
+}
+
+/**
+ * With bootstrapping keys the first two refreshes bootstrap, the first one as the warm-up and the second one to
+ * measure it, the next two go to the secret key the same way, and from then on the cheaper one gets picked. The
+ * values survive all of them.
+ */
+bool HE_bootstrapRefreshTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( HELibBootstrappingParameters { } );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<long> ptFactory;
+	const uint bs = ctxtFactory.batchsize();
+
+	std::vector<std::vector<HELibCipherText>> inputVector( 1 );
+	TensorP<long> expected = ptFactory.create( Shape( { bs, 4 } ) );
+	expected->init();
+	for ( uint i = 0; i < 4; ++i ) {
+		std::vector<long> slots( bs );
+		for ( uint b = 0; b < bs; ++b ) {
+			slots[ b ] = ( i + b ) % 2;
+			( *expected )[ (long) ( b * 4 + i ) ] = slots[ b ];
+		}
+		inputVector[ 0 ].push_back( ctxtFactory.createCipherText( slots ) );
+	}
+	TensorP<HELibCipherText> encrypted = hetfactory.create( Shape( { bs, 4 } ) );
+	encrypted->init( inputVector );
+
+	ctxtFactory.enableRefreshOnHighNoise( 1e9 ); // every ciphertext is stale
+	encrypted->performChecks();
+	encrypted->performChecks();
+	long bootstrapped = ctxtFactory.bootstrapCost().batches;
+	encrypted->performChecks();
+	encrypted->performChecks();
+	long refreshed = ctxtFactory.clientRefreshCost().batches;
+	bool bootstrapCheaper = ctxtFactory.bootstrapCost().perCipherText() <= ctxtFactory.clientRefreshCost().perCipherText();
+	encrypted->performChecks();
+	cout << "bootstrapping " << ctxtFactory.bootstrapCost().perCipherText() << "s, client refresh "
+			<< ctxtFactory.clientRefreshCost().perCipherText() << "s per ciphertext" << endl;
+
+	if ( bootstrapped != 2 || refreshed != 2 || ctxtFactory.bootstrapCost().cipherTexts + ctxtFactory.clientRefreshCost().cipherTexts != 20 ) {
+		cout << "FAILED: the first two refreshes bootstrapped " << bootstrapped << " batches, the next two refreshed " << refreshed << endl;
+		return false;
+	}
+	if ( ( bootstrapCheaper ? ctxtFactory.bootstrapCost().batches : ctxtFactory.clientRefreshCost().batches ) != 3 ) {
+		cout << "FAILED: fifth refresh did not pick " << ( bootstrapCheaper ? "bootstrapping" : "the client refresh" ) << endl;
+		return false;
+	}
+	TensorP<long> decrypted = std::dynamic_pointer_cast<HETensor<HELibCipherText>>( encrypted )->decryptLong();
+	return finishTest<long, long>( decrypted, expected, __func__ );
+}
+
+/**
+ * Two dense layers on integers with a plaintext space of 8 bits, the output of every layer gets bootstrapped by its
+ * checks (the first two batches of refreshes always bootstrap). The result has to match the same layers on plain longs.
+ */
+bool HE_bootstrapDenseTest1() {
+	cout << "Running " << __func__ << " " << endl;
+
+	HELibCipherTextFactory ctxtFactory( HELibBootstrappingParameters::forValueBits( 8 ) );
+	HETensorFactory<HELibCipherText> hetfactory( &ctxtFactory );
+	PlainTensorFactory<long> ptFactory;
+	const uint bs = ctxtFactory.batchsize();
+
+	TensorP<long> plainInput = ptFactory.create( Shape( { bs, 4 } ) );
+	plainInput->init();
+	std::vector<std::vector<HELibCipherText>> inputVector( 1 );
+	for ( uint i = 0; i < 4; ++i ) {
+		std::vector<long> slots( bs );
+		for ( uint b = 0; b < bs; ++b ) {
+			slots[ b ] = ( i + b ) % 4;
+			( *plainInput )[ (long) ( b * 4 + i ) ] = slots[ b ];
+		}
+		inputVector[ 0 ].push_back( ctxtFactory.createCipherText( slots ) );
+	}
+	TensorP<HELibCipherText> input = hetfactory.create( Shape( { bs, 4 } ) );
+	input->init( inputVector );
+
+	TensorP<long> weights1 = ptFactory.create( Shape( { 3, 4 } ) );
+	weights1->init();
+	for ( long i = 0; i < 12; ++i )
+		( *weights1 )[ i ] = i % 3;
+	TensorP<long> weights2 = ptFactory.create( Shape( { 2, 3 } ) );
+	weights2->init();
+	for ( long i = 0; i < 6; ++i )
+		( *weights2 )[ i ] = i % 2 + 1;
+
+	// largest value: 3 * ( 4 * 3 * 2 + 1 ) * 2 + 1 = 151 < 2^8
+	Dense<long, long, PlainTensor<long>, PlainTensor<long>> plain1( "plain1", LinearActivation<long>::getSharedPointer(), 3, plainInput,
+			&ptFactory, &ptFactory );
+	plain1.output()->init();
+	Dense<long, long, PlainTensor<long>, PlainTensor<long>> plain2( "plain2", LinearActivation<long>::getSharedPointer(), 2, plain1.output(),
+			&ptFactory, &ptFactory );
+	plain2.output()->init();
+	Dense<HELibCipherText, long, HETensor<HELibCipherText>, PlainTensor<long>> layer1( "layer1", LinearActivation<HELibCipherText>::getSharedPointer(), 3,
+			input, &hetfactory, &ptFactory );
+	layer1.output()->init();
+	Dense<HELibCipherText, long, HETensor<HELibCipherText>, PlainTensor<long>> layer2( "layer2", LinearActivation<HELibCipherText>::getSharedPointer(), 2,
+			layer1.output(), &hetfactory, &ptFactory );
+	layer2.output()->init();
+	plain1.weights( weights1 );
+	layer1.weights( weights1 );
+	plain2.weights( weights2 );
+	layer2.weights( weights2 );
+	for ( auto layer : std::vector<Layer<long, long, PlainTensor<long>, PlainTensor<long>>*> { &plain1, &plain2 } ) {
+		layer->biases( ptFactory.ones( Shape( { layer->output()->shape[ 1 ] } ) ) );
+		layer->feedForward();
+	}
+
+	ctxtFactory.enableRefreshOnHighNoise( 1e9 ); // every output is stale
+	for ( auto layer : std::vector<Layer<HELibCipherText, long, HETensor<HELibCipherText>, PlainTensor<long>>*> { &layer1, &layer2 } ) {
+		layer->biases( ptFactory.ones( Shape( { layer->output()->shape[ 1 ] } ) ) );
+		layer->feedForward();
+		layer->output()->performChecks(); // Dense leaves the checks to the caller
+	}
+	if ( ctxtFactory.bootstrapCost().cipherTexts != 5 ) {
+		cout << "FAILED: bootstrapped " << ctxtFactory.bootstrapCost().cipherTexts << " ciphertexts instead of the 5 layer outputs" << endl;
+		return false;
+	}
+	TensorP<long> decrypted = std::dynamic_pointer_cast<HETensor<HELibCipherText>>( layer2.output() )->decryptLong();
+	return finishTest<long, long>( decrypted, plain2.output(), __func__ );
+}
@@ -31,4 +31,30 @@ bool HE_convTest1_ValidBatch_CKKS();
 
 bool HE_convTest2_Valid_CKKS();
 
+bool HE_globalAveragePoolingTest1_CKKS();
+
+bool HE_lazyRelinearizationTest1();
+
+bool HE_parameterSelectionTest1();
+
+bool HE_planLevelsTest1();
+
+bool HE_feedDecryptTest1();
+
+bool HE_randomStreamsTest1();
+
+bool HE_precomputedZerosTest1();
+
+bool HE_tensorFileTest1();
+
+bool HE_compactTensorFileTest1();
+
+bool HE_corruptTensorFileTest1();
+
+bool HE_keyHolderRefreshTest1();
+
+bool HE_bootstrapRefreshTest1();
+
+bool HE_bootstrapDenseTest1();
+
 #endif /* TEST_HEBACKENDTESTS_H_ */
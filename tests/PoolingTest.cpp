@@ -538,3 +538,74 @@ bool oddPoolSameRangeTest3() {
 	//compare output w/ expected output
 	return finishTest( pool.output(), expectedOutput, __func__ );
 }
+
+/**
+ * Runs a convolution followed by a 2x2 average pooling once as seperate layers and once
+ * fused into the convolution and compares the outputs.
+ */
+bool fusedConvPoolTest( PADDING_MODE convPad, std::string testName ) {
+	PlainTensorFactory<float> factory;
+	TensorP<float> data = factory.range( Shape( { 2, 2, 7, 7 } ) );
+	TensorP<float> weights = factory.range( Shape( { 3, 2, 3, 3 } ) );
+	TensorP<float> biases = factory.range( Shape( { 3 } ) );
+
+	std::vector<TensorP<float>> outputs;
+	for ( auto usage : { MemoryUsage::greedy, MemoryUsage::greedy | MemoryUsage::fuse_layers } ) {
+		Model<float, float, PlainTensor<float>, PlainTensor<float>> model( usage, &factory, &factory );
+		model.addLayer( std::make_shared<Convolution2D<float, float, PlainTensor<float>, PlainTensor<float>>>( "conv",
+				SquareActivation<float>::getSharedPointer(), 3, 3, 1, convPad, factory.create( data->shape ), &factory, &factory ) );
+		model.addLayer( std::make_shared<AveragePooling<float, float, PlainTensor<float>, PlainTensor<float>>>( "pool", 2, 2, PADDING_MODE::VALID ) );
+		if ( ( usage & MemoryUsage::fuse_layers ) && model.layers().size() != 1 ) {
+			cout << "pooling did not get fused" << endl;
+			return false;
+		}
+		model.layers().front()->weights( weights );
+		model.layers().front()->biases( biases );
+		model.input()->feed( *data );
+		model.run();
+		outputs.push_back( model.output() );
+	}
+
+	return finishTest( outputs[ 1 ], outputs[ 0 ], testName );
+}
+
+bool fusedConvPoolValidTest1() {
+	cout << "Running " << __func__ << " " << flush;
+	return fusedConvPoolTest( PADDING_MODE::VALID, __func__ );
+}
+
+bool fusedConvPoolSameTest1() {
+	cout << "Running " << __func__ << " " << flush;
+	return fusedConvPoolTest( PADDING_MODE::SAME, __func__ );
+}
+
+bool globalPoolOnesTest1() {
+	cout << "Running " << __func__ << " " << flush;
+	PlainTensorFactory<float> dataFactory, weightFactory;
+
+	TensorP<float> input = dataFactory.onesAndInit( { 2, 3, 5, 5 } );
+	TensorP<float> expectedOutput = dataFactory.ones( Shape( { 2, 3 } ) );
+
+	GlobalAveragePooling2D<float, float, PlainTensor<float>, PlainTensor<float>> pool( "test", input, &dataFactory, &weightFactory );
+	pool.output()->init();
+	pool.feedForward();
+
+	return finishTest( pool.output(), expectedOutput, __func__ );
+}
+
+bool globalPoolRangeTest1() {
+	cout << "Running " << __func__ << " " << flush;
+	PlainTensorFactory<float> dataFactory, weightFactory;
+
+	// every channel holds 16 consecutive numbers starting at 16 * ( batch * channels + channel )
+	TensorP<float> input = dataFactory.range( Shape( { 2, 3, 4, 4 } ) );
+	vector<vector<float>> expectedOutputV { { 7.5, 23.5, 39.5 }, { 55.5, 71.5, 87.5 } };
+	TensorP<float> expectedOutput = dataFactory.create( Shape( { 2, 3 } ) );
+	expectedOutput->init( expectedOutputV );
+
+	GlobalAveragePooling2D<float, float, PlainTensor<float>, PlainTensor<float>> pool( "test", input, &dataFactory, &weightFactory );
+	pool.output()->init();
+	pool.feedForward();
+
+	return finishTest( pool.output(), expectedOutput, __func__ );
+}
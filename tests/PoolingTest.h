@@ -42,5 +42,11 @@ bool oddPoolSameRangeTest1();
 bool oddPoolSameRangeTest2();
 bool oddPoolSameRangeTest3();
 
+bool fusedConvPoolValidTest1();
+bool fusedConvPoolSameTest1();
+
+bool globalPoolOnesTest1();
+bool globalPoolRangeTest1();
+
 
 #endif /* TEST_POOLINGTEST_H_ */
@@ -12,6 +12,9 @@
 #include "../src/architecture/ActivationFunction.h"
 #include "../src/architecture/Layer.h"
 #include "../src/architecture/PlainTensor.h"
+#include "../src/architecture/Model.h"
+#include <cstdlib>
+#include <fstream>
 
 
 
@@ -107,3 +110,53 @@ bool rnnTest3() {
 
 }
 
+/**
+ * An RNN whose input and recurrent weights are half zeros, loaded from weight files with and without
+ * sparse_weights. The sparse kernels have to give the same last state as the dense ones.
+ */
+bool sparseRnnTest1() {
+	std::cout << "Running " << __func__ << " " << std::flush;
+	uint datadim = 4;
+	uint timesteps = 3;
+	uint units = 3;
+	char dir[] = "/tmp/sparseRnnTestXXXXXX";
+	if ( !mkdtemp( dir ) ) {
+		std::cout << "can not create the weight directory" << std::endl;
+		return false;
+	}
+	std::string path = std::string( dir ) + "/";
+	for ( uint u = 0; u < units; ++u ) {
+		std::ofstream weights( path + "rnn_" + std::to_string( u ) + ".txt" );
+		for ( uint i = 0; i < datadim; ++i )
+			weights << ( ( u + i ) % 2 == 0 ? u + i + 1 : 0 ) << " ";
+		std::ofstream recurrent( path + "rnn_recurrent_" + std::to_string( u ) + ".txt" );
+		for ( uint i = 0; i < units; ++i )
+			recurrent << ( u == i ? 1 : 0 ) << " ";
+	}
+	std::ofstream( path + "rnn_bias.txt" ) << "1 0 -1";
+
+	PlainTensorFactory<float> factory;
+	auto data = factory.range( Shape( { 1, timesteps, datadim } ) );
+	std::vector<TensorP<float>> outputs;
+	for ( auto usage : { MemoryUsage::greedy, MemoryUsage::greedy | MemoryUsage::sparse_weights } ) {
+		Model<float, float, PlainTensor<float>, PlainTensor<float>> model( usage, &factory, &factory );
+		model.addLayer( std::make_shared<RNN<float, float, PlainTensor<float>, PlainTensor<float>>>( "rnn",
+				LinearActivation<float>::getSharedPointer(), units, false, factory.create( data->shape ), &factory,
+				&factory ) );
+		model.loadWeights( path );
+		auto sparse = model.layers().front()->sparseWeights();
+		if ( ( usage & MemoryUsage::sparse_weights ) && ( !sparse || sparse->nonZeros() != 6 ) ) {
+			std::cout << "zero weights did not get dropped" << std::endl;
+			return false;
+		}
+		model.input()->feed( *data );
+		model.run();
+		outputs.push_back( model.output() );
+	}
+	for ( std::string file : { "rnn_bias.txt", "rnn_0.txt", "rnn_1.txt", "rnn_2.txt", "rnn_recurrent_0.txt",
+			"rnn_recurrent_1.txt", "rnn_recurrent_2.txt" } )
+		std::remove( ( path + file ).c_str() );
+	std::remove( dir );
+
+	return finishTest( outputs[ 1 ], outputs[ 0 ], __func__ );
+}
@@ -11,5 +11,6 @@
 bool rnnTest1();
 bool rnnTest2();
 bool rnnTest3();
+bool sparseRnnTest1();
 
 #endif /* TEST_RNNTEST_H_ */
@@ -13,10 +13,13 @@
 #include "HEBackendTests.h"
 #include "RNNTest.h"
 #include "PoolingTest.h"
+#include "../src/architecture/HEBackend/KeyHolder.h"
+#include "../src/architecture/HEBackend/helib/HELIbCipherText.h"
 
 
 
 int main(int argc, char **argv) {
+	KeyHolder<HELibCipherText>::serveIfSpawned(); // HE_keyHolderRefreshTest1 spawns this executable as its key holder
 
 	bool success = true;
 
@@ -42,6 +45,17 @@ int main(int argc, char **argv) {
 	success &= convTest_strides_validPad_1(); //works
 	success &= convTest_multiple_channels_non_unit_stride_validPad_1(); //CAUSES ERROR
 
+	success &= depthwiseConvTest1_validPad();
+	success &= depthwiseConvTest2_samePad();
+	success &= separableConvTest1();
+	success &= sparseConvTest1_validPad();
+	success &= sparseConvTest2_samePad();
+	success &= clusteredConvTest1_samePad();
+	success &= integerWeightsConvTest1_validPad();
+	success &= fixedConvKernelTest1();
+	success &= inputStationaryConvTest1();
+	success &= encodedWeightsConvTest1();
+
 
 	success &= completeNetworkTestLong();
 	success &= completeNetworkTestHELibBFV();
@@ -59,6 +73,15 @@ int main(int argc, char **argv) {
 	success &=  flattenTest4();
 	success &= denseTest1();
 	success &= denseTest2();
+	success &= fusedDenseActivationTest1();
+	success &= foldLinearLayersTest1();
+	success &= batchNormalizationFoldTest1();
+	success &= sparseDenseTest1();
+	success &= clusteredDenseTest1();
+	success &= factorizeDenseTest1();
+	success &= integerWeightsDenseTest1();
+	success &= parallelismDenseTest1();
+	success &= planLevelsDenseTest1();
 
 
 	success &= convTest_validPad_secondLayer_cryptonet();
@@ -74,6 +97,7 @@ int main(int argc, char **argv) {
 	success &= rnnTest1();
 	success &= rnnTest2();
 	success &= rnnTest3();
+	success &= sparseRnnTest1();
 
 	success &= HE_convTest1_samePad_CKKS();
 	success &= HE_convTest1_samePadBatch_CKKS();
@@ -81,6 +105,19 @@ int main(int argc, char **argv) {
 	success &= compareLayerByLayerEncryptedFloat();
 	success &= HE_convTest1_ValidBatch_CKKS();
 	success &= HE_convTest2_Valid_CKKS();
+	success &= HE_globalAveragePoolingTest1_CKKS();
+	success &= HE_lazyRelinearizationTest1();
+	success &= HE_parameterSelectionTest1();
+	success &= HE_planLevelsTest1();
+	success &= HE_feedDecryptTest1();
+	success &= HE_randomStreamsTest1();
+	success &= HE_precomputedZerosTest1();
+	success &= HE_tensorFileTest1();
+	success &= HE_compactTensorFileTest1();
+	success &= HE_corruptTensorFileTest1();
+	success &= HE_keyHolderRefreshTest1();
+	success &= HE_bootstrapRefreshTest1();
+	success &= HE_bootstrapDenseTest1();
 	success &= compareLayerByLayerEncryptedFloat();
 	success &= compareLayerByLayerEncryptedFloat();
 	success &= HE_SamePaddFloats();
@@ -105,6 +142,10 @@ int main(int argc, char **argv) {
 	success &= oddPoolSameRangeTest1();
 	success &= oddPoolSameRangeTest2();
 	success &= oddPoolSameRangeTest3();
+	success &= fusedConvPoolValidTest1();
+	success &= fusedConvPoolSameTest1();
+	success &= globalPoolOnesTest1();
+	success &= globalPoolRangeTest1();
 
 
 	if(success){